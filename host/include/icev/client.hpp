@@ -0,0 +1,398 @@
+/*
+ * client.hpp - host client for the ICE-V socket protocol
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ *
+ * One Client keeps one connection open and sends every request with the
+ * tagged header so any number can be in flight. Replies are matched up by
+ * a reader thread and complete the returned futures (or callbacks) in the
+ * order the board sends them.
+ *
+ * Register reads and writes issued while an earlier send is still going
+ * out are collected and sent as a single sequence (cmd 5) so bursts of
+ * small operations cost one round trip and one SPI job on the board.
+ *
+ * Spans passed to psram_read(), psram_write(), playback(), save_bitstream(),
+ * configure() and update_firmware() are used in place - no copy is made -
+ * so they must stay valid until the future is ready.
+ */
+
+#ifndef __ICEV_CLIENT__
+#define __ICEV_CLIENT__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "icev/streams.hpp"
+
+namespace icev {
+
+constexpr uint16_t default_port = 3333;
+
+/* bits of the reply status byte */
+constexpr uint8_t err_alloc = 1;
+constexpr uint8_t err_extra = 2;
+constexpr uint8_t err_header = 4;
+constexpr uint8_t err_command = 8;
+constexpr uint8_t err_bitstream = 0x10;	// rejected before the FPGA was touched
+
+/* non-zero reply status, or the connection failing under a request */
+class Error : public std::runtime_error
+{
+public:
+	Error(uint8_t status, const std::string &what) :
+		std::runtime_error(what), status_(status) {}
+	uint8_t status() const noexcept { return status_; }
+private:
+	uint8_t status_;
+};
+
+/* a raw reply - status byte and whatever followed it */
+struct Reply
+{
+	uint8_t err = 0;
+	std::vector<uint8_t> data;
+};
+
+/* cmd 4 */
+struct WaitResult
+{
+	uint32_t value;
+	uint32_t iters;
+	uint32_t elapsed_us;
+};
+
+/* cmd 5 */
+constexpr int seq_slots = 16;
+struct SeqResult
+{
+	uint32_t status;
+	uint32_t pc;
+	uint32_t elapsed_us;
+	std::array<uint32_t, seq_slots> slots;
+	std::vector<uint8_t> read_data;
+};
+
+/* cmd 7 */
+struct PlaybackArgs
+{
+	uint32_t mode;			// 0 = PSRAM ring, 1 = FPGA FIFO
+	uint32_t base;			// ring base address or FIFO data register
+	uint32_t size;			// ring size in bytes, unused for FIFO
+	uint32_t credit_reg;	// free space: bytes for ring, words for FIFO
+	uint32_t wptr_reg;		// ring write pointer register, unused for FIFO
+};
+struct PlaybackResult
+{
+	uint32_t total;
+	uint32_t elapsed_us;
+	uint32_t underruns;
+	uint32_t stalls;
+	uint32_t kbytes_per_sec;
+};
+
+/* cmd 8 groups and their reports - layouts match the firmware */
+enum class StatsGroup : uint32_t { pool = 0, storage = 1, config = 2, cache = 3, ps = 4, timesync = 5, regmap = 6 };
+struct PoolStats
+{
+	uint32_t size, count, in_use, peak, allocs, fails;
+};
+struct StorageStats
+{
+	uint32_t backend, mount_us, total, used, writes, wr_bytes, wr_us, rd_bytes, rd_us;
+};
+struct ConfigStats
+{
+	uint32_t count, fails, status, clk_hz, bytes, reset_us, clear_us, data_us,
+		done_us, done_clks, total_us;
+};
+struct CacheStats
+{
+	uint32_t arena, used, entries, raw_bytes, hits, flash_hits, misses, inserts,
+		evictions, too_big, config_us;
+};
+
+/* cmd 0x10 - power save modes are the board's wifi_ps_type_t */
+enum class PsMode : uint32_t { none = 0, min_modem = 1, max_modem = 2 };
+constexpr uint32_t ps_auto = 0xFFFFFFFF;	// pin: let the governor decide
+constexpr uint32_t ps_keep = 0xFFFFFFFF;	// other fields: leave as is
+struct PsConfig
+{
+	uint32_t pin = ps_auto;
+	uint32_t idle_mode = ps_keep;
+	uint32_t idle_ms = ps_keep;
+	uint32_t boost_bps = ps_keep;
+};
+struct PsState
+{
+	PsMode mode;
+	PsConfig config;
+};
+struct PsStats
+{
+	uint32_t mode;
+	PsConfig config;
+	uint32_t switches;
+	struct { uint32_t entries, time_ms, requests, lat_avg_us, lat_max_us; } per_mode[3];
+};
+
+/* cmd 0x1e/0x1f - board clocks follow icev_timesrv, which serves server_time_us() */
+constexpr uint16_t timesync_port = 3334;
+uint64_t server_time_us();
+struct SyncStats
+{
+	int64_t offset_us;		// server time minus board time
+	int32_t drift_ppb;
+	uint32_t rtt_us;		// best round trip of the last sync
+	uint32_t server;		// IPv4, network order
+	uint32_t port, interval_ms;
+	uint32_t samples;		// syncs in the drift fit, 0 until synced
+	uint32_t syncs, fails, age_ms;
+	uint32_t sched;			// timed commands run
+	uint32_t late;			// started more than 500 us late
+	int32_t last_err_us;	// start minus target of the last one
+	uint32_t max_err_us;
+};
+
+/* cmd 0x20/0x21 - how the board treats reads of each register */
+enum class RegClass : uint32_t
+{
+	direct = 0,			// always read the hardware - the default
+	cached = 1,			// write-through shadow, reads don't touch the bus
+	write_only = 2,		// reads return the last write
+};
+struct RegRange
+{
+	uint32_t first, count;
+	RegClass cls;
+};
+constexpr size_t reg_count = 128;
+struct RegShadow
+{
+	std::array<RegClass, reg_count> cls;
+	std::array<uint32_t, reg_count> value;
+	std::array<bool, reg_count> valid;		// the board holds a value
+};
+struct RegmapStats
+{
+	uint32_t hits, misses, reads, writes, invalidates, loads;
+	uint32_t cached, write_only, valid;
+};
+
+/* cmd 0x11 - timestamps are the low word of the board's microsecond clock */
+struct TraceRecord
+{
+	uint32_t ts_us, id, a, b;
+};
+struct TraceDump
+{
+	uint32_t now_us;	// clock when the ring was read
+	uint32_t lost;		// records overwritten before they were read
+	std::vector<TraceRecord> records;
+};
+
+/* name and argument names of a trace ID, nullptr if this build doesn't know it */
+struct TraceId
+{
+	const char *name, *a, *b;
+};
+const TraceId *trace_id(uint32_t id);
+
+/* cmd 0x12 - on-device SPI benchmark */
+enum class BenchTest : uint32_t { psram = 0, reg = 1 };
+constexpr uint32_t bench_slow_read = 1;		// PSRAM flags: read with 0x03
+constexpr uint32_t bench_fast_read = 2;		// read with 0x0B
+constexpr uint32_t bench_verify = 1;		// register flags: read back writes
+struct BenchArgs
+{
+	BenchTest test = BenchTest::psram;
+	uint32_t addr = 0;					// PSRAM address or register
+	uint32_t total = 64 * 1024;			// PSRAM bytes (up to 1 MB) or register accesses (up to 10000) per point
+	uint32_t sizes = 0x3554;			// bit n tests 2^n byte transactions (4B, 16B ... 4kB, 8kB)
+	uint32_t flags = bench_slow_read;
+	std::vector<uint32_t> clocks_hz;	// empty runs at the current clock
+};
+struct BenchRow
+{
+	uint32_t req_hz, clk_hz;	// clk_hz 0 if the board couldn't run at req_hz
+	uint32_t rd_cmd, size, count;
+	uint32_t wr_rate, rd_rate;	// kB/s for PSRAM, accesses/s for registers
+	uint32_t wr_ovh_ns, rd_ovh_ns;
+	uint32_t errors;
+};
+
+/* cmd 0x13-0x15 - network self-test as timed on the board */
+struct NetStats
+{
+	uint32_t bytes, us, kbytes_per_sec;
+	uint32_t calls;			// recv() or send() calls on the board
+	uint32_t stalls;		// gaps long enough to be retransmit timeouts
+	uint32_t max_gap_us;
+	uint32_t tcp_wnd, tcp_snd_buf, tcp_mss;		// the board's lwIP settings
+};
+
+/* cmd 0x17/0x18 - one region of a PSRAM gather or scatter */
+struct PsramRegion
+{
+	uint32_t addr;
+	uint32_t len;
+};
+constexpr uint32_t psram_max_regions = 1024;
+constexpr uint32_t sg_ok = 0;
+constexpr uint32_t sg_range = 1;	// past the end of PSRAM, skipped
+constexpr uint32_t sg_short = 2;	// scatter data ran out
+
+/* cmd 0x16 - session capture, see session_fmt.h for the capture layout */
+enum class SessionState : uint32_t { idle = 0, armed = 1, recording = 2, done = 3 };
+constexpr uint32_t session_overflow = 1;	// capture stopped when it filled up
+struct SessionStatus
+{
+	SessionState state;
+	uint32_t used;			// capture bytes, file header included
+	uint32_t size;
+	uint32_t flags;
+	uint32_t records;
+};
+
+/* cmd 9 */
+struct OtaResult
+{
+	uint32_t written;
+	uint32_t elapsed_ms;
+};
+
+/* cmd 0xa - where the board found the bitstream */
+enum class ConfigSource : uint32_t { ram = 0, flash = 1, miss = 2 };
+
+/* cmd 0x1c/0x1d - configure now, write to flash in the background */
+struct PersistJob
+{
+	uint32_t seq;		// job number to look for in PersistStatus
+	uint32_t crc;
+};
+enum class PersistState : uint32_t { idle = 0, writing = 1, done = 2, failed = 3 };
+struct PersistStatus
+{
+	PersistState state;
+	uint32_t seq;		// latest job
+	uint32_t crc;
+	uint32_t bytes;
+	uint32_t result;	// esp_err_t of the write
+	uint32_t write_us;
+};
+
+/* CRC32 as the board computes it (same as zlib / linux crc32) */
+uint32_t crc32(std::span<const std::byte> data);
+
+class Client
+{
+public:
+	using Callback = std::function<void(Reply, std::exception_ptr)>;
+
+	explicit Client(std::string host, uint16_t port = default_port);
+	~Client();
+	Client(const Client &) = delete;
+	Client &operator=(const Client &) = delete;
+
+	/* the connection is opened on first use and again after it drops */
+	void connect();
+	void close();
+	bool connected() const;
+
+	/* collect register ops into sequences while a send is busy - on by default */
+	void set_batching(bool on);
+
+	/* raw access to any command */
+	std::future<Reply> request(uint8_t cmd, std::span<const std::byte> payload = {});
+	void request(uint8_t cmd, std::span<const std::byte> payload, Callback done);
+
+	/* one call per command */
+	std::future<uint32_t> read_reg(uint8_t reg);
+	std::future<void> write_reg(uint8_t reg, uint32_t value);
+	std::future<uint32_t> vbat_mv();
+	/* timeout up to 10 s, and up to 10 ms if interval_us is under 10 ms */
+	std::future<WaitResult> wait_reg(uint8_t reg, uint32_t mask, uint32_t expect,
+		uint32_t interval_us, uint32_t timeout_us);
+	std::future<SeqResult> run_sequence(std::span<const std::byte> prog);
+	std::future<SeqResult> store_boot_sequence(std::span<const std::byte> prog);
+	std::future<SeqResult> run_boot_sequence();
+	std::future<SeqResult> erase_boot_sequence();
+	std::future<PlaybackResult> playback(const PlaybackArgs &args,
+		std::span<const std::byte> data);
+	std::future<std::vector<uint8_t>> stats(StatsGroup group);
+	std::future<std::vector<PoolStats>> pool_stats();
+	std::future<StorageStats> storage_stats();
+	std::future<ConfigStats> config_stats();
+	std::future<CacheStats> cache_stats();
+	std::future<PsStats> ps_stats();
+	std::future<OtaResult> update_firmware(std::span<const std::byte> image);
+	std::future<ConfigSource> configure_by_crc(uint32_t crc);
+	std::future<void> psram_read(uint32_t addr, std::span<std::byte> dest);
+	std::future<void> psram_write(uint32_t addr, std::span<const std::byte> data);
+	/* dest and data hold the regions back to back - result is a status per region */
+	std::future<std::vector<uint32_t>> psram_gather(std::span<const PsramRegion> regions,
+		std::span<std::byte> dest);
+	std::future<std::vector<uint32_t>> psram_scatter(std::span<const PsramRegion> regions,
+		std::span<const std::byte> data);
+	/* run on the board - an empty pattern clears, the CRC matches crc32() */
+	std::future<void> psram_fill(uint32_t addr, uint32_t len, std::span<const std::byte> pattern = {});
+	std::future<void> psram_copy(uint32_t dst, uint32_t src, uint32_t len);
+	std::future<uint32_t> psram_crc(uint32_t addr, uint32_t len);
+	std::future<void> save_bitstream(std::span<const std::byte> bits);
+	std::future<void> configure(std::span<const std::byte> bits);
+	std::future<PersistJob> configure_persist(std::span<const std::byte> bits);
+	/* wait_ms > 0 holds the reply until the write ends or the time is up (10 s max) */
+	std::future<PersistStatus> persist_status(uint32_t wait_ms = 0);
+	/* sync to a time server now and every interval - an empty server stops */
+	std::future<SyncStats> time_sync(const std::string &server, uint16_t port = timesync_port,
+		uint32_t interval_ms = 10000);
+	std::future<SyncStats> sync_now();
+	std::future<SyncStats> sync_stats();
+	/* run a command when the server clock reaches server_us, up to 30 s ahead */
+	std::future<Reply> run_at(uint64_t server_us, uint8_t cmd, std::span<const std::byte> payload = {});
+	std::future<void> write_reg_at(uint64_t server_us, uint8_t reg, uint32_t value);
+	/* replaces the whole map and empties the shadow - an empty map clears it */
+	std::future<void> load_regmap(std::span<const RegRange> map);
+	std::future<RegShadow> regmap_dump();
+	std::future<RegmapStats> regmap_stats();
+	std::future<PsState> power_save(const PsConfig &config);
+	std::future<PsState> power_save();
+	std::future<TraceDump> trace(bool clear = false);
+	std::future<std::vector<BenchRow>> bench(const BenchArgs &args);
+	std::future<NetStats> net_sink(std::span<const std::byte> data);
+	std::future<NetStats> net_source(uint32_t bytes);
+	std::future<NetStats> net_echo(std::span<const std::byte> data);
+	std::future<SessionStatus> session_arm(uint32_t size = 64 * 1024);
+	std::future<SessionStatus> session_stop();
+	std::future<SessionStatus> session_status();
+	std::future<SessionStatus> session_free();
+	std::future<std::vector<uint8_t>> session_read(uint32_t offset, uint32_t len);
+
+	/* configure by CRC and only upload the bitstream on a miss */
+	ConfigSource configure_cached(std::span<const std::byte> bits);
+
+	/* the whole capture, read in as many requests as it takes */
+	std::vector<uint8_t> session_download();
+
+	/* these take over a connection of their own */
+	EventStream subscribe(uint8_t status_reg);
+	CaptureStream capture(const CaptureArgs &args);
+
+	struct Impl;
+private:
+	std::string host_;
+	uint16_t port_;
+	std::unique_ptr<Impl> impl_;
+};
+
+}
+
+#endif
@@ -0,0 +1,33 @@
+/*
+ * mdns.hpp - find boards advertising _FPGA._tcp
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __ICEV_MDNS__
+#define __ICEV_MDNS__
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace icev {
+
+struct Device
+{
+	std::string instance;	// service instance name
+	std::string hostname;	// e.g. ICE-V.local
+	std::string address;	// dotted IPv4
+	uint16_t port = 0;
+	std::map<std::string, std::string> txt;
+};
+
+/* multicast one query and collect answers for the given time */
+std::vector<Device> discover(std::chrono::milliseconds wait = std::chrono::milliseconds(1000),
+	const std::string &service = "_FPGA._tcp.local");
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * streams.hpp - connections dedicated to event and capture streams
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __ICEV_STREAMS__
+#define __ICEV_STREAMS__
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace icev {
+
+/* one FPGA interrupt */
+struct Event
+{
+	uint32_t seq;
+	int64_t time_us;	// board esp_timer time of the IRQ edge
+	uint32_t reg;
+	uint32_t status;
+};
+
+/* cmd 3 - frames arrive until the stream is closed */
+class EventStream
+{
+public:
+	EventStream(const std::string &host, uint16_t port, uint8_t status_reg);
+	~EventStream();
+	EventStream(EventStream &&other) noexcept;
+	EventStream(const EventStream &) = delete;
+
+	/* nothing if no event came within timeout */
+	std::optional<Event> next(std::chrono::milliseconds timeout);
+	void close();
+
+private:
+	int sock_;
+};
+
+/* cmd 6 */
+struct CaptureArgs
+{
+	uint32_t mode;		// 0 = PSRAM ring, 1 = FPGA FIFO
+	uint32_t base;		// ring base address or FIFO data register
+	uint32_t size;		// ring size in bytes, unused for FIFO
+	uint32_t wptr_reg;	// ring write pointer or FIFO level register
+	uint32_t rptr_reg;	// ring read pointer register, unused for FIFO
+	uint32_t total;		// bytes to capture, 0 = until closed - whole words for FIFO
+};
+
+/* trailer sent when a capture finishes */
+struct CaptureSummary
+{
+	uint32_t overruns;
+	uint32_t sent;
+	uint32_t elapsed_us;
+};
+
+class CaptureStream
+{
+public:
+	CaptureStream(const std::string &host, uint16_t port, const CaptureArgs &args);
+	~CaptureStream();
+	CaptureStream(CaptureStream &&other) noexcept;
+	CaptureStream(const CaptureStream &) = delete;
+
+	/* next frame's data appended to out - false once the trailer arrives */
+	bool next(std::vector<std::byte> &out, uint32_t *overruns = nullptr);
+	const CaptureSummary &summary() const { return summary_; }
+	void close();
+
+private:
+	int sock_;
+	CaptureSummary summary_{};
+};
+
+}
+
+#endif
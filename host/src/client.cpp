@@ -0,0 +1,1059 @@
+/*
+ * client.cpp - host client for the ICE-V socket protocol
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "icev/client.hpp"
+#include "net.hpp"
+#include "sha256.hpp"
+#include "proto.h"
+
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace icev {
+
+/* sequence opcodes used for register batches - see main/seq.h */
+constexpr uint8_t seq_op_end = 0x00;
+constexpr uint8_t seq_op_write = 0x01;
+constexpr uint8_t seq_op_read = 0x02;
+constexpr size_t batch_max_ops = 64;
+
+/* reader buffer - big enough to catch a burst of small replies in one recv */
+constexpr size_t rx_buf_sz = 64 * 1024;
+
+uint32_t crc32(std::span<const std::byte> data)
+{
+	static uint32_t table[256];
+	static std::once_flag once;
+	uint32_t crc = 0xFFFFFFFF;
+
+	std::call_once(once, [] {
+		for(uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for(int k = 0; k < 8; k++)
+				c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+			table[i] = c;
+		}
+	});
+
+	for(std::byte b : data)
+		crc = table[(crc ^ (uint8_t)b) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
+/*
+ * throw if a reply says the command failed
+ */
+static void check(const Reply &r, const char *what, size_t need = 0)
+{
+	if(r.err & err_bitstream)
+		throw Error(r.err, std::string(what) + " failed, not a valid UP5K bitstream");
+	if(r.err)
+		throw Error(r.err, std::string(what) + " failed, status " + std::to_string(r.err));
+	if(r.data.size() < need)
+		throw Error(0, std::string(what) + " reply too short");
+}
+
+static std::vector<uint8_t> words(std::initializer_list<uint32_t> w)
+{
+	std::vector<uint8_t> v(4 * w.size());
+	size_t i = 0;
+
+	for(uint32_t x : w)
+		net::put32(&v[4 * i++], x);
+	return v;
+}
+
+static SeqResult parse_seq(const Reply &r)
+{
+	SeqResult s{};
+	const size_t fixed = 12 + 4 * seq_slots + 4;
+
+	if(r.data.size() < fixed)
+		throw Error(r.err, "sequence reply too short");
+	s.status = net::get32(&r.data[0]);
+	s.pc = net::get32(&r.data[4]);
+	s.elapsed_us = net::get32(&r.data[8]);
+	for(int i = 0; i < seq_slots; i++)
+		s.slots[i] = net::get32(&r.data[12 + 4 * i]);
+	s.read_data.assign(r.data.begin() + fixed, r.data.end());
+	return s;
+}
+
+/*
+ * buffered reads from the connection - large reads skip the buffer
+ */
+class RxBuf
+{
+public:
+	explicit RxBuf(int sock) : sock_(sock), buf_(rx_buf_sz) {}
+
+	void read(void *dst, size_t len)
+	{
+		uint8_t *d = (uint8_t *)dst;
+		size_t n = std::min(len, end_ - pos_);
+
+		memcpy(d, &buf_[pos_], n);
+		pos_ += n;
+		d += n;
+		len -= n;
+
+		if(len >= buf_.size() / 2)
+		{
+			net::recv_all(sock_, d, len);
+			return;
+		}
+
+		while(len)
+		{
+			ssize_t got = recv(sock_, buf_.data(), buf_.size(), 0);
+			if(got <= 0)
+			{
+				if((got < 0) && (errno == EINTR))
+					continue;
+				throw Error(0, "connection closed");
+			}
+			pos_ = 0;
+			end_ = got;
+			n = std::min(len, end_);
+			memcpy(d, buf_.data(), n);
+			pos_ = n;
+			d += n;
+			len -= n;
+		}
+	}
+
+private:
+	int sock_;
+	std::vector<uint8_t> buf_;
+	size_t pos_ = 0, end_ = 0;
+};
+
+struct Client::Impl
+{
+	/* what to do with a reply */
+	struct Pending
+	{
+		Callback done;
+		std::span<std::byte> dest;	// reply data is received straight here
+	};
+
+	/* register op waiting to be batched */
+	struct RegOp
+	{
+		bool read;
+		uint8_t reg;
+		uint32_t value;
+		std::function<void(uint32_t, std::exception_ptr)> done;
+	};
+
+	/* outgoing data - owned or borrowed from the caller */
+	struct Chunk
+	{
+		std::vector<uint8_t> own;
+		std::span<const std::byte> ref;
+	};
+
+	std::string host;
+	uint16_t port;
+	std::mutex mu;
+	int sock = -1, dead = -1;
+	std::thread reader;
+	std::map<uint32_t, Pending> pending;
+	uint32_t next_tag = 1;
+	std::deque<Chunk> out;
+	std::vector<RegOp> batch;
+	int batch_reads = 0;
+	bool sending = false, batching = true;
+
+	Impl(std::string h, uint16_t p) : host(std::move(h)), port(p) {}
+
+	~Impl()
+	{
+		std::unique_lock<std::mutex> lk(mu);
+		if(sock >= 0)
+			shutdown(sock, SHUT_RDWR);
+		lk.unlock();
+		if(reader.joinable())
+			reader.join();
+		if(sock >= 0)
+			::close(sock);
+		if(dead >= 0)
+			::close(dead);
+	}
+
+	/*
+	 * fail everything outstanding - called without the lock held
+	 */
+	static void fail(std::map<uint32_t, Pending> &p, std::exception_ptr e)
+	{
+		for(auto &kv : p)
+			kv.second.done(Reply{}, e);
+	}
+
+	/*
+	 * (re)connect - only the sender does this so no send is using the old socket
+	 */
+	void open(std::unique_lock<std::mutex> &lk)
+	{
+		if(reader.joinable())
+		{
+			if(reader.get_id() == std::this_thread::get_id())
+				reader.detach();
+			else
+			{
+				lk.unlock();
+				reader.join();
+				lk.lock();
+			}
+		}
+		if(dead >= 0)
+		{
+			::close(dead);
+			dead = -1;
+		}
+
+		sock = net::connect_tcp(host, port);
+		reader = std::thread(&Impl::read_loop, this, sock);
+	}
+
+	/*
+	 * match up replies as they arrive
+	 */
+	void read_loop(int s)
+	{
+		RxBuf rx(s);
+		uint8_t hdr[8];
+
+		try
+		{
+			while(1)
+			{
+				rx.read(hdr, sizeof(hdr));
+				uint32_t tag = net::get32(&hdr[0]), len = net::get32(&hdr[4]);
+				Pending p;
+				{
+					std::lock_guard<std::mutex> lk(mu);
+					auto it = pending.find(tag);
+					if(it == pending.end())
+						throw Error(0, "reply for unknown tag " + std::to_string(tag));
+					p = std::move(it->second);
+					pending.erase(it);
+				}
+
+				Reply r;
+				if(!len)
+					throw Error(0, "empty reply");
+				rx.read(&r.err, 1);
+				len--;
+				if(len && (len == p.dest.size()))
+					rx.read(p.dest.data(), len);
+				else
+				{
+					r.data.resize(len);
+					rx.read(r.data.data(), len);
+				}
+				p.done(std::move(r), nullptr);
+			}
+		}
+		catch(...)
+		{
+			std::map<uint32_t, Pending> lost;
+			{
+				std::lock_guard<std::mutex> lk(mu);
+				if(sock == s)
+				{
+					shutdown(s, SHUT_RDWR);
+					dead = s;
+					sock = -1;
+				}
+				lost.swap(pending);
+			}
+			fail(lost, std::current_exception());
+		}
+	}
+
+	/*
+	 * turn the open batch into a request - one op goes as a plain cmd
+	 */
+	void close_batch()
+	{
+		if(batch.empty())
+			return;
+
+		std::vector<RegOp> ops;
+		ops.swap(batch);
+		batch_reads = 0;
+
+		if(ops.size() == 1)
+		{
+			RegOp op = std::move(ops[0]);
+			auto done = std::move(op.done);
+			queue(op.read ? 0 : 1, op.read ? words({op.reg}) : words({op.reg, op.value}), {},
+				Pending{[done](Reply r, std::exception_ptr e) {
+					uint32_t v = 0;
+					if(!e)
+					{
+						try
+						{
+							check(r, "register op");
+							if(r.data.size() >= 4)
+								v = net::get32(r.data.data());
+						}
+						catch(...) { e = std::current_exception(); }
+					}
+					done(v, e);
+				}, {}});
+			return;
+		}
+
+		/* sequence program: op 0 = run */
+		std::vector<uint8_t> prog = words({0});
+		std::vector<uint32_t> offset, slot;
+		int reads = 0;
+		for(auto &op : ops)
+		{
+			offset.push_back(prog.size() - 4);
+			if(op.read)
+			{
+				slot.push_back(reads);
+				prog.insert(prog.end(), {seq_op_read, op.reg, (uint8_t)reads++});
+			}
+			else
+			{
+				slot.push_back(0);
+				prog.insert(prog.end(), {seq_op_write, op.reg});
+				prog.resize(prog.size() + 4);
+				net::put32(&prog[prog.size() - 4], op.value);
+			}
+		}
+		prog.push_back(seq_op_end);
+
+		auto shared = std::make_shared<std::vector<RegOp>>(std::move(ops));
+		queue(5, std::move(prog), {}, Pending{[shared, offset, slot](Reply r, std::exception_ptr e) {
+			SeqResult s{};
+			if(!e)
+			{
+				try { s = parse_seq(r); }
+				catch(...) { e = std::current_exception(); }
+			}
+
+			/* ops before a failing one still happened */
+			for(size_t i = 0; i < shared->size(); i++)
+			{
+				auto &op = (*shared)[i];
+				if(e)
+					op.done(0, e);
+				else if(s.status && (offset[i] >= s.pc))
+					op.done(0, std::make_exception_ptr(Error(r.err,
+						"batched register op failed, sequence status " + std::to_string(s.status))));
+				else
+					op.done(op.read ? s.slots[slot[i]] : 0, nullptr);
+			}
+		}, {}});
+	}
+
+	/*
+	 * add a request to the outgoing data - lock held
+	 */
+	void queue(uint8_t cmd, std::vector<uint8_t> pre, std::span<const std::byte> ref, Pending p)
+	{
+		uint32_t tag = next_tag++;
+		std::vector<uint8_t> hdr = words({PROTO_TAG_MAGIC | cmd,
+			(uint32_t)(pre.size() + ref.size()), tag});
+
+		hdr.insert(hdr.end(), pre.begin(), pre.end());
+		pending.emplace(tag, std::move(p));
+		out.push_back(Chunk{std::move(hdr), {}});
+		if(!ref.empty())
+			out.push_back(Chunk{{}, ref});
+	}
+
+	/*
+	 * send until nothing is left - whoever finds nobody sending does it so
+	 * anything queued meanwhile goes out together
+	 */
+	void pump(std::unique_lock<std::mutex> &lk)
+	{
+		if(sending)
+			return;
+		sending = true;
+
+		while(1)
+		{
+			close_batch();
+			if(out.empty())
+				break;
+
+			std::deque<Chunk> take;
+			take.swap(out);
+			try
+			{
+				if(sock < 0)
+					open(lk);
+			}
+			catch(...)
+			{
+				std::map<uint32_t, Pending> lost;
+				lost.swap(pending);
+				sending = false;
+				lk.unlock();
+				fail(lost, std::current_exception());
+				lk.lock();
+				return;
+			}
+
+			int s = sock;
+			lk.unlock();
+			std::vector<struct iovec> iov;
+			for(auto &c : take)
+			{
+				if(!c.own.empty())
+					iov.push_back({c.own.data(), c.own.size()});
+				else
+					iov.push_back({const_cast<std::byte *>(c.ref.data()), c.ref.size()});
+			}
+			try
+			{
+				net::sendv_all(s, iov.data(), iov.size());
+			}
+			catch(...)
+			{
+				/* the reader sees the shutdown and fails what's pending */
+				shutdown(s, SHUT_RDWR);
+			}
+			lk.lock();
+		}
+
+		sending = false;
+	}
+
+	void submit(uint8_t cmd, std::vector<uint8_t> pre, std::span<const std::byte> ref, Pending p)
+	{
+		std::unique_lock<std::mutex> lk(mu);
+
+		/* keep order with any register ops before this */
+		close_batch();
+		queue(cmd, std::move(pre), ref, std::move(p));
+		pump(lk);
+	}
+
+	void submit_reg(RegOp op)
+	{
+		std::unique_lock<std::mutex> lk(mu);
+
+		if(op.read)
+			batch_reads++;
+		batch.push_back(std::move(op));
+		if(!batching || (batch.size() >= batch_max_ops) || (batch_reads >= seq_slots))
+			close_batch();
+		pump(lk);
+	}
+
+	template<class T, class F>
+	std::future<T> call(uint8_t cmd, std::vector<uint8_t> pre, std::span<const std::byte> ref,
+		F parse, std::span<std::byte> dest = {})
+	{
+		auto pr = std::make_shared<std::promise<T>>();
+		auto fut = pr->get_future();
+
+		submit(cmd, std::move(pre), ref, Pending{[pr, parse](Reply r, std::exception_ptr e) {
+			if(e)
+			{
+				pr->set_exception(e);
+				return;
+			}
+			try
+			{
+				if constexpr(std::is_void_v<T>)
+				{
+					parse(r);
+					pr->set_value();
+				}
+				else
+					pr->set_value(parse(r));
+			}
+			catch(...)
+			{
+				pr->set_exception(std::current_exception());
+			}
+		}, dest});
+		return fut;
+	}
+};
+
+Client::Client(std::string host, uint16_t port) :
+	host_(host), port_(port), impl_(std::make_unique<Impl>(host, port))
+{
+}
+
+Client::~Client() = default;
+
+void Client::connect()
+{
+	std::unique_lock<std::mutex> lk(impl_->mu);
+	if((impl_->sock < 0) && !impl_->sending)
+		impl_->open(lk);
+}
+
+void Client::close()
+{
+	impl_ = std::make_unique<Impl>(host_, port_);
+}
+
+bool Client::connected() const
+{
+	std::lock_guard<std::mutex> lk(impl_->mu);
+	return impl_->sock >= 0;
+}
+
+void Client::set_batching(bool on)
+{
+	std::lock_guard<std::mutex> lk(impl_->mu);
+	impl_->batching = on;
+}
+
+std::future<Reply> Client::request(uint8_t cmd, std::span<const std::byte> payload)
+{
+	return impl_->call<Reply>(cmd, {}, payload, [](const Reply &r) { return r; });
+}
+
+void Client::request(uint8_t cmd, std::span<const std::byte> payload, Callback done)
+{
+	impl_->submit(cmd, {}, payload, Impl::Pending{std::move(done), {}});
+}
+
+std::future<uint32_t> Client::read_reg(uint8_t reg)
+{
+	auto pr = std::make_shared<std::promise<uint32_t>>();
+	auto fut = pr->get_future();
+
+	impl_->submit_reg({true, reg, 0, [pr](uint32_t v, std::exception_ptr e) {
+		if(e)
+			pr->set_exception(e);
+		else
+			pr->set_value(v);
+	}});
+	return fut;
+}
+
+std::future<void> Client::write_reg(uint8_t reg, uint32_t value)
+{
+	auto pr = std::make_shared<std::promise<void>>();
+	auto fut = pr->get_future();
+
+	impl_->submit_reg({false, reg, value, [pr](uint32_t, std::exception_ptr e) {
+		if(e)
+			pr->set_exception(e);
+		else
+			pr->set_value();
+	}});
+	return fut;
+}
+
+std::future<uint32_t> Client::vbat_mv()
+{
+	return impl_->call<uint32_t>(2, {}, {}, [](const Reply &r) {
+		check(r, "vbat", 4);
+		return net::get32(r.data.data());
+	});
+}
+
+std::future<WaitResult> Client::wait_reg(uint8_t reg, uint32_t mask, uint32_t expect,
+	uint32_t interval_us, uint32_t timeout_us)
+{
+	return impl_->call<WaitResult>(4, words({reg, mask, expect, interval_us, timeout_us}), {},
+		[](const Reply &r) {
+			check(r, "register wait", 12);
+			return WaitResult{net::get32(&r.data[0]), net::get32(&r.data[4]), net::get32(&r.data[8])};
+		});
+}
+
+std::future<SeqResult> Client::run_sequence(std::span<const std::byte> prog)
+{
+	return impl_->call<SeqResult>(5, words({0}), prog, parse_seq);
+}
+
+std::future<SeqResult> Client::store_boot_sequence(std::span<const std::byte> prog)
+{
+	return impl_->call<SeqResult>(5, words({1}), prog, parse_seq);
+}
+
+std::future<SeqResult> Client::run_boot_sequence()
+{
+	return impl_->call<SeqResult>(5, words({2}), {}, parse_seq);
+}
+
+std::future<SeqResult> Client::erase_boot_sequence()
+{
+	return impl_->call<SeqResult>(5, words({3}), {}, parse_seq);
+}
+
+std::future<PlaybackResult> Client::playback(const PlaybackArgs &a, std::span<const std::byte> data)
+{
+	return impl_->call<PlaybackResult>(7,
+		words({a.mode, a.base, a.size, a.credit_reg, a.wptr_reg}), data, [](const Reply &r) {
+			check(r, "playback", 20);
+			return PlaybackResult{net::get32(&r.data[0]), net::get32(&r.data[4]),
+				net::get32(&r.data[8]), net::get32(&r.data[12]), net::get32(&r.data[16])};
+		});
+}
+
+std::future<std::vector<uint8_t>> Client::stats(StatsGroup group)
+{
+	return impl_->call<std::vector<uint8_t>>(8, words({(uint32_t)group}), {}, [](const Reply &r) {
+		check(r, "stats", 4);
+		uint32_t len = net::get32(r.data.data());
+		if(r.data.size() < 4 + len)
+			throw Error(0, "stats reply too short");
+		return std::vector<uint8_t>(r.data.begin() + 4, r.data.begin() + 4 + len);
+	});
+}
+
+/*
+ * reports are packed uint32_t so they copy straight into the structs
+ */
+template<class T>
+static std::future<T> stats_as(std::future<std::vector<uint8_t>> raw)
+{
+	return std::async(std::launch::deferred, [](std::future<std::vector<uint8_t>> f) {
+		auto v = f.get();
+		T t{};
+		memcpy(&t, v.data(), std::min(v.size(), sizeof(T)));
+		return t;
+	}, std::move(raw));
+}
+
+std::future<std::vector<PoolStats>> Client::pool_stats()
+{
+	return std::async(std::launch::deferred, [](std::future<std::vector<uint8_t>> f) {
+		auto v = f.get();
+		std::vector<PoolStats> p(v.size() / sizeof(PoolStats));
+		memcpy(p.data(), v.data(), p.size() * sizeof(PoolStats));
+		return p;
+	}, stats(StatsGroup::pool));
+}
+
+std::future<StorageStats> Client::storage_stats()
+{
+	return stats_as<StorageStats>(stats(StatsGroup::storage));
+}
+
+std::future<ConfigStats> Client::config_stats()
+{
+	return stats_as<ConfigStats>(stats(StatsGroup::config));
+}
+
+std::future<CacheStats> Client::cache_stats()
+{
+	return stats_as<CacheStats>(stats(StatsGroup::cache));
+}
+
+std::future<PsStats> Client::ps_stats()
+{
+	return stats_as<PsStats>(stats(StatsGroup::ps));
+}
+
+std::future<OtaResult> Client::update_firmware(std::span<const std::byte> image)
+{
+	std::array<uint8_t, 32> digest = sha256(image);
+
+	return impl_->call<OtaResult>(9, std::vector<uint8_t>(digest.begin(), digest.end()), image,
+		[](const Reply &r) {
+			check(r, "firmware update", 8);
+			return OtaResult{net::get32(&r.data[0]), net::get32(&r.data[4])};
+		});
+}
+
+std::future<ConfigSource> Client::configure_by_crc(uint32_t crc)
+{
+	return impl_->call<ConfigSource>(0xa, words({crc}), {}, [](const Reply &r) {
+		check(r, "configure by CRC", 4);
+		return (ConfigSource)net::get32(r.data.data());
+	});
+}
+
+std::future<void> Client::psram_read(uint32_t addr, std::span<std::byte> dest)
+{
+	size_t want = dest.size();
+
+	return impl_->call<void>(0xb, words({addr, (uint32_t)dest.size()}), {},
+		[want](const Reply &r) {
+			check(r, "PSRAM read");
+			if(!r.data.empty() && (r.data.size() != want))
+				throw Error(0, "PSRAM read size mismatch");
+		}, dest);
+}
+
+std::future<void> Client::psram_write(uint32_t addr, std::span<const std::byte> data)
+{
+	return impl_->call<void>(0xc, words({addr}), data, [](const Reply &r) {
+		check(r, "PSRAM write");
+	});
+}
+
+static std::vector<uint8_t> sg_list(std::span<const PsramRegion> regions)
+{
+	std::vector<uint8_t> list = words({(uint32_t)regions.size()});
+
+	for(auto &r : regions)
+	{
+		list.resize(list.size() + 8);
+		net::put32(&list[list.size() - 8], r.addr);
+		net::put32(&list[list.size() - 4], r.len);
+	}
+	return list;
+}
+
+std::future<std::vector<uint32_t>> Client::psram_gather(std::span<const PsramRegion> regions,
+	std::span<std::byte> dest)
+{
+	std::vector<PsramRegion> regs(regions.begin(), regions.end());
+
+	return impl_->call<std::vector<uint32_t>>(0x17, sg_list(regions), {},
+		[regs, dest](const Reply &r) {
+			check(r, "PSRAM gather", regs.size() * 4);
+			std::vector<uint32_t> status(regs.size());
+			size_t in = regs.size() * 4, out = 0;
+			for(size_t i = 0; i < regs.size(); i++)
+			{
+				/* only good regions are sent, bad ones leave a gap in dest */
+				status[i] = net::get32(&r.data[i * 4]);
+				if(status[i] == sg_ok)
+				{
+					if((in + regs[i].len > r.data.size()) || (out + regs[i].len > dest.size()))
+						throw Error(0, "PSRAM gather size mismatch");
+					memcpy(&dest[out], &r.data[in], regs[i].len);
+					in += regs[i].len;
+				}
+				out += regs[i].len;
+			}
+			return status;
+		});
+}
+
+std::future<std::vector<uint32_t>> Client::psram_scatter(std::span<const PsramRegion> regions,
+	std::span<const std::byte> data)
+{
+	size_t n = regions.size();
+
+	return impl_->call<std::vector<uint32_t>>(0x18, sg_list(regions), data, [n](const Reply &r) {
+		check(r, "PSRAM scatter", n * 4);
+		std::vector<uint32_t> status(n);
+		for(size_t i = 0; i < n; i++)
+			status[i] = net::get32(&r.data[i * 4]);
+		return status;
+	});
+}
+
+std::future<void> Client::psram_fill(uint32_t addr, uint32_t len, std::span<const std::byte> pattern)
+{
+	return impl_->call<void>(0x19, words({addr, len}), pattern, [](const Reply &r) {
+		check(r, "PSRAM fill");
+	});
+}
+
+std::future<void> Client::psram_copy(uint32_t dst, uint32_t src, uint32_t len)
+{
+	return impl_->call<void>(0x1a, words({dst, src, len}), {}, [](const Reply &r) {
+		check(r, "PSRAM copy");
+	});
+}
+
+std::future<uint32_t> Client::psram_crc(uint32_t addr, uint32_t len)
+{
+	return impl_->call<uint32_t>(0x1b, words({addr, len}), {}, [](const Reply &r) {
+		check(r, "PSRAM CRC", 4);
+		return net::get32(&r.data[0]);
+	});
+}
+
+std::future<void> Client::save_bitstream(std::span<const std::byte> bits)
+{
+	return impl_->call<void>(0xe, {}, bits, [](const Reply &r) {
+		check(r, "save");
+	});
+}
+
+std::future<void> Client::configure(std::span<const std::byte> bits)
+{
+	return impl_->call<void>(0xf, {}, bits, [](const Reply &r) {
+		check(r, "configure");
+	});
+}
+
+static PsState parse_ps(const Reply &r)
+{
+	check(r, "power save", 20);
+	return PsState{(PsMode)net::get32(&r.data[0]), PsConfig{net::get32(&r.data[4]),
+		net::get32(&r.data[8]), net::get32(&r.data[12]), net::get32(&r.data[16])}};
+}
+
+std::future<PersistJob> Client::configure_persist(std::span<const std::byte> bits)
+{
+	return impl_->call<PersistJob>(0x1c, {}, bits, [](const Reply &r) {
+		check(r, "configure", 8);
+		return PersistJob{net::get32(&r.data[0]), net::get32(&r.data[4])};
+	});
+}
+
+std::future<PersistStatus> Client::persist_status(uint32_t wait_ms)
+{
+	return impl_->call<PersistStatus>(0x1d, words({wait_ms}), {}, [](const Reply &r) {
+		PersistStatus st;
+		check(r, "persist status", sizeof(PersistStatus));
+		memcpy(&st, r.data.data(), sizeof(PersistStatus));
+		return st;
+	});
+}
+
+uint64_t server_time_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static SyncStats parse_sync(const Reply &r)
+{
+	SyncStats st;
+
+	check(r, "time sync", sizeof(SyncStats));
+	memcpy(&st, r.data.data(), sizeof(SyncStats));
+	return st;
+}
+
+std::future<SyncStats> Client::time_sync(const std::string &server, uint16_t port, uint32_t interval_ms)
+{
+	struct in_addr ip = {};
+
+	if(!server.empty() && (inet_pton(AF_INET, server.c_str(), &ip) != 1))
+		throw Error(0, "time server must be an IPv4 address: " + server);
+	return impl_->call<SyncStats>(0x1e, words({0, ip.s_addr, port, interval_ms}), {}, parse_sync);
+}
+
+std::future<SyncStats> Client::sync_now()
+{
+	return impl_->call<SyncStats>(0x1e, words({1}), {}, parse_sync);
+}
+
+std::future<SyncStats> Client::sync_stats()
+{
+	return impl_->call<SyncStats>(0x1e, words({2}), {}, parse_sync);
+}
+
+std::future<Reply> Client::run_at(uint64_t server_us, uint8_t cmd, std::span<const std::byte> payload)
+{
+	return impl_->call<Reply>(0x1f, words({(uint32_t)server_us, (uint32_t)(server_us >> 32), cmd}),
+		payload, [](const Reply &r) { return r; });
+}
+
+std::future<void> Client::write_reg_at(uint64_t server_us, uint8_t reg, uint32_t value)
+{
+	return impl_->call<void>(0x1f, words({(uint32_t)server_us, (uint32_t)(server_us >> 32), 1, reg, value}),
+		{}, [](const Reply &r) {
+			check(r, "timed register write");
+		});
+}
+
+std::future<void> Client::load_regmap(std::span<const RegRange> map)
+{
+	std::vector<uint8_t> v;
+
+	for(auto &r : map)
+	{
+		auto w = words({r.first, r.count, (uint32_t)r.cls});
+		v.insert(v.end(), w.begin(), w.end());
+	}
+	return impl_->call<void>(0x20, std::move(v), {}, [](const Reply &r) {
+		check(r, "register map load");
+	});
+}
+
+std::future<RegShadow> Client::regmap_dump()
+{
+	return impl_->call<RegShadow>(0x21, {}, {}, [](const Reply &r) {
+		/* valid bits, a class byte per register, then the values */
+		check(r, "register map dump", 16 + 5 * reg_count);
+		RegShadow s;
+		const uint8_t *p = r.data.data();
+		for(size_t i = 0; i < reg_count; i++)
+		{
+			s.valid[i] = (net::get32(p + 4 * (i / 32)) >> (i % 32)) & 1;
+			s.cls[i] = (RegClass)p[16 + i];
+			s.value[i] = net::get32(p + 16 + reg_count + 4 * i);
+		}
+		return s;
+	});
+}
+
+std::future<RegmapStats> Client::regmap_stats()
+{
+	return stats_as<RegmapStats>(stats(StatsGroup::regmap));
+}
+
+std::future<PsState> Client::power_save(const PsConfig &c)
+{
+	return impl_->call<PsState>(0x10, words({c.pin, c.idle_mode, c.idle_ms, c.boost_bps}), {},
+		parse_ps);
+}
+
+std::future<PsState> Client::power_save()
+{
+	return impl_->call<PsState>(0x10, {}, {}, parse_ps);
+}
+
+std::future<TraceDump> Client::trace(bool clear)
+{
+	return impl_->call<TraceDump>(0x11, words({clear ? 1u : 0u}), {}, [](const Reply &r) {
+		check(r, "trace", 12);
+		TraceDump d{net::get32(&r.data[0]), net::get32(&r.data[4]), {}};
+		uint32_t n = std::min<size_t>(net::get32(&r.data[8]), (r.data.size() - 12) / 16);
+		for(uint32_t i = 0; i < n; i++)
+		{
+			const uint8_t *p = &r.data[12 + 16 * i];
+			d.records.push_back({net::get32(p), net::get32(p + 4), net::get32(p + 8), net::get32(p + 12)});
+		}
+		return d;
+	});
+}
+
+std::future<std::vector<BenchRow>> Client::bench(const BenchArgs &a)
+{
+	std::vector<uint8_t> args = words({(uint32_t)a.test, a.addr, a.total, a.sizes, a.flags});
+	for(auto hz : a.clocks_hz)
+	{
+		args.resize(args.size() + 4);
+		net::put32(&args[args.size() - 4], hz);
+	}
+
+	return impl_->call<std::vector<BenchRow>>(0x12, args, {}, [](const Reply &r) {
+		check(r, "benchmark", 4);
+		size_t n = std::min<size_t>(net::get32(&r.data[0]), (r.data.size() - 4) / sizeof(BenchRow));
+		std::vector<BenchRow> rows(n);
+		memcpy(rows.data(), &r.data[4], n * sizeof(BenchRow));
+		return rows;
+	});
+}
+
+static NetStats parse_net(const Reply &r, const char *what, size_t data)
+{
+	NetStats st;
+
+	check(r, what, data + sizeof(NetStats));
+	memcpy(&st, &r.data[data], sizeof(NetStats));
+	return st;
+}
+
+std::future<NetStats> Client::net_sink(std::span<const std::byte> data)
+{
+	return impl_->call<NetStats>(0x13, {}, data, [](const Reply &r) {
+		return parse_net(r, "network sink", 0);
+	});
+}
+
+std::future<NetStats> Client::net_source(uint32_t bytes)
+{
+	return impl_->call<NetStats>(0x14, words({bytes}), {}, [bytes](const Reply &r) {
+		NetStats st = parse_net(r, "network source", bytes);
+		for(uint32_t i = 0; i < bytes; i++)
+			if(r.data[i] != (uint8_t)(i % 8192))
+				throw Error(0, "network source data mismatch at " + std::to_string(i));
+		return st;
+	});
+}
+
+std::future<NetStats> Client::net_echo(std::span<const std::byte> data)
+{
+	return impl_->call<NetStats>(0x15, {}, data, [data](const Reply &r) {
+		NetStats st = parse_net(r, "network echo", data.size());
+		if(memcmp(r.data.data(), data.data(), data.size()))
+			throw Error(0, "network echo data mismatch");
+		return st;
+	});
+}
+
+static SessionStatus parse_session(const Reply &r)
+{
+	SessionStatus st;
+
+	check(r, "session", sizeof(SessionStatus));
+	memcpy(&st, r.data.data(), sizeof(SessionStatus));
+	return st;
+}
+
+std::future<SessionStatus> Client::session_arm(uint32_t size)
+{
+	return impl_->call<SessionStatus>(0x16, words({0, size}), {}, parse_session);
+}
+
+std::future<SessionStatus> Client::session_stop()
+{
+	return impl_->call<SessionStatus>(0x16, words({1}), {}, parse_session);
+}
+
+std::future<SessionStatus> Client::session_status()
+{
+	return impl_->call<SessionStatus>(0x16, words({3}), {}, parse_session);
+}
+
+std::future<SessionStatus> Client::session_free()
+{
+	return impl_->call<SessionStatus>(0x16, words({4}), {}, parse_session);
+}
+
+std::future<std::vector<uint8_t>> Client::session_read(uint32_t offset, uint32_t len)
+{
+	return impl_->call<std::vector<uint8_t>>(0x16, words({2, offset, len}), {}, [](const Reply &r) {
+		parse_session(r);
+		return std::vector<uint8_t>(r.data.begin() + sizeof(SessionStatus), r.data.end());
+	});
+}
+
+std::vector<uint8_t> Client::session_download()
+{
+	SessionStatus st = session_status().get();
+	std::vector<uint8_t> all;
+
+	while(all.size() < st.used)
+	{
+		auto part = session_read(all.size(), st.used - all.size()).get();
+		if(part.empty())
+			break;
+		all.insert(all.end(), part.begin(), part.end());
+	}
+	return all;
+}
+
+ConfigSource Client::configure_cached(std::span<const std::byte> bits)
+{
+	ConfigSource src = configure_by_crc(crc32(bits)).get();
+
+	if(src == ConfigSource::miss)
+		configure(bits).get();
+	return src;
+}
+
+EventStream Client::subscribe(uint8_t status_reg)
+{
+	return EventStream(host_, port_, status_reg);
+}
+
+CaptureStream Client::capture(const CaptureArgs &args)
+{
+	return CaptureStream(host_, port_, args);
+}
+
+}
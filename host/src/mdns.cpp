@@ -0,0 +1,188 @@
+/*
+ * mdns.cpp - minimal mDNS querier. Sends one PTR query from an ephemeral
+ * port (a "legacy unicast" query, answered straight back to us) and pulls
+ * the instance, SRV, TXT and A records out of whatever comes back.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "icev/mdns.hpp"
+#include "icev/client.hpp"
+#include "net.hpp"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <netinet/in.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace icev {
+
+constexpr uint16_t mdns_port = 5353;
+constexpr uint16_t type_a = 1, type_ptr = 12, type_txt = 16, type_srv = 33;
+
+static uint16_t get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+/*
+ * read a possibly compressed name - returns offset just past it, 0 if bad
+ */
+static size_t get_name(const uint8_t *m, size_t len, size_t off, std::string &name)
+{
+	size_t end = 0;
+	int hops = 0;
+
+	name.clear();
+	while(off < len)
+	{
+		uint8_t l = m[off];
+		if(!l)
+			return end ? end : off + 1;
+		if((l & 0xC0) == 0xC0)
+		{
+			if((off + 1 >= len) || (++hops > 16))
+				return 0;
+			if(!end)
+				end = off + 2;
+			off = ((l & 0x3F) << 8) | m[off + 1];
+			continue;
+		}
+		if(off + 1 + l > len)
+			return 0;
+		if(!name.empty())
+			name += '.';
+		name.append((const char *)&m[off + 1], l);
+		off += 1 + l;
+	}
+
+	return 0;
+}
+
+static bool same_name(const std::string &a, const std::string &b)
+{
+	return (a.size() == b.size()) && !strncasecmp(a.c_str(), b.c_str(), a.size());
+}
+
+std::vector<Device> discover(std::chrono::milliseconds wait, const std::string &service)
+{
+	std::vector<Device> found;
+	std::map<std::string, std::string> addrs;
+	uint8_t q[512], m[1500];
+	size_t n = 12;
+	int sock;
+
+	/* header with one question, then the labels, type PTR, class IN */
+	memset(q, 0, sizeof(q));
+	q[5] = 1;
+	for(size_t start = 0; start <= service.size(); )
+	{
+		size_t dot = service.find('.', start);
+		if(dot == std::string::npos)
+			dot = service.size();
+		q[n++] = dot - start;
+		memcpy(&q[n], &service[start], dot - start);
+		n += dot - start;
+		start = dot + 1;
+	}
+	q[n++] = 0;
+	q[n++] = 0; q[n++] = type_ptr;
+	q[n++] = 0; q[n++] = 1;
+
+	if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		throw Error(0, "mDNS socket failed");
+
+	struct sockaddr_in to = {};
+	to.sin_family = AF_INET;
+	to.sin_port = htons(mdns_port);
+	inet_pton(AF_INET, "224.0.0.251", &to.sin_addr);
+	sendto(sock, q, n, 0, (struct sockaddr *)&to, sizeof(to));
+
+	auto deadline = std::chrono::steady_clock::now() + wait;
+	while(1)
+	{
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+			deadline - std::chrono::steady_clock::now()).count();
+		if((left <= 0) || !net::wait_readable(sock, left))
+			break;
+
+		ssize_t len = recv(sock, m, sizeof(m), 0);
+		if(len < 12)
+			continue;
+
+		/* skip questions then walk every record section */
+		size_t off = 12;
+		int qd = get16(&m[4]), rr = get16(&m[6]) + get16(&m[8]) + get16(&m[10]);
+		std::string name, target;
+		while(qd-- && off)
+			if((off = get_name(m, len, off, name)))
+				off += 4;
+
+		while(rr-- && off && (off + 10 <= (size_t)len))
+		{
+			if(!(off = get_name(m, len, off, name)) || (off + 10 > (size_t)len))
+				break;
+			uint16_t type = get16(&m[off]);
+			uint16_t rdlen = get16(&m[off + 8]);
+			size_t rd = off + 10;
+			off = rd + rdlen;
+			if(off > (size_t)len)
+				break;
+
+			if((type == type_ptr) && same_name(name, service))
+			{
+				if(get_name(m, len, rd, target))
+				{
+					bool have = false;
+					for(auto &d : found)
+						have |= same_name(d.instance, target);
+					if(!have)
+						found.push_back(Device{target, "", "", 0, {}});
+				}
+			}
+			else if((type == type_srv) && (rdlen >= 6))
+			{
+				for(auto &d : found)
+					if(same_name(d.instance, name) && get_name(m, len, rd + 6, target))
+					{
+						d.port = get16(&m[rd + 4]);
+						d.hostname = target;
+					}
+			}
+			else if(type == type_txt)
+			{
+				for(auto &d : found)
+				{
+					if(!same_name(d.instance, name))
+						continue;
+					for(size_t t = rd; t < rd + rdlen; t += 1 + m[t])
+					{
+						std::string kv((const char *)&m[t + 1], std::min<size_t>(m[t], rd + rdlen - t - 1));
+						size_t eq = kv.find('=');
+						if(eq != std::string::npos)
+							d.txt[kv.substr(0, eq)] = kv.substr(eq + 1);
+					}
+				}
+			}
+			else if((type == type_a) && (rdlen == 4))
+			{
+				char ip[INET_ADDRSTRLEN];
+				inet_ntop(AF_INET, &m[rd], ip, sizeof(ip));
+				addrs[name] = ip;
+			}
+		}
+	}
+	::close(sock);
+
+	/* A records may come in a different packet than the SRV */
+	for(auto &d : found)
+		for(auto &a : addrs)
+			if(same_name(a.first, d.hostname))
+				d.address = a.second;
+
+	return found;
+}
+
+}
@@ -0,0 +1,121 @@
+/*
+ * net.cpp - blocking socket helpers shared by the client classes
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "net.hpp"
+#include "icev/client.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace icev::net {
+
+static Error sys_error(const char *what)
+{
+	return Error(0, std::string(what) + ": " + strerror(errno));
+}
+
+int connect_tcp(const std::string &host, uint16_t port)
+{
+	struct addrinfo hints = {}, *res;
+	int sock = -1, one = 1;
+
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res))
+		throw Error(0, "can't resolve " + host);
+
+	for(struct addrinfo *ai = res; ai; ai = ai->ai_next)
+	{
+		if((sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+			continue;
+		if(!::connect(sock, ai->ai_addr, ai->ai_addrlen))
+			break;
+		::close(sock);
+		sock = -1;
+	}
+	freeaddrinfo(res);
+	if(sock < 0)
+		throw sys_error(("can't connect to " + host).c_str());
+
+	/* requests go out as soon as they're queued */
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return sock;
+}
+
+void send_all(int sock, const void *buf, size_t len)
+{
+	struct iovec iov = {const_cast<void *>(buf), len};
+	sendv_all(sock, &iov, 1);
+}
+
+void sendv_all(int sock, struct iovec *iov, int cnt)
+{
+	struct msghdr msg = {};
+	ssize_t n;
+
+	while(cnt)
+	{
+		msg.msg_iov = iov;
+		msg.msg_iovlen = cnt;
+		if((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			throw sys_error("send");
+		}
+
+		/* step over whatever went */
+		while(cnt && (size_t)n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if(cnt)
+		{
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+void recv_all(int sock, void *buf, size_t len)
+{
+	char *p = (char *)buf;
+	ssize_t n;
+
+	while(len)
+	{
+		if((n = recv(sock, p, len, 0)) <= 0)
+		{
+			if((n < 0) && (errno == EINTR))
+				continue;
+			throw n ? sys_error("recv") : Error(0, "connection closed");
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+bool wait_readable(int sock, int timeout_ms)
+{
+	struct pollfd pfd = {sock, POLLIN, 0};
+	int n;
+
+	while((n = poll(&pfd, 1, timeout_ms)) < 0)
+		if(errno != EINTR)
+			throw sys_error("poll");
+
+	return n > 0;
+}
+
+}
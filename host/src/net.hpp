@@ -0,0 +1,40 @@
+/*
+ * net.hpp - blocking socket helpers shared by the client classes
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __ICEV_NET__
+#define __ICEV_NET__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/uio.h>
+
+namespace icev::net {
+
+/* connected TCP socket with NODELAY set - throws on failure */
+int connect_tcp(const std::string &host, uint16_t port);
+
+/* whole buffers or throw */
+void send_all(int sock, const void *buf, size_t len);
+void sendv_all(int sock, struct iovec *iov, int cnt);
+void recv_all(int sock, void *buf, size_t len);
+
+/* false if nothing arrived within timeout_ms */
+bool wait_readable(int sock, int timeout_ms);
+
+/* header words as the board sends them */
+inline void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+inline uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+}
+
+#endif
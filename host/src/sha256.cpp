@@ -0,0 +1,88 @@
+/*
+ * sha256.cpp - FIPS 180-4 SHA-256 so the library needs nothing beyond libc
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "sha256.hpp"
+
+#include <cstring>
+
+namespace icev {
+
+static const uint32_t k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t ror(uint32_t x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static void block(uint32_t h[8], const uint8_t *p)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, hh, t1, t2;
+	int i;
+
+	for(i = 0; i < 16; i++)
+		w[i] = (p[4*i] << 24) | (p[4*i+1] << 16) | (p[4*i+2] << 8) | p[4*i+3];
+	for(i = 16; i < 64; i++)
+		w[i] = w[i-16] + (ror(w[i-15], 7) ^ ror(w[i-15], 18) ^ (w[i-15] >> 3)) +
+			w[i-7] + (ror(w[i-2], 17) ^ ror(w[i-2], 19) ^ (w[i-2] >> 10));
+
+	a = h[0]; b = h[1]; c = h[2]; d = h[3];
+	e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+	for(i = 0; i < 64; i++)
+	{
+		t1 = hh + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+		t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		hh = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+std::array<uint8_t, 32> sha256(std::span<const std::byte> data)
+{
+	uint32_t h[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	const uint8_t *p = (const uint8_t *)data.data();
+	size_t len = data.size(), i;
+	uint64_t bits = (uint64_t)len * 8;
+	uint8_t tail[128] = {};
+	std::array<uint8_t, 32> out;
+
+	for(i = 0; i + 64 <= len; i += 64)
+		block(h, p + i);
+
+	/* pad with 0x80, zeros and the bit count */
+	size_t rem = len - i, tlen = (rem < 56) ? 64 : 128;
+	memcpy(tail, p + i, rem);
+	tail[rem] = 0x80;
+	for(int j = 0; j < 8; j++)
+		tail[tlen - 1 - j] = bits >> (8 * j);
+	block(h, tail);
+	if(tlen == 128)
+		block(h, tail + 64);
+
+	for(i = 0; i < 8; i++)
+	{
+		out[4*i] = h[i] >> 24;
+		out[4*i+1] = h[i] >> 16;
+		out[4*i+2] = h[i] >> 8;
+		out[4*i+3] = h[i];
+	}
+	return out;
+}
+
+}
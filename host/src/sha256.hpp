@@ -0,0 +1,21 @@
+/*
+ * sha256.hpp - digest for firmware update images
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __ICEV_SHA256__
+#define __ICEV_SHA256__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace icev {
+
+std::array<uint8_t, 32> sha256(std::span<const std::byte> data);
+
+}
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * streams.cpp - connections dedicated to event and capture streams
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "icev/client.hpp"
+#include "net.hpp"
+#include "proto.h"
+
+#include <unistd.h>
+
+namespace icev {
+
+constexpr uint32_t event_magic = 0xCAFEBEE3;
+
+/*
+ * send one tagged request and check its status - the stream follows
+ */
+static int open_stream(const std::string &host, uint16_t port, uint8_t cmd,
+	const uint32_t *args, int nargs, const char *what)
+{
+	int sock = net::connect_tcp(host, port);
+	uint8_t buf[12 + 4 * 8];
+
+	try
+	{
+		net::put32(&buf[0], PROTO_TAG_MAGIC | cmd);
+		net::put32(&buf[4], 4 * nargs);
+		net::put32(&buf[8], 1);
+		for(int i = 0; i < nargs; i++)
+			net::put32(&buf[12 + 4 * i], args[i]);
+		net::send_all(sock, buf, 12 + 4 * nargs);
+
+		/* tag, length, status and anything else in the reply */
+		net::recv_all(sock, buf, 9);
+		uint32_t extra = net::get32(&buf[4]) - 1;
+		uint8_t err = buf[8];
+		while(extra--)
+			net::recv_all(sock, buf, 1);
+		if(err)
+			throw Error(err, std::string(what) + " failed, status " + std::to_string(err));
+	}
+	catch(...)
+	{
+		::close(sock);
+		throw;
+	}
+
+	return sock;
+}
+
+EventStream::EventStream(const std::string &host, uint16_t port, uint8_t status_reg)
+{
+	uint32_t arg = status_reg;
+	sock_ = open_stream(host, port, 3, &arg, 1, "subscribe");
+}
+
+EventStream::EventStream(EventStream &&other) noexcept : sock_(other.sock_)
+{
+	other.sock_ = -1;
+}
+
+EventStream::~EventStream()
+{
+	close();
+}
+
+void EventStream::close()
+{
+	if(sock_ >= 0)
+		::close(sock_);
+	sock_ = -1;
+}
+
+std::optional<Event> EventStream::next(std::chrono::milliseconds timeout)
+{
+	uint8_t f[24];
+
+	if(!net::wait_readable(sock_, timeout.count()))
+		return std::nullopt;
+
+	net::recv_all(sock_, f, sizeof(f));
+	if(net::get32(&f[0]) != event_magic)
+		throw Error(0, "bad event frame");
+
+	return Event{net::get32(&f[4]),
+		(int64_t)((uint64_t)net::get32(&f[8]) | ((uint64_t)net::get32(&f[12]) << 32)),
+		net::get32(&f[16]), net::get32(&f[20])};
+}
+
+CaptureStream::CaptureStream(const std::string &host, uint16_t port, const CaptureArgs &a)
+{
+	uint32_t args[6] = {a.mode, a.base, a.size, a.wptr_reg, a.rptr_reg, a.total};
+
+	/* the FIFO is read a word at a time */
+	if((a.mode == 1) && (a.total & 3))
+		throw Error(0, "FIFO capture total must be a multiple of 4");
+	sock_ = open_stream(host, port, 6, args, 6, "capture");
+}
+
+CaptureStream::CaptureStream(CaptureStream &&other) noexcept :
+	sock_(other.sock_), summary_(other.summary_)
+{
+	other.sock_ = -1;
+}
+
+CaptureStream::~CaptureStream()
+{
+	close();
+}
+
+void CaptureStream::close()
+{
+	if(sock_ >= 0)
+		::close(sock_);
+	sock_ = -1;
+}
+
+bool CaptureStream::next(std::vector<std::byte> &out, uint32_t *overruns)
+{
+	uint8_t hdr[8];
+
+	if(sock_ < 0)
+		return false;
+
+	net::recv_all(sock_, hdr, sizeof(hdr));
+	uint32_t len = net::get32(&hdr[0]);
+	if(overruns)
+		*overruns = net::get32(&hdr[4]);
+
+	/* zero length frame is the trailer */
+	if(!len)
+	{
+		uint8_t t[8];
+		net::recv_all(sock_, t, sizeof(t));
+		summary_ = {net::get32(&hdr[4]), net::get32(&t[0]), net::get32(&t[4])};
+		close();
+		return false;
+	}
+
+	size_t at = out.size();
+	out.resize(at + len);
+	net::recv_all(sock_, &out[at], len);
+	return true;
+}
+
+}
@@ -0,0 +1,22 @@
+/*
+ * trace.cpp - names for the firmware's trace IDs, straight from its list
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "icev/client.hpp"
+
+namespace icev {
+
+static const TraceId trace_ids[] = {
+#define TRACE_ID(name, str, a, b) {str, a, b},
+#include "trace_ids.h"
+#undef TRACE_ID
+};
+
+const TraceId *trace_id(uint32_t id)
+{
+	return (id < sizeof(trace_ids) / sizeof(trace_ids[0])) ? &trace_ids[id] : nullptr;
+}
+
+}
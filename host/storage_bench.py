@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+#
+# storage_bench.py - measure bitstream save speed of an ICE-V board
+# part of ICE-V_WiFiMgr
+# 10-19-26
+#
+# Uploads a bitstream with the save command (0xe) several times and reads
+# the device's storage statistics (cmd 8, group 1) after each one. Run it
+# once against a SPIFFS build and once against a LittleFS build with
+# --save, then --compare the two result files.
+#
+# The bitstream is written to the board's boot file so use a real one.
+#
+
+import argparse
+import json
+import socket
+import struct
+import sys
+import time
+
+PORT = 3333
+STATS_STORAGE = 1
+STATS_FIELDS = ("backend", "mount_us", "total", "used", "writes",
+                "wr_bytes", "wr_us", "rd_bytes", "rd_us")
+BACKENDS = ("SPIFFS", "LittleFS")
+
+
+def recv_all(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError("connection closed")
+        data += chunk
+    return data
+
+
+def command(host, cmd, payload):
+    """send one command, return (err, socket) with the reply pending"""
+    sock = socket.create_connection((host, PORT), timeout=30)
+    sock.sendall(struct.pack("<II", 0xCAFEBEE0 | cmd, len(payload)) + payload)
+    err = recv_all(sock, 1)[0]
+    return err, sock
+
+
+def storage_stats(host):
+    err, sock = command(host, 8, struct.pack("<I", STATS_STORAGE))
+    with sock:
+        length = struct.unpack("<I", recv_all(sock, 4))[0]
+        data = recv_all(sock, length)
+    if err:
+        raise RuntimeError("stats error %d" % err)
+    return dict(zip(STATS_FIELDS, struct.unpack("<%dI" % len(STATS_FIELDS),
+                                                 data[:4 * len(STATS_FIELDS)])))
+
+
+def run(args):
+    with open(args.bitstream, "rb") as f:
+        bits = f.read()
+
+    st = storage_stats(args.host)
+    backend = BACKENDS[st["backend"]] if st["backend"] < len(BACKENDS) else "?"
+    print("%s: %s, mount %.1f ms, %d/%d bytes used" % (
+        args.host, backend, st["mount_us"] / 1000.0, st["used"], st["total"]))
+
+    runs = []
+    for i in range(args.count):
+        start = time.monotonic()
+        err, sock = command(args.host, 0xE, bits)
+        sock.close()
+        host_s = time.monotonic() - start
+        if err:
+            print("run %d: save error %d" % (i, err))
+            sys.exit(1)
+        st = storage_stats(args.host)
+        dev_mbs = st["wr_bytes"] / st["wr_us"] if st["wr_us"] else 0.0
+        runs.append({"bytes": st["wr_bytes"], "wr_us": st["wr_us"],
+                     "host_s": host_s})
+        print("run %d: %d bytes, flash %.3f MB/s (%.1f ms), end-to-end %.3f MB/s"
+              % (i, st["wr_bytes"], dev_mbs, st["wr_us"] / 1000.0,
+                 len(bits) / host_s / 1e6))
+
+    result = summarize(backend, st["mount_us"], runs)
+    print("mean flash %.3f MB/s, end-to-end %.3f MB/s" % (
+        result["flash_mbs"], result["e2e_mbs"]))
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(result, f, indent=2)
+
+
+def summarize(backend, mount_us, runs):
+    wr_us = sum(r["wr_us"] for r in runs)
+    host_s = sum(r["host_s"] for r in runs)
+    total = sum(r["bytes"] for r in runs)
+    return {"backend": backend, "mount_us": mount_us, "runs": runs,
+            "flash_mbs": total / wr_us if wr_us else 0.0,
+            "e2e_mbs": total / host_s / 1e6 if host_s else 0.0}
+
+
+def compare(files):
+    results = []
+    for name in files:
+        with open(name) as f:
+            results.append(json.load(f))
+    print("%-10s %10s %12s %12s" % ("backend", "mount ms", "flash MB/s", "e2e MB/s"))
+    for r in results:
+        print("%-10s %10.1f %12.3f %12.3f" % (r["backend"], r["mount_us"] / 1000.0,
+                                            r["flash_mbs"], r["e2e_mbs"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure ICE-V bitstream save speed")
+    parser.add_argument("bitstream", nargs="?", help="bitstream to save")
+    parser.add_argument("--host", default="ICE-V.local")
+    parser.add_argument("-n", "--count", type=int, default=5)
+    parser.add_argument("--save", help="write results to a JSON file")
+    parser.add_argument("--compare", nargs="+", metavar="JSON",
+                        help="compare saved results instead of running")
+    args = parser.parse_args()
+
+    if args.compare:
+        compare(args.compare)
+    elif args.bitstream:
+        run(args)
+    else:
+        parser.error("bitstream required")
+
+
+if __name__ == "__main__":
+    main()
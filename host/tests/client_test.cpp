@@ -0,0 +1,236 @@
+/*
+ * client_test.cpp - host library tests against the loopback stand-in.
+ * Run one case by name: icev_test pipeline|batch|psram|errors
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "icev/client.hpp"
+#include "standin.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+using icev::test::StandIn;
+
+constexpr uint32_t psram_sz = 8 * 1024 * 1024;
+
+#define CHECK(c) do { if(!(c)) throw std::runtime_error(std::string("line ") + \
+	std::to_string(__LINE__) + ": " + #c); } while(0)
+
+/*
+ * a reply that never comes fails the test instead of hanging it
+ */
+template<class T>
+static T get(std::future<T> &f)
+{
+	if(f.wait_for(5s) != std::future_status::ready)
+		throw std::runtime_error("timed out waiting for a reply");
+	return f.get();
+}
+
+/*
+ * the status of the error a request fails with, -1 if it doesn't
+ */
+template<class T>
+static int status_of(std::future<T> f)
+{
+	try
+	{
+		get(f);
+	}
+	catch(const icev::Error &e)
+	{
+		return e.status();
+	}
+	return -1;
+}
+
+static std::vector<std::byte> pattern(size_t len, uint32_t seed)
+{
+	std::vector<std::byte> v(len);
+	std::mt19937 rng(seed);
+
+	for(auto &b : v)
+		b = (std::byte)rng();
+	return v;
+}
+
+/*
+ * many requests in flight at once, replies matched up by tag
+ */
+static void test_pipeline(void)
+{
+	StandIn s;
+	icev::Client c("127.0.0.1", s.port());
+	std::vector<std::future<void>> wr;
+	std::vector<std::future<uint32_t>> rd;
+	const int n = 32;
+
+	/* one request per op */
+	c.set_batching(false);
+	for(int i = 0; i < n; i++)
+		wr.push_back(c.write_reg(i, 0x1000 * i + 7));
+	for(auto &f : wr)
+		get(f);
+
+	/* the stand-in answers nothing until it has all of them */
+	s.hold(n);
+	for(int i = 0; i < n; i++)
+		rd.push_back(c.read_reg(i));
+	for(int i = 0; i < n; i++)
+		CHECK(get(rd[i]) == 0x1000u * i + 7);
+
+	auto log = s.log();
+	std::set<uint32_t> tags(log.tags.begin(), log.tags.end());
+	CHECK(log.max_held == n);
+	CHECK(tags.size() == log.tags.size());
+	CHECK(log.cmds[0] == n);
+	CHECK(log.cmds[1] == n);
+	CHECK(!log.cmds.count(5));
+}
+
+/*
+ * register ops queued behind a send go out as one sequence
+ */
+static void test_batch(void)
+{
+	StandIn s;
+	icev::Client c("127.0.0.1", s.port());
+	auto big = pattern(4 * 1024 * 1024, 1);
+	std::vector<std::future<void>> wr;
+	std::vector<std::future<uint32_t>> rd;
+
+	/* hold up a big write so the register ops pile up behind it */
+	c.connect();
+	s.pause();
+	auto sender = std::async(std::launch::async, [&] { return c.psram_write(0, big); });
+	std::this_thread::sleep_for(200ms);
+	for(int i = 0; i < 10; i++)
+	{
+		wr.push_back(c.write_reg(0x40 + i, 0xA5000000 | i));
+		rd.push_back(c.read_reg(0x40 + i));
+	}
+	s.resume();
+
+	auto done = get(sender);
+	get(done);
+	for(auto &f : wr)
+		get(f);
+	for(int i = 0; i < 10; i++)
+		CHECK(get(rd[i]) == (0xA5000000u | i));
+
+	auto log = s.log();
+	CHECK(log.cmds[0xc] == 1);
+	CHECK(log.cmds[5] == 1);
+	CHECK(!log.cmds.count(0) && !log.cmds.count(1));
+	CHECK(!memcmp(s.psram(), big.data(), big.size()));
+}
+
+/*
+ * PSRAM spans written and read back in place, big and small
+ */
+static void test_psram(void)
+{
+	StandIn s;
+	icev::Client c("127.0.0.1", s.port());
+	auto small = pattern(100, 2), large = pattern(300000, 3);
+	std::vector<std::byte> small_rd(small.size()), large_rd(large.size());
+
+	/* small writes are held whole, large ones are streamed */
+	auto w0 = c.psram_write(0x100, small);
+	auto w1 = c.psram_write(0x12345, large);
+	auto r0 = c.psram_read(0x100, small_rd);
+	auto r1 = c.psram_read(0x12345, large_rd);
+	get(w0);
+	get(w1);
+	get(r0);
+	get(r1);
+
+	CHECK(small_rd == small);
+	CHECK(large_rd == large);
+	CHECK(!memcmp(s.psram() + 0x12345, large.data(), large.size()));
+
+	/* right up to the end */
+	auto tail = pattern(64, 4);
+	std::vector<std::byte> tail_rd(tail.size());
+	auto w2 = c.psram_write(psram_sz - tail.size(), tail);
+	get(w2);
+	auto r2 = c.psram_read(psram_sz - tail.size(), tail_rd);
+	get(r2);
+	CHECK(tail_rd == tail);
+}
+
+/*
+ * failures come back as error replies and leave the connection usable
+ */
+static void test_errors(void)
+{
+	StandIn s;
+	icev::Client c("127.0.0.1", s.port());
+	std::vector<std::byte> buf(16);
+	const std::byte bad_op[] = {std::byte{0}, std::byte{0}, std::byte{0}, std::byte{0}, std::byte{9}};
+
+	/* short arguments and unknown commands */
+	auto short_rd = c.request(0);
+	CHECK(get(short_rd).err == icev::err_command);
+	auto unknown = c.request(0x7f);
+	CHECK(get(unknown).err == icev::err_command);
+
+	/* out of range PSRAM */
+	CHECK(status_of(c.psram_read(psram_sz - 4, buf)) == icev::err_command);
+	CHECK(status_of(c.psram_read(0xFFFFFFF0, buf)) == icev::err_command);
+	CHECK(status_of(c.psram_write(psram_sz, buf)) == icev::err_command);
+
+	/* a bad sequence says why it stopped */
+	auto seq = c.request(5, bad_op);
+	auto r = get(seq);
+	CHECK(r.err == icev::err_command);
+	CHECK(r.data.size() >= 8);
+	CHECK(r.data[0] == 1);
+
+	/* still connected and working */
+	CHECK(c.connected());
+	auto wr = c.write_reg(3, 0xDEADBEEF);
+	get(wr);
+	auto rd = c.read_reg(3);
+	CHECK(get(rd) == 0xDEADBEEF);
+	CHECK(s.reg(3) == 0xDEADBEEF);
+}
+
+int main(int argc, char **argv)
+{
+	std::map<std::string, void (*)(void)> tests = {
+		{"pipeline", test_pipeline},
+		{"batch", test_batch},
+		{"psram", test_psram},
+		{"errors", test_errors},
+	};
+
+	if((argc != 2) || !tests.count(argv[1]))
+	{
+		fprintf(stderr, "usage: icev_test pipeline|batch|psram|errors\n");
+		return 2;
+	}
+
+	try
+	{
+		tests[argv[1]]();
+	}
+	catch(const std::exception &e)
+	{
+		fprintf(stderr, "%s: FAIL %s\n", argv[1], e.what());
+		return 1;
+	}
+	printf("%s: ok\n", argv[1]);
+	return 0;
+}
@@ -0,0 +1,343 @@
+/*
+ * standin.cpp - loopback stand-in for a board, for the host library tests
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "standin.hpp"
+#include "net.hpp"
+/* the firmware's parser, built as C */
+extern "C" {
+#include "proto.h"
+}
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace icev::test {
+
+/* as main/ice.h and main/seq.h */
+constexpr uint32_t psram_sz = 8 * 1024 * 1024;
+constexpr uint8_t seq_op_end = 0x00;
+constexpr uint8_t seq_op_write = 0x01;
+constexpr uint8_t seq_op_read = 0x02;
+constexpr uint32_t seq_err_opcode = 1;
+constexpr uint32_t seq_err_trunc = 2;
+constexpr uint32_t seq_err_slot = 4;
+constexpr int seq_slots = 16;
+
+/* small so a paused stand-in holds up a big send quickly */
+constexpr int rcvbuf_sz = 32 * 1024;
+
+static void *body_alloc(uint32_t size)
+{
+	return malloc(size ? size : 1);
+}
+
+/*
+ * argument bytes a command can't do without - as socket_min_args()
+ */
+static uint32_t min_args(uint32_t cmd)
+{
+	switch(cmd)
+	{
+		case 0:
+		case 3:
+		case 8:
+		case 0xc:
+			return 4;
+		case 1:
+		case 0xb:
+			return 8;
+		default:
+			return 0;
+	}
+}
+
+static void put(std::vector<uint8_t> &v, uint32_t w)
+{
+	v.resize(v.size() + 4);
+	net::put32(&v[v.size() - 4], w);
+}
+
+StandIn::StandIn() : psram_(psram_sz)
+{
+	struct sockaddr_in addr = {};
+	socklen_t alen = sizeof(addr);
+	int one = 1, rcvbuf = rcvbuf_sz;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(((lsock_ = socket(AF_INET, SOCK_STREAM, 0)) < 0) ||
+		setsockopt(lsock_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+		setsockopt(lsock_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) ||
+		bind(lsock_, (struct sockaddr *)&addr, sizeof(addr)) ||
+		listen(lsock_, 1) ||
+		getsockname(lsock_, (struct sockaddr *)&addr, &alen))
+		throw std::runtime_error("stand-in: can't listen");
+	port_ = ntohs(addr.sin_port);
+
+	thread_ = std::thread(&StandIn::serve, this);
+}
+
+StandIn::~StandIn()
+{
+	{
+		std::lock_guard<std::mutex> lk(mu_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	shutdown(lsock_, SHUT_RDWR);
+	thread_.join();
+	::close(lsock_);
+}
+
+void StandIn::pause()
+{
+	std::lock_guard<std::mutex> lk(mu_);
+	paused_ = true;
+}
+
+void StandIn::resume()
+{
+	{
+		std::lock_guard<std::mutex> lk(mu_);
+		paused_ = false;
+	}
+	cv_.notify_all();
+}
+
+void StandIn::hold(int n)
+{
+	std::lock_guard<std::mutex> lk(mu_);
+	hold_ = n;
+}
+
+StandInLog StandIn::log()
+{
+	std::lock_guard<std::mutex> lk(mu_);
+	return log_;
+}
+
+uint32_t StandIn::reg(uint8_t r)
+{
+	std::lock_guard<std::mutex> lk(mu_);
+	return regs_[r & 0x7f];
+}
+
+/*
+ * one connection at a time, like the board
+ */
+void StandIn::serve()
+{
+	int sock;
+
+	while((sock = accept(lsock_, NULL, NULL)) >= 0)
+	{
+		try
+		{
+			session(sock);
+		}
+		catch(...)
+		{
+			/* client went away mid-message */
+		}
+		::close(sock);
+	}
+}
+
+/*
+ * receive while not paused - false once closed or stopping
+ */
+int StandIn::receive(int sock, uint8_t *buf, size_t len)
+{
+	{
+		std::unique_lock<std::mutex> lk(mu_);
+		cv_.wait(lk, [this] { return !paused_ || stop_; });
+		if(stop_)
+			return 0;
+	}
+	return recv(sock, buf, len, 0);
+}
+
+void StandIn::session(int sock)
+{
+	std::vector<uint8_t> out, body;
+	uint8_t buf[16384], rhdr[8];
+	uint32_t used;
+	proto_t p;
+	proto_hdr_t hdr;
+	int len, off, held = 0, res;
+
+	proto_init(&p, body_alloc);
+	while((len = receive(sock, buf, sizeof(buf))) > 0)
+	{
+		/* a segment may hold the end of one message and several more */
+		for(off = 0; off < len; )
+		{
+			res = proto_parse(&p, buf + off, len - off, &used);
+			off += used;
+			hdr = p.hdr;
+			if(res == PROTO_MSG)
+			{
+				uint8_t *b = proto_take(&p);
+				body.assign(b, b + hdr.txsz);
+				free(b);
+			}
+			else if(res == PROTO_STREAM)
+			{
+				/* the rest of a streamed body is read straight off the socket */
+				uint32_t n = std::min<uint32_t>(hdr.txsz, len - off);
+				int got;
+				body.assign(buf + off, buf + off + n);
+				off += n;
+				body.resize(hdr.txsz);
+				for(; n < hdr.txsz; n += got)
+					if((got = receive(sock, body.data() + n, hdr.txsz - n)) <= 0)
+						throw std::runtime_error("stand-in: closed mid-message");
+			}
+			else if(res == PROTO_BAD)
+			{
+				uint8_t err = 4;
+				send(sock, &err, 1, MSG_NOSIGNAL);
+				free(proto_take(&p));
+				return;
+			}
+			else
+				continue;
+
+			/* reply is tag and length, then status and data */
+			std::vector<uint8_t> r;
+			handle(hdr.cmd, body.data(), hdr.txsz, r);
+			out.insert(out.end(), rhdr, rhdr + proto_reply_hdr(&hdr, r.size(), rhdr));
+			out.insert(out.end(), r.begin(), r.end());
+			held++;
+
+			std::lock_guard<std::mutex> lk(mu_);
+			log_.cmds[hdr.cmd]++;
+			log_.tags.push_back(hdr.tag);
+			log_.max_held = std::max(log_.max_held, held);
+			if(held >= hold_)
+			{
+				net::send_all(sock, out.data(), out.size());
+				out.clear();
+				held = 0;
+				hold_ = 0;
+			}
+		}
+	}
+	free(proto_take(&p));
+}
+
+/*
+ * run one request - out gets the status byte and any data
+ */
+void StandIn::handle(uint32_t cmd, const uint8_t *body, uint32_t len, std::vector<uint8_t> &out)
+{
+	uint32_t addr, n;
+
+	out.push_back(0);
+	if(len < min_args(cmd))
+	{
+		out[0] |= 8;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lk(mu_);
+	switch(cmd)
+	{
+		case 0:
+			put(out, regs_[body[0] & 0x7f]);
+			break;
+
+		case 1:
+			regs_[body[0] & 0x7f] = net::get32(&body[4]);
+			break;
+
+		case 5:
+			sequence(body, len, out);
+			break;
+
+		case 0xb:
+			addr = net::get32(&body[0]);
+			n = net::get32(&body[4]);
+			if((addr > psram_sz) || (n > psram_sz - addr))
+				out[0] |= 8;
+			else
+				out.insert(out.end(), &psram_[addr], &psram_[addr] + n);
+			break;
+
+		case 0xc:
+			addr = net::get32(&body[0]);
+			n = len - 4;
+			if((addr > psram_sz) || (n > psram_sz - addr))
+				out[0] |= 8;
+			else
+				memcpy(&psram_[addr], body + 4, n);
+			break;
+
+		default:
+			out[0] |= 8;
+			break;
+	}
+}
+
+/*
+ * register ops of a sequence - reply is status, pc, elapsed, slots, rdlen
+ */
+void StandIn::sequence(const uint8_t *body, uint32_t len, std::vector<uint8_t> &out)
+{
+	uint32_t op = (len >= 4) ? net::get32(body) : 0xFFFFFFFF, status = 0, pc = 0;
+	uint32_t slots[seq_slots] = {};
+	const uint8_t *prog = body + 4;
+	uint32_t plen = (len > 4) ? len - 4 : 0;
+
+	if(op != 0)
+		out[0] |= 8;
+	else
+	{
+		while(!status && (pc < plen) && (prog[pc] != seq_op_end))
+		{
+			if(prog[pc] == seq_op_write)
+			{
+				if(pc + 6 > plen)
+					status = seq_err_trunc;
+				else
+				{
+					regs_[prog[pc + 1] & 0x7f] = net::get32(&prog[pc + 2]);
+					pc += 6;
+				}
+			}
+			else if(prog[pc] == seq_op_read)
+			{
+				if(pc + 3 > plen)
+					status = seq_err_trunc;
+				else if(prog[pc + 2] >= seq_slots)
+					status = seq_err_slot;
+				else
+				{
+					slots[prog[pc + 2]] = regs_[prog[pc + 1] & 0x7f];
+					pc += 3;
+				}
+			}
+			else
+				status = seq_err_opcode;
+		}
+		if(status)
+			out[0] |= 8;
+	}
+
+	put(out, status);
+	put(out, pc);
+	put(out, 0);
+	for(uint32_t s : slots)
+		put(out, s);
+	put(out, 0);
+}
+
+}
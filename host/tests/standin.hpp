@@ -0,0 +1,70 @@
+/*
+ * standin.hpp - loopback stand-in for a board, for the host library tests.
+ * Frames requests with the firmware's own proto.c and answers register,
+ * sequence and PSRAM commands from RAM the way the board does, error
+ * replies included.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __ICEV_STANDIN__
+#define __ICEV_STANDIN__
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace icev::test {
+
+/* what the stand-in has seen */
+struct StandInLog
+{
+	std::map<uint32_t, int> cmds;	// requests per command
+	std::vector<uint32_t> tags;		// in arrival order
+	int max_held = 0;				// most replies held back at once
+};
+
+class StandIn
+{
+public:
+	StandIn();
+	~StandIn();
+
+	uint16_t port() const { return port_; }
+
+	/* stop reading the connection until resumed */
+	void pause();
+	void resume();
+
+	/* hold replies until n requests have arrived, then send them together */
+	void hold(int n);
+
+	StandInLog log();
+	uint32_t reg(uint8_t r);
+	const uint8_t *psram() const { return psram_.data(); }
+
+private:
+	void serve();
+	int receive(int sock, uint8_t *buf, size_t len);
+	void session(int sock);
+	void handle(uint32_t cmd, const uint8_t *body, uint32_t len, std::vector<uint8_t> &out);
+	void sequence(const uint8_t *body, uint32_t len, std::vector<uint8_t> &out);
+
+	int lsock_ = -1;
+	uint16_t port_ = 0;
+	bool stop_ = false, paused_ = false;
+	int hold_ = 0;
+	std::mutex mu_;
+	std::condition_variable cv_;
+	std::thread thread_;
+	StandInLog log_;
+	uint32_t regs_[128] = {};
+	std::vector<uint8_t> psram_;
+};
+
+}
+
+#endif
@@ -0,0 +1,482 @@
+/*
+ * icev_cli.cpp - command line front end for the client library
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "icev/client.hpp"
+#include "icev/mdns.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <arpa/inet.h>
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: icev_cli discover\n"
+		"       icev_cli HOST read REG\n"
+		"       icev_cli HOST write REG VALUE\n"
+		"       icev_cli HOST vbat\n"
+		"       icev_cli HOST stats GROUP\n"
+		"       icev_cli HOST config FILE         (by CRC, uploads on a miss)\n"
+		"       icev_cli HOST save FILE\n"
+		"       icev_cli HOST deploy FILE         (configure, then save in the background)\n"
+		"       icev_cli HOST psram-read ADDR LEN FILE\n"
+		"       icev_cli HOST psram-write ADDR FILE\n"
+		"       icev_cli HOST psram-gather FILE ADDR:LEN...   (regions back to back)\n"
+		"       icev_cli HOST psram-scatter FILE ADDR:LEN...\n"
+		"       icev_cli HOST psram-fill ADDR LEN [BYTE...]\n"
+		"       icev_cli HOST psram-copy DST SRC LEN\n"
+		"       icev_cli HOST psram-crc ADDR LEN [FILE]  (FILE checks against its CRC)\n"
+		"       icev_cli HOST ota FILE\n"
+		"       icev_cli HOST ps [auto|none|min|max] [IDLE_MODE IDLE_MS BOOST_BPS]\n"
+		"       icev_cli HOST timesync SERVER [PORT] [INTERVAL_MS]|off|now|status\n"
+		"       icev_cli HOST write-at +MS|@US REG VALUE  (at a time on the server clock)\n"
+		"       icev_cli HOST regmap load FILE|clear|dump|stats  (FILE lines: REG[-LAST] cached|direct|wo)\n"
+		"       icev_cli HOST trace [clear]         (decoded trace ring)\n"
+		"       icev_cli HOST bench-spi psram ADDR BYTES [HZ...]  (on-device)\n"
+		"       icev_cli HOST bench-spi reg REG COUNT [HZ...]\n"
+		"       icev_cli HOST bench-net sink|source|echo BYTES\n"
+		"       icev_cli HOST bench-reg REG COUNT (pipelined register reads)\n"
+		"       icev_cli HOST session arm [SIZE]|stop|status|free  (records the next connection)\n"
+		"       icev_cli HOST session save FILE   (for icev_replay)\n");
+	exit(1);
+}
+
+static std::vector<std::byte> load(const char *name)
+{
+	std::ifstream f(name, std::ios::binary);
+	if(!f)
+	{
+		fprintf(stderr, "can't open %s\n", name);
+		exit(1);
+	}
+	std::vector<char> c((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	std::vector<std::byte> b(c.size());
+	memcpy(b.data(), c.data(), c.size());
+	return b;
+}
+
+static uint32_t num(const char *s)
+{
+	return strtoul(s, NULL, 0);
+}
+
+static std::vector<icev::PsramRegion> regions(int argc, char **argv, size_t &total)
+{
+	std::vector<icev::PsramRegion> r;
+	char *end;
+
+	total = 0;
+	for(int i = 0; i < argc; i++)
+	{
+		icev::PsramRegion x;
+		x.addr = strtoul(argv[i], &end, 0);
+		if(*end != ':')
+			usage();
+		x.len = num(end + 1);
+		total += x.len;
+		r.push_back(x);
+	}
+	return r;
+}
+
+/*
+ * read a register map - one range per line, # starts a comment
+ */
+static std::vector<icev::RegRange> regmap_file(const char *name)
+{
+	static const char *classes[] = {"direct", "cached", "wo"};
+	std::vector<icev::RegRange> map;
+	std::ifstream f(name);
+	std::string line;
+	int n = 0;
+
+	if(!f)
+	{
+		fprintf(stderr, "can't open %s\n", name);
+		exit(1);
+	}
+	while(std::getline(f, line))
+	{
+		char first[32], cls[32], *end;
+		n++;
+		line = line.substr(0, line.find('#'));
+		if(sscanf(line.c_str(), "%31s %31s", first, cls) != 2)
+			continue;
+
+		icev::RegRange r;
+		uint32_t last = r.first = strtoul(first, &end, 0);
+		if(*end == '-')
+			last = strtoul(end + 1, &end, 0);
+		uint32_t c = 0;
+		while((c < 3) && strcmp(cls, classes[c]))
+			c++;
+		if(*end || (last < r.first) || (last >= icev::reg_count) || (c == 3))
+		{
+			fprintf(stderr, "%s:%d: expected REG[-LAST] cached|direct|wo\n", name, n);
+			exit(1);
+		}
+		r.count = last - r.first + 1;
+		r.cls = (icev::RegClass)c;
+		map.push_back(r);
+	}
+	return map;
+}
+
+static void sg_status(std::vector<uint32_t> &st)
+{
+	for(size_t i = 0; i < st.size(); i++)
+		if(st[i] != icev::sg_ok)
+			printf("region %zu %s\n", i, (st[i] == icev::sg_range) ? "out of range" : "short");
+}
+
+int main(int argc, char **argv)
+{
+	if((argc == 2) && !strcmp(argv[1], "discover"))
+	{
+		for(auto &d : icev::discover())
+		{
+			printf("%s  %s  %s:%d", d.instance.c_str(), d.hostname.c_str(), d.address.c_str(), d.port);
+			for(auto &kv : d.txt)
+				printf("  %s=%s", kv.first.c_str(), kv.second.c_str());
+			printf("\n");
+		}
+		return 0;
+	}
+	if(argc < 3)
+		usage();
+
+	icev::Client c(argv[1]);
+	std::string cmd = argv[2];
+
+	try
+	{
+		if((cmd == "read") && (argc == 4))
+			printf("0x%08X\n", c.read_reg(num(argv[3])).get());
+		else if((cmd == "write") && (argc == 5))
+			c.write_reg(num(argv[3]), num(argv[4])).get();
+		else if(cmd == "vbat")
+			printf("%u mV\n", c.vbat_mv().get());
+		else if((cmd == "stats") && (argc == 4))
+		{
+			auto v = c.stats((icev::StatsGroup)num(argv[3])).get();
+			for(size_t i = 0; i + 4 <= v.size(); i += 4)
+			{
+				uint32_t w;
+				memcpy(&w, &v[i], 4);
+				printf("%u%c", w, ((i / 4) % 8 == 7) ? '\n' : ' ');
+			}
+			printf("\n");
+		}
+		else if((cmd == "config") && (argc == 4))
+		{
+			auto bits = load(argv[3]);
+			auto start = std::chrono::steady_clock::now();
+			auto src = c.configure_cached(bits);
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			static const char *from[] = {"RAM cache", "flash", "upload"};
+			printf("configured from %s in %ld us\n", from[(int)src], (long)us);
+		}
+		else if((cmd == "deploy") && (argc == 4))
+		{
+			auto bits = load(argv[3]);
+			auto start = std::chrono::steady_clock::now();
+			auto ms = [&start] {
+				return (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - start).count();
+			};
+			auto job = c.configure_persist(bits).get();
+			printf("configured in %ld ms, CRC 0x%08X\n", ms(), job.crc);
+
+			icev::PersistStatus st;
+			do
+				st = c.persist_status(10000).get();
+			while((st.seq == job.seq) && (st.state == icev::PersistState::writing));
+			if((st.seq != job.seq) || (st.state != icev::PersistState::done))
+			{
+				printf("flash write failed, status %d\n", (int)st.result);
+				return 2;
+			}
+			printf("saved in %ld ms (%u us on the board)\n", ms(), st.write_us);
+		}
+		else if((cmd == "save") && (argc == 4))
+			c.save_bitstream(load(argv[3])).get();
+		else if((cmd == "psram-read") && (argc == 6))
+		{
+			std::vector<std::byte> buf(num(argv[4]));
+			c.psram_read(num(argv[3]), buf).get();
+			std::ofstream(argv[5], std::ios::binary).write((const char *)buf.data(), buf.size());
+		}
+		else if((cmd == "psram-write") && (argc == 5))
+			c.psram_write(num(argv[3]), load(argv[4])).get();
+		else if((cmd == "psram-gather") && (argc >= 5))
+		{
+			size_t total;
+			auto regs = regions(argc - 4, argv + 4, total);
+			std::vector<std::byte> buf(total);
+			auto st = c.psram_gather(regs, buf).get();
+			sg_status(st);
+			std::ofstream(argv[3], std::ios::binary).write((const char *)buf.data(), buf.size());
+		}
+		else if((cmd == "psram-scatter") && (argc >= 5))
+		{
+			size_t total;
+			auto regs = regions(argc - 4, argv + 4, total);
+			auto data = load(argv[3]);
+			if(data.size() < total)
+			{
+				fprintf(stderr, "%s is shorter than the regions\n", argv[3]);
+				return 1;
+			}
+			data.resize(total);
+			auto st = c.psram_scatter(regs, data).get();
+			sg_status(st);
+		}
+		else if((cmd == "psram-fill") && (argc >= 5))
+		{
+			std::vector<std::byte> pat;
+			for(int i = 5; i < argc; i++)
+				pat.push_back((std::byte)num(argv[i]));
+			c.psram_fill(num(argv[3]), num(argv[4]), pat).get();
+		}
+		else if((cmd == "psram-copy") && (argc == 6))
+			c.psram_copy(num(argv[3]), num(argv[4]), num(argv[5])).get();
+		else if((cmd == "psram-crc") && ((argc == 5) || (argc == 6)))
+		{
+			uint32_t crc = c.psram_crc(num(argv[3]), num(argv[4])).get();
+			printf("0x%08X\n", crc);
+			if(argc == 6)
+			{
+				auto data = load(argv[5]);
+				data.resize(std::min<size_t>(data.size(), num(argv[4])));
+				if(icev::crc32(data) != crc)
+				{
+					printf("differs from %s (0x%08X)\n", argv[5], icev::crc32(data));
+					return 2;
+				}
+			}
+		}
+		else if((cmd == "ota") && (argc == 4))
+		{
+			auto r = c.update_firmware(load(argv[3])).get();
+			printf("wrote %u bytes in %u ms, board restarting\n", r.written, r.elapsed_ms);
+		}
+		else if((cmd == "ps") && ((argc == 3) || (argc == 4) || (argc == 7)))
+		{
+			static const char *modes[] = {"none", "min", "max"};
+			icev::PsState st;
+			if(argc == 3)
+				st = c.power_save().get();
+			else
+			{
+				icev::PsConfig cfg;
+				for(uint32_t i = 0; i < 3; i++)
+					if(!strcmp(argv[3], modes[i]))
+						cfg.pin = i;
+				if(argc == 7)
+				{
+					cfg.idle_mode = num(argv[4]);
+					cfg.idle_ms = num(argv[5]);
+					cfg.boost_bps = num(argv[6]);
+				}
+				st = c.power_save(cfg).get();
+			}
+			printf("mode %s, pin %s, idle %s after %u ms, boost at %u B/s\n",
+				modes[(int)st.mode % 3],
+				(st.config.pin == icev::ps_auto) ? "auto" : modes[st.config.pin % 3],
+				modes[st.config.idle_mode % 3], st.config.idle_ms, st.config.boost_bps);
+		}
+		else if((cmd == "timesync") && (argc >= 3) && (argc <= 6))
+		{
+			std::string op = (argc > 3) ? argv[3] : "status";
+			icev::SyncStats st;
+			if(op == "status")
+				st = c.sync_stats().get();
+			else if(op == "now")
+				st = c.sync_now().get();
+			else if(op == "off")
+				st = c.time_sync("").get();
+			else
+				st = c.time_sync(op, (argc > 4) ? num(argv[4]) : icev::timesync_port,
+					(argc > 5) ? num(argv[5]) : 10000).get();
+
+			struct in_addr ip = {st.server};
+			printf("server %s:%u every %u ms, %u syncs, %u failed, last %u ms ago\n",
+				st.server ? inet_ntoa(ip) : "none", st.port, st.interval_ms, st.syncs, st.fails, st.age_ms);
+			if(st.samples)
+				printf("offset %lld us, drift %+.3f ppm over %u samples, rtt %u us\n",
+					(long long)st.offset_us, st.drift_ppb / 1000.0, st.samples, st.rtt_us);
+			else
+				printf("not synced\n");
+			printf("%u timed commands, %u late, last error %+d us, worst %u us\n",
+				st.sched, st.late, st.last_err_us, st.max_err_us);
+		}
+		else if((cmd == "write-at") && (argc == 6) && ((argv[3][0] == '+') || (argv[3][0] == '@')))
+		{
+			/* +MS is from now, @US is absolute server time */
+			uint64_t when = strtoull(argv[3] + 1, NULL, 0);
+			if(argv[3][0] == '+')
+				when = icev::server_time_us() + when * 1000;
+			c.write_reg_at(when, num(argv[4]), num(argv[5])).get();
+			auto st = c.sync_stats().get();
+			printf("written at %llu, %+d us from target\n", (unsigned long long)when, st.last_err_us);
+		}
+		else if((cmd == "trace") && ((argc == 3) || ((argc == 4) && !strcmp(argv[3], "clear"))))
+		{
+			auto d = c.trace(argc == 4).get();
+			uint32_t prev = d.records.empty() ? 0 : d.records[0].ts_us;
+			if(d.lost)
+				printf("(%u records lost)\n", d.lost);
+			for(auto &r : d.records)
+			{
+				/* times relative to the dump, gaps to the record before */
+				printf("%10.6f %+9.6f  ", -(int32_t)(d.now_us - r.ts_us) / 1e6,
+					(int32_t)(r.ts_us - prev) / 1e6);
+				prev = r.ts_us;
+				if(auto *t = icev::trace_id(r.id))
+					printf("%-12s %s=0x%X %s=0x%X\n", t->name, t->a, r.a, t->b, r.b);
+				else
+					printf("id %-9u 0x%X 0x%X\n", r.id, r.a, r.b);
+			}
+		}
+		else if((cmd == "bench-spi") && (argc >= 6))
+		{
+			icev::BenchArgs a;
+			bool reg = !strcmp(argv[3], "reg");
+			a.test = reg ? icev::BenchTest::reg : icev::BenchTest::psram;
+			a.addr = num(argv[4]);
+			a.total = num(argv[5]);
+			a.flags = reg ? icev::bench_verify : (icev::bench_slow_read | icev::bench_fast_read);
+			for(int i = 6; i < argc; i++)
+				a.clocks_hz.push_back(num(argv[i]));
+
+			printf("%10s %4s %6s %7s %10s %10s %9s %9s %6s\n", "clk_hz", "op", "size", "count",
+				reg ? "wr/s" : "wr_kB/s", reg ? "rd/s" : "rd_kB/s", "wr_ovh_ns", "rd_ovh_ns", "errors");
+			for(auto &r : c.bench(a).get())
+			{
+				if(!r.clk_hz)
+					printf("%10u  not supported\n", r.req_hz);
+				else
+					printf("%10u 0x%02X %6u %7u %10u %10u %9u %9u %6u\n", r.clk_hz, r.rd_cmd, r.size,
+						r.count, r.wr_rate, r.rd_rate, r.wr_ovh_ns, r.rd_ovh_ns, r.errors);
+			}
+		}
+		else if((cmd == "bench-net") && (argc == 5))
+		{
+			std::string mode = argv[3];
+			uint32_t n = num(argv[4]);
+			std::vector<std::byte> data(mode == "source" ? 0 : n);
+			for(uint32_t i = 0; i < data.size(); i++)
+				data[i] = (std::byte)(i * 7);
+			c.vbat_mv().get();	// connect outside the timing
+
+			auto start = std::chrono::steady_clock::now();
+			icev::NetStats st;
+			if(mode == "sink")
+				st = c.net_sink(data).get();
+			else if(mode == "source")
+				st = c.net_source(n).get();
+			else if(mode == "echo")
+				st = c.net_echo(data).get();
+			else
+				usage();
+			double us = std::chrono::duration<double, std::micro>(
+				std::chrono::steady_clock::now() - start).count();
+
+			printf("board: %u bytes in %u us, %u kB/s, %u calls, %u stalls, max gap %u us\n",
+				st.bytes, st.us, st.kbytes_per_sec, st.calls, st.stalls, st.max_gap_us);
+			printf("host:  %.0f us, %.0f kB/s\n", us, n * 1000.0 / us);
+			printf("lwIP:  window %u, send buffer %u, MSS %u\n", st.tcp_wnd, st.tcp_snd_buf, st.tcp_mss);
+		}
+		else if((cmd == "regmap") && ((argc == 4) || (argc == 5)))
+		{
+			std::string op = argv[3];
+			if((op == "load") && (argc == 5))
+				c.load_regmap(regmap_file(argv[4])).get();
+			else if(op == "clear")
+				c.load_regmap({}).get();
+			else if(op == "dump")
+			{
+				static const char *classes[] = {"direct", "cached", "wo"};
+				auto s = c.regmap_dump().get();
+				for(size_t i = 0; i < icev::reg_count; i++)
+				{
+					if(s.cls[i] == icev::RegClass::direct)
+						continue;
+					printf("0x%02zx %-6s ", i, classes[(int)s.cls[i] % 3]);
+					if(s.valid[i])
+						printf("0x%08X\n", s.value[i]);
+					else
+						printf("-\n");
+				}
+			}
+			else if(op == "stats")
+			{
+				auto st = c.regmap_stats().get();
+				uint32_t cached = st.hits + st.misses;
+				printf("%u cached, %u write-only, %u shadowed\n", st.cached, st.write_only, st.valid);
+				printf("reads: %u from shadow, %u filled, %u direct (%.1f%% hit)\n", st.hits, st.misses,
+					st.reads, cached ? 100.0 * st.hits / cached : 0.0);
+				printf("%u writes, %u maps loaded, %u invalidated\n", st.writes, st.loads, st.invalidates);
+			}
+			else
+				usage();
+		}
+		else if((cmd == "session") && (argc >= 4))
+		{
+			static const char *states[] = {"idle", "armed", "recording", "done"};
+			std::string op = argv[3];
+			icev::SessionStatus st;
+			if((op == "save") && (argc == 5))
+			{
+				auto cap = c.session_download();
+				std::ofstream(argv[4], std::ios::binary).write((const char *)cap.data(), cap.size());
+				st = c.session_status().get();
+			}
+			else if(op == "arm")
+				st = ((argc == 5) ? c.session_arm(num(argv[4])) : c.session_arm()).get();
+			else if(op == "stop")
+				st = c.session_stop().get();
+			else if(op == "status")
+				st = c.session_status().get();
+			else if(op == "free")
+				st = c.session_free().get();
+			else
+				usage();
+			printf("%s, %u records, %u of %u bytes%s\n", states[(int)st.state % 4], st.records,
+				st.used, st.size, (st.flags & icev::session_overflow) ? ", overflowed" : "");
+		}
+		else if((cmd == "bench-reg") && (argc == 5))
+		{
+			uint32_t reg = num(argv[3]), n = num(argv[4]);
+			std::vector<std::future<uint32_t>> f;
+			c.read_reg(reg).get();	// connect outside the timing
+
+			auto start = std::chrono::steady_clock::now();
+			for(uint32_t i = 0; i < n; i++)
+				f.push_back(c.read_reg(reg));
+			for(auto &x : f)
+				x.get();
+			double us = std::chrono::duration<double, std::micro>(
+				std::chrono::steady_clock::now() - start).count();
+			printf("%u reads in %.0f us, %.1f us each\n", n, us, us / n);
+		}
+		else
+			usage();
+	}
+	catch(const icev::Error &e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+
+	return 0;
+}
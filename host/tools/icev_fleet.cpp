@@ -0,0 +1,202 @@
+/*
+ * icev_fleet.cpp - programs a bitstream into every board on the network.
+ * Boards are found with mDNS, ones whose TXT crc already matches are
+ * skipped and the rest are configured and saved a few at a time in
+ * parallel, so a rack takes about as long as its slowest board.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "icev/client.hpp"
+#include "icev/mdns.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+/* one board and how it went */
+struct Target
+{
+	std::string name;
+	std::string address;
+	uint16_t port = icev::default_port;
+	std::string fw;
+	bool current = false;		// already running the design
+	bool ok = false;
+	double config_ms = 0;		// upload and configure
+	double total_ms = 0;		// until the flash write was done
+	std::string error;
+};
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: icev_fleet [-j JOBS] [-w WAIT_MS] [--force] [--ram] FILE [HOST...]\n"
+		"  boards come from mDNS unless HOSTs are given\n"
+		"  -j       boards programmed at once (default 8)\n"
+		"  -w       mDNS listen time (default 2000)\n"
+		"  --force  program boards already running FILE\n"
+		"  --ram    configure only, don't save to flash\n");
+	exit(1);
+}
+
+static std::vector<std::byte> load(const char *name)
+{
+	std::ifstream f(name, std::ios::binary);
+	if(!f)
+	{
+		fprintf(stderr, "can't open %s\n", name);
+		exit(1);
+	}
+	std::vector<char> c((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	std::vector<std::byte> b(c.size());
+	memcpy(b.data(), c.data(), c.size());
+	return b;
+}
+
+static double ms_since(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/*
+ * configure one board and wait for its flash write
+ */
+static void program(Target &t, std::span<const std::byte> bits, bool ram)
+{
+	auto start = Clock::now();
+
+	try
+	{
+		icev::Client c(t.address, t.port);
+		if(ram)
+		{
+			/* no upload at all if the board still has it cached */
+			c.configure_cached(bits);
+			t.config_ms = t.total_ms = ms_since(start);
+			t.ok = true;
+			return;
+		}
+
+		auto job = c.configure_persist(bits).get();
+		t.config_ms = ms_since(start);
+
+		icev::PersistStatus st;
+		do
+			st = c.persist_status(10000).get();
+		while((st.seq == job.seq) && (st.state == icev::PersistState::writing));
+		t.total_ms = ms_since(start);
+		if((st.seq != job.seq) || (st.state != icev::PersistState::done))
+			t.error = "flash write failed, status " + std::to_string(st.result);
+		else
+			t.ok = true;
+	}
+	catch(const std::exception &e)
+	{
+		t.total_ms = ms_since(start);
+		t.error = e.what();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned jobs = 8, wait_ms = 2000;
+	bool force = false, ram = false;
+	std::vector<Target> targets;
+	int i;
+
+	for(i = 1; (i < argc) && (argv[i][0] == '-'); i++)
+	{
+		if(!strcmp(argv[i], "-j") && (i + 1 < argc))
+			jobs = strtoul(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "-w") && (i + 1 < argc))
+			wait_ms = strtoul(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "--force"))
+			force = true;
+		else if(!strcmp(argv[i], "--ram"))
+			ram = true;
+		else
+			usage();
+	}
+	if((i >= argc) || !jobs)
+		usage();
+
+	auto bits = load(argv[i++]);
+	uint32_t crc = icev::crc32(bits);
+
+	/* named boards, or whatever answers mDNS */
+	if(i < argc)
+	{
+		for(; i < argc; i++)
+		{
+			Target t;
+			t.name = t.address = argv[i];
+			targets.push_back(t);
+		}
+	}
+	else
+	{
+		for(auto &d : icev::discover(std::chrono::milliseconds(wait_ms)))
+		{
+			Target t;
+			t.name = d.instance;
+			t.address = d.address.empty() ? d.hostname : d.address;
+			if(d.port)
+				t.port = d.port;
+			if(d.txt.count("fw"))
+				t.fw = d.txt["fw"];
+			if(d.txt.count("crc"))
+				t.current = (strtoul(d.txt["crc"].c_str(), NULL, 16) == crc);
+			targets.push_back(t);
+		}
+	}
+	if(targets.empty())
+	{
+		fprintf(stderr, "no boards found\n");
+		return 1;
+	}
+
+	/* a few workers take boards off the list until it's done */
+	std::atomic<size_t> next = 0;
+	std::vector<std::thread> pool;
+	auto start = Clock::now();
+	for(unsigned w = 0; w < std::min<size_t>(jobs, targets.size()); w++)
+		pool.emplace_back([&] {
+			size_t n;
+			while((n = next++) < targets.size())
+				if(force || !targets[n].current)
+					program(targets[n], bits, ram);
+		});
+	for(auto &t : pool)
+		t.join();
+	double wall = ms_since(start), sum = 0;
+
+	int done = 0, skipped = 0, failed = 0;
+	printf("%-28s %-15s %-6s %10s %10s  %s\n", "board", "address", "fw", "config_ms", "total_ms", "result");
+	for(auto &t : targets)
+	{
+		printf("%-28s %-15s %-6s ", t.name.c_str(), t.address.c_str(), t.fw.empty() ? "-" : t.fw.c_str());
+		if(t.current && !force)
+		{
+			printf("%10s %10s  current\n", "-", "-");
+			skipped++;
+			continue;
+		}
+		printf("%10.1f %10.1f  %s\n", t.config_ms, t.total_ms, t.ok ? "ok" : t.error.c_str());
+		sum += t.total_ms;
+		t.ok ? done++ : failed++;
+	}
+	printf("%d programmed, %d current, %d failed in %.0f ms (%.0f ms one at a time)\n",
+		done, skipped, failed, wall, sum);
+
+	return failed ? 2 : 0;
+}
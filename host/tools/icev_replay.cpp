@@ -0,0 +1,289 @@
+/*
+ * icev_replay.cpp - plays back a session captured with "icev_cli HOST
+ * session save". Offline it pushes the received segments, split exactly as
+ * the board's recv() calls returned them, through the firmware's own
+ * proto.c and checks it finds the same messages the board did. With
+ * --board it sends the same segments to a live board and compares the
+ * replies with the captured ones.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "icev/client.hpp"
+#include "net.hpp"
+/* the firmware's parser, built as C */
+extern "C" {
+#include "proto.h"
+}
+#include "session_fmt.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct Record
+{
+	uint32_t ts_us;
+	uint32_t type;
+	std::vector<uint8_t> data;
+};
+
+using Clock = std::chrono::steady_clock;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: icev_replay [--realtime] FILE               (offline, through proto.c)\n"
+		"       icev_replay [--realtime] --board HOST FILE  (live, compares replies)\n");
+	exit(1);
+}
+
+/*
+ * read and check a capture
+ */
+static std::vector<Record> load(const char *name)
+{
+	std::ifstream f(name, std::ios::binary);
+	std::vector<char> c((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	std::vector<Record> recs;
+	session_file_t hdr;
+	size_t off = sizeof(session_file_t);
+
+	if(c.size() < sizeof(session_file_t))
+	{
+		fprintf(stderr, "can't read %s\n", name);
+		exit(1);
+	}
+	memcpy(&hdr, c.data(), sizeof(hdr));
+	if((hdr.magic != SESSION_MAGIC) || (hdr.version != SESSION_VERSION) ||
+		(hdr.rec_sz != sizeof(session_rec_t)))
+	{
+		fprintf(stderr, "%s isn't a version %d session capture\n", name, SESSION_VERSION);
+		exit(1);
+	}
+
+	while(off + sizeof(session_rec_t) <= c.size())
+	{
+		session_rec_t r;
+		memcpy(&r, &c[off], sizeof(r));
+		off += sizeof(r);
+		if(off + r.len > c.size())
+		{
+			fprintf(stderr, "capture truncated at record %zu\n", recs.size());
+			break;
+		}
+		recs.push_back({r.ts_us, r.type, std::vector<uint8_t>(&c[off], &c[off] + r.len)});
+		off += (r.len + 3) & ~3;
+	}
+
+	return recs;
+}
+
+static void pace(bool realtime, Clock::time_point start, uint32_t ts_us)
+{
+	if(realtime)
+		std::this_thread::sleep_until(start + std::chrono::microseconds(ts_us));
+}
+
+static void *body_alloc(uint32_t size)
+{
+	return malloc(size);
+}
+
+/*
+ * feed the receives through the parser the way do_getmsg() does and check
+ * the result against what the board found
+ */
+static int offline(const std::vector<Record> &recs, bool realtime)
+{
+	std::vector<proto_hdr_t> want, got;
+	Clock::duration total{}, worst{};
+	proto_t p;
+	uint32_t skip = 0;
+	bool stop = false;
+	int bad = 0;
+
+	for(auto &r : recs)
+	{
+		if(((r.type == SESSION_MSG) || (r.type == SESSION_STREAM)) && (r.data.size() == sizeof(proto_hdr_t)))
+		{
+			proto_hdr_t h;
+			memcpy(&h, r.data.data(), sizeof(h));
+			want.push_back(h);
+		}
+		else if(r.type == SESSION_BAD)
+			want.push_back(proto_hdr_t{~0u, 0, 0, 0});
+	}
+
+	proto_init(&p, body_alloc);
+	auto start = Clock::now();
+	for(auto &r : recs)
+	{
+		if(r.type != SESSION_RX)
+			continue;
+		pace(realtime, start, r.ts_us);
+
+		const uint8_t *rxp = r.data.data();
+		uint32_t len = r.data.size(), used, n;
+		auto t0 = Clock::now();
+		while(len && !stop)
+		{
+			int res;
+			uint8_t *dst;
+
+			/* streaming cmds read their own data */
+			if(skip)
+			{
+				n = std::min(skip, len);
+				skip -= n;
+				rxp += n;
+				len -= n;
+				continue;
+			}
+
+			/* bodies go straight into their buffer, no more than asked for */
+			if((dst = proto_direct(&p, &n)))
+			{
+				n = std::min(n, len);
+				memcpy(dst, rxp, n);
+				res = proto_advance(&p, n);
+				used = n;
+			}
+			else
+				res = proto_parse(&p, rxp, len, &used);
+			rxp += used;
+			len -= used;
+
+			if(res == PROTO_MSG)
+			{
+				got.push_back(p.hdr);
+				free(proto_take(&p));
+				stop = (p.hdr.cmd == 3);	// subscribe takes the socket away
+			}
+			else if(res == PROTO_STREAM)
+			{
+				got.push_back(p.hdr);
+				skip = p.hdr.txsz;
+			}
+			else if(res == PROTO_BAD)
+			{
+				got.push_back(proto_hdr_t{~0u, 0, 0, 0});
+				stop = true;
+			}
+		}
+		auto dt = Clock::now() - t0;
+		total += dt;
+		worst = std::max(worst, dt);
+	}
+	free(proto_take(&p));
+
+	for(size_t i = 0; i < std::max(want.size(), got.size()); i++)
+	{
+		if((i < want.size()) && (i < got.size()) && !memcmp(&want[i], &got[i], sizeof(proto_hdr_t)))
+			continue;
+		if(bad++ < 10)
+		{
+			printf("message %zu:", i);
+			if(i < want.size())
+				printf(" board cmd 0x%x txsz %u tag %u", want[i].cmd, want[i].txsz, want[i].tag);
+			if(i < got.size())
+				printf(" replay cmd 0x%x txsz %u tag %u", got[i].cmd, got[i].txsz, got[i].tag);
+			printf("\n");
+		}
+	}
+
+	double us = std::chrono::duration<double, std::micro>(total).count();
+	printf("%zu messages, %d mismatched\n", got.size(), bad);
+	printf("parse %.1f us total, %.3f us per message, worst segment %.1f us\n", us,
+		got.empty() ? 0.0 : us / got.size(), std::chrono::duration<double, std::micro>(worst).count());
+
+	return bad ? 2 : 0;
+}
+
+/*
+ * send the receives to a board and compare what comes back with the
+ * captured sends. Replies holding live data (registers, timers, battery)
+ * will differ - the offset of the first difference says where.
+ */
+static int live(const std::vector<Record> &recs, const std::string &host, bool realtime)
+{
+	std::vector<uint8_t> expect, reply;
+	int sock = icev::net::connect_tcp(host, icev::default_port);
+
+	for(auto &r : recs)
+		if(r.type == SESSION_TX)
+			expect.insert(expect.end(), r.data.begin(), r.data.end());
+
+	std::thread tx([&] {
+		auto start = Clock::now();
+		for(auto &r : recs)
+			if(r.type == SESSION_RX)
+			{
+				pace(realtime, start, r.ts_us);
+				icev::net::send_all(sock, r.data.data(), r.data.size());
+			}
+	});
+
+	/* take replies until we have them all or the board goes quiet */
+	auto start = Clock::now();
+	uint8_t buf[4096];
+	while((reply.size() < expect.size()) && icev::net::wait_readable(sock, 2000))
+	{
+		ssize_t n = recv(sock, buf, sizeof(buf), 0);
+		if(n <= 0)
+			break;
+		reply.insert(reply.end(), buf, buf + n);
+	}
+	double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+	tx.join();
+	::close(sock);
+
+	auto diff = std::mismatch(expect.begin(), expect.end(), reply.begin(), reply.end());
+	printf("%zu of %zu reply bytes in %.0f us\n", reply.size(), expect.size(), us);
+	if((diff.first == expect.end()) && (diff.second == reply.end()))
+	{
+		printf("replies match\n");
+		return 0;
+	}
+	printf("replies differ from byte %zu\n", (size_t)(diff.first - expect.begin()));
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	bool realtime = false;
+	std::string board;
+	int i;
+
+	for(i = 1; (i < argc) && (argv[i][0] == '-'); i++)
+	{
+		if(!strcmp(argv[i], "--realtime"))
+			realtime = true;
+		else if(!strcmp(argv[i], "--board") && (i + 1 < argc))
+			board = argv[++i];
+		else
+			usage();
+	}
+	if(i != argc - 1)
+		usage();
+
+	auto recs = load(argv[i]);
+	try
+	{
+		return board.empty() ? offline(recs, realtime) : live(recs, board, realtime);
+	}
+	catch(const std::exception &e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+}
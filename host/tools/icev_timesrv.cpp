@@ -0,0 +1,81 @@
+/*
+ * icev_timesrv.cpp - time server for board clock sync. Answers each
+ * request with its receive and send times on server_time_us(), the clock
+ * the host library schedules timed commands against. Boards are pointed
+ * at it with "icev_cli HOST timesync SERVER".
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include "icev/client.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* matches tsync_pkt_t in main/timesync.h */
+struct Packet
+{
+	uint32_t magic;
+	uint32_t seq;
+	uint64_t t1;		// board send
+	uint64_t t2;		// our receive
+	uint64_t t3;		// our send
+};
+
+constexpr uint32_t magic = 0xCAFE7135;
+
+int main(int argc, char **argv)
+{
+	bool verbose = false;
+	uint16_t port = icev::timesync_port;
+	int i;
+
+	for(i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-v"))
+			verbose = true;
+		else if(!strcmp(argv[i], "-p") && (i + 1 < argc))
+			port = strtoul(argv[++i], NULL, 0);
+		else
+		{
+			fprintf(stderr, "usage: icev_timesrv [-p PORT] [-v]\n");
+			return 1;
+		}
+	}
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if((sock < 0) || (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0))
+	{
+		perror("icev_timesrv");
+		return 1;
+	}
+	printf("serving time on udp port %u\n", port);
+
+	for(;;)
+	{
+		struct sockaddr_in from;
+		socklen_t alen = sizeof(from);
+		Packet p;
+
+		ssize_t n = recvfrom(sock, &p, sizeof(p), 0, (struct sockaddr *)&from, &alen);
+		uint64_t t2 = icev::server_time_us();
+		if((n != sizeof(p)) || (p.magic != magic))
+			continue;
+
+		/* stamp as close to the socket calls as we can */
+		p.t2 = t2;
+		p.t3 = icev::server_time_us();
+		sendto(sock, &p, sizeof(p), 0, (struct sockaddr *)&from, alen);
+		if(verbose)
+			printf("%s seq %u\n", inet_ntoa(from.sin_addr), p.seq);
+	}
+}
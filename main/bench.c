@@ -0,0 +1,267 @@
+/*
+ * bench.c - on-device SPI benchmarks. Runs PSRAM and register traffic
+ * across transfer sizes, SPI clocks and read opcodes with the network out
+ * of the picture, checking the data as it goes.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "bench.h"
+#include "ice.h"
+#include "regmap.h"
+#include "esp_timer.h"
+
+static const char *TAG = "bench";
+
+/* PSRAM read opcodes in bench_args_t.flags bit order */
+static const uint8_t bench_rd_cmds[] = {ICE_PSRAM_SLOW_READ, ICE_PSRAM_FAST_READ};
+
+/*
+ * test data - different every point so stale data can't pass
+ */
+static void bench_fill(uint32_t *buf, uint32_t words, uint32_t seed)
+{
+	uint32_t x = seed | 1;
+	
+	while(words--)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		*buf++ = x;
+	}
+}
+
+/*
+ * count words that differ
+ */
+static uint32_t bench_check(const uint32_t *a, const uint32_t *b, uint32_t words)
+{
+	uint32_t bad = 0;
+	
+	if(!memcmp(a, b, words * 4))
+		return 0;
+	
+	while(words--)
+		if(*a++ != *b++)
+			bad++;
+	
+	return bad;
+}
+
+/*
+ * time per transaction beyond the bits on the wire, in ns
+ */
+static uint32_t bench_ovh(int64_t us, uint32_t count, uint32_t bytes, uint32_t hz)
+{
+	int64_t per = us * 1000 / count, wire = (int64_t)bytes * 8 * 1000000000LL / hz;
+	
+	return (per > wire) ? per - wire : 0;
+}
+
+/*
+ * write then read back total bytes in size byte transactions
+ */
+static void bench_psram(const bench_args_t *a, uint32_t size, uint32_t seed,
+	uint32_t *wbuf, uint32_t *rbuf, bench_row_t *row, int *nrows, int maxrows)
+{
+	uint32_t n = (a->total > size) ? a->total / size : 1, i, c, errors;
+	uint32_t words = size / 4;
+	int64_t start, wr_us;
+	
+	bench_fill(wbuf, words, seed);
+	
+	/* first word tags each transaction so aliased addresses show up */
+	start = esp_timer_get_time();
+	for(i = 0; i < n; i++)
+	{
+		wbuf[0] = seed ^ i;
+		ICE_PSRAM_Write(a->addr + i * size, (uint8_t *)wbuf, size);
+	}
+	wr_us = esp_timer_get_time() - start;
+	
+	for(c = 0; (c < sizeof(bench_rd_cmds)) && (*nrows < maxrows); c++)
+	{
+		if(!(a->flags & (1 << c)))
+			continue;
+		
+		ICE_PSRAM_SetReadCmd(bench_rd_cmds[c]);
+		errors = 0;
+		start = esp_timer_get_time();
+		for(i = 0; i < n; i++)
+		{
+			ICE_PSRAM_Read(a->addr + i * size, (uint8_t *)rbuf, size);
+			wbuf[0] = seed ^ i;
+			errors += bench_check(wbuf, rbuf, words);
+		}
+		start = esp_timer_get_time() - start;
+		
+		row[*nrows].rd_cmd = bench_rd_cmds[c];
+		row[*nrows].size = size;
+		row[*nrows].count = n;
+		row[*nrows].wr_rate = (uint64_t)n * size * 1000 / (wr_us ? wr_us : 1);
+		row[*nrows].rd_rate = (uint64_t)n * size * 1000 / (start ? start : 1);
+		row[*nrows].wr_ovh_ns = bench_ovh(wr_us, n, 4 + size, row[*nrows].clk_hz);
+		row[*nrows].rd_ovh_ns = bench_ovh(start, n,
+			((bench_rd_cmds[c] == ICE_PSRAM_FAST_READ) ? 5 : 4) + size, row[*nrows].clk_hz);
+		row[*nrows].errors = errors;
+		(*nrows)++;
+		
+		/* next row starts out at the same clock */
+		if(*nrows < maxrows)
+			row[*nrows] = row[*nrows-1];
+	}
+}
+
+/*
+ * register write and read rates, optionally checking writes read back
+ */
+static void bench_reg(const bench_args_t *a, uint32_t seed, bench_row_t *row)
+{
+	uint32_t n = a->total ? a->total : 1, i, data;
+	uint8_t reg = a->addr & 0x7f;
+	int64_t start, wr_us, rd_us;
+	
+	start = esp_timer_get_time();
+	for(i = 0; i < n; i++)
+		ICE_FPGA_Serial_Write(reg, seed ^ i);
+	wr_us = esp_timer_get_time() - start;
+	
+	vTaskDelay(1);
+	
+	start = esp_timer_get_time();
+	for(i = 0; i < n; i++)
+		ICE_FPGA_Serial_Read(reg, &data);
+	rd_us = esp_timer_get_time() - start;
+	
+	row->errors = 0;
+	if(a->flags & BENCH_FLAG_VERIFY)
+	{
+		vTaskDelay(1);
+		for(i = 0; i < n; i++)
+		{
+			ICE_FPGA_Serial_Write(reg, seed ^ ~i);
+			ICE_FPGA_Serial_Read(reg, &data);
+			if(data != (seed ^ ~i))
+				row->errors++;
+		}
+	}
+	
+	/* written around the shadow to time the bus alone */
+	regmap_drop(reg);
+	
+	row->rd_cmd = 0;
+	row->size = 4;
+	row->count = n;
+	row->wr_rate = (uint64_t)n * 1000000 / (wr_us ? wr_us : 1);
+	row->rd_rate = (uint64_t)n * 1000000 / (rd_us ? rd_us : 1);
+	row->wr_ovh_ns = bench_ovh(wr_us, n, 5, row->clk_hz);
+	row->rd_ovh_ns = bench_ovh(rd_us, n, 5, row->clk_hz);
+}
+
+/*
+ * run a benchmark - args are a bench_args_t then clocks. Fills buf with a
+ * row count and bench_row_t table, returns its size or -1 if it couldn't
+ * run. The bus is shared so other SPI users just see a slow device.
+ */
+int bench_run(const uint32_t *args, int nargs, uint8_t *buf, int max)
+{
+	bench_args_t a;
+	bench_row_t *row = (bench_row_t *)(buf + 4);
+	uint32_t clk[BENCH_MAX_CLKS], nclk, i, sz, seed;
+	uint32_t orig_hz = ICE_SPI_GetClock();
+	uint8_t orig_cmd = ICE_PSRAM_GetReadCmd();
+	uint32_t *wbuf = NULL, *rbuf = NULL, extent;
+	int nrows = 0, maxrows = (max - 4) / sizeof(bench_row_t), start;
+	
+	if(nargs < sizeof(bench_args_t) / 4)
+		return -1;
+	memcpy(&a, args, sizeof(bench_args_t));
+	nclk = nargs - sizeof(bench_args_t) / 4;
+	if(nclk > BENCH_MAX_CLKS)
+		nclk = BENCH_MAX_CLKS;
+	memcpy(clk, args + sizeof(bench_args_t) / 4, nclk * 4);
+	if(!nclk)
+		clk[nclk++] = orig_hz;
+	
+	if(a.test == BENCH_PSRAM)
+	{
+		/* whole words up to a slab */
+		a.sizes &= (2*BENCH_MAX_XFER - 1) & ~3;
+		if(a.total > BENCH_MAX_TOTAL)
+			a.total = BENCH_MAX_TOTAL;
+		if(!(a.flags & 3))
+			a.flags |= 1 << (orig_cmd == ICE_PSRAM_FAST_READ);
+		if(!a.sizes)
+			return -1;
+		
+		/* the most any size touches - total, or one of the largest */
+		extent = 1 << (31 - __builtin_clz(a.sizes));
+		if(a.total > extent)
+			extent = a.total;
+		if((a.addr > ICE_PSRAM_SZ) || (extent > ICE_PSRAM_SZ - a.addr))
+		{
+			ESP_LOGW(TAG, "PSRAM 0x%08X + 0x%08X out of range", a.addr, extent);
+			return -1;
+		}
+		
+		wbuf = pool_alloc(BENCH_MAX_XFER);
+		rbuf = pool_alloc(BENCH_MAX_XFER);
+		if(!wbuf || !rbuf)
+		{
+			ESP_LOGW(TAG, "Couldn't alloc buffers");
+			pool_free(wbuf);
+			pool_free(rbuf);
+			return -1;
+		}
+	}
+	else if(a.test == BENCH_REG)
+	{
+		if(a.total > BENCH_MAX_ITERS)
+			a.total = BENCH_MAX_ITERS;
+	}
+	else
+		return -1;
+	
+	seed = esp_timer_get_time();
+	for(i = 0; (i < nclk) && (nrows < maxrows); i++)
+	{
+		memset(&row[nrows], 0, sizeof(bench_row_t));
+		row[nrows].req_hz = clk[i];
+		if(!(row[nrows].clk_hz = ICE_SPI_SetClock(clk[i])))
+		{
+			ESP_LOGW(TAG, "SPI clock %d not supported", clk[i]);
+			nrows++;
+			continue;
+		}
+		
+		start = nrows;
+		if(a.test == BENCH_REG)
+		{
+			bench_reg(&a, seed++, &row[nrows++]);
+			vTaskDelay(1);
+		}
+		else
+		{
+			for(sz = 4; (sz <= BENCH_MAX_XFER) && (nrows < maxrows); sz <<= 1)
+			{
+				if(!(a.sizes & sz))
+					continue;
+				bench_psram(&a, sz, seed++, wbuf, rbuf, row, &nrows, maxrows);
+				
+				/* let the idle task in so the watchdog stays quiet */
+				vTaskDelay(1);
+			}
+		}
+		ESP_LOGI(TAG, "%d Hz: %d points", row[start].clk_hz, nrows - start);
+	}
+	
+	ICE_SPI_SetClock(orig_hz);
+	ICE_PSRAM_SetReadCmd(orig_cmd);
+	pool_free(wbuf);
+	pool_free(rbuf);
+	
+	memcpy(buf, &nrows, 4);
+	return 4 + nrows * sizeof(bench_row_t);
+}
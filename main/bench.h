@@ -0,0 +1,52 @@
+/*
+ * bench.h - on-device SPI, PSRAM and register benchmarks
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __BENCH__
+#define __BENCH__
+
+#include "main.h"
+#include "pool.h"
+
+#define BENCH_PSRAM			0
+#define BENCH_REG			1
+
+#define BENCH_MAX_CLKS		8
+#define BENCH_MAX_XFER		POOL_MED_SZ		// largest PSRAM transaction
+#define BENCH_MAX_TOTAL		(1024*1024)		// PSRAM bytes per point
+#define BENCH_MAX_ITERS		10000			// register accesses per point
+
+/* bits of bench_args_t.flags */
+#define BENCH_FLAG_VERIFY	1	// register test reads back what it wrote
+
+/* request - clocks that follow are in Hz, none means the current one */
+typedef struct
+{
+	uint32_t test;		// BENCH_PSRAM or BENCH_REG
+	uint32_t addr;		// PSRAM start address or register
+	uint32_t total;		// PSRAM bytes or register accesses per point
+	uint32_t sizes;		// PSRAM: bit n set tests 2^n byte transactions
+	uint32_t flags;		// PSRAM: bit 0 tests slow read, bit 1 fast read
+						// register: BENCH_FLAG_VERIFY
+} bench_args_t;
+
+/* one point of the result table */
+typedef struct
+{
+	uint32_t req_hz;	// clock asked for
+	uint32_t clk_hz;	// clock the SPI driver gave, 0 if it refused
+	uint32_t rd_cmd;	// PSRAM read opcode, 0 for registers
+	uint32_t size;		// bytes per transaction
+	uint32_t count;		// transactions each way
+	uint32_t wr_rate;	// kB/s for PSRAM, accesses/s for registers
+	uint32_t rd_rate;
+	uint32_t wr_ovh_ns;	// per transaction time beyond the bits on the wire
+	uint32_t rd_ovh_ns;
+	uint32_t errors;	// words that didn't read back as written
+} bench_row_t;
+
+int bench_run(const uint32_t *args, int nargs, uint8_t *buf, int max);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * bitstream.c - walks the iCE40 bitstream command stream (preamble, bank
+ * and geometry commands, CRAM/BRAM data, CRC checks, wakeup) so a bad
+ * image is turned away before CRESET drops and the running design is
+ * lost. Works on pieces as they arrive, so a save can be checked without
+ * holding the whole file.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "bitstream.h"
+#include "trace.h"
+#include "rom/crc.h"
+
+static const char *TAG = "bitstream";
+
+/* parser states */
+#define BS_LEAD		0	// looking for the preamble
+#define BS_CMD		1
+#define BS_PAYLOAD	2
+#define BS_DATA		3	// bank data
+#define BS_PAD		4	// zeros after bank data
+#define BS_DONE		5	// after wakeup
+
+static const char *bitstream_names[] = {
+	"ok", "no preamble", "bad command", "CRC", "not a UP5K", "bad bank data",
+	"truncated", "trailing data"
+};
+
+/*
+ * CRC-16 CCITT, all ones preset - the ROM routine inverts in and out
+ */
+static uint16_t bitstream_crc(uint16_t crc, const uint8_t *data, uint32_t len)
+{
+	return ~crc16_be((uint16_t)~crc, data, len);
+}
+
+/*
+ * act on a complete command
+ */
+static void bitstream_cmd(bitstream_t *bs)
+{
+	uint32_t p = bs->shift, sz;
+	
+	bs->state = BS_CMD;
+	switch(bs->cmd >> 4)
+	{
+		case 0:
+			if((p == 1) || (p == 3))
+			{
+				/* CRAM or BRAM bank write with the current geometry */
+				sz = bs->width * bs->height;
+				if(!sz || (sz & 7) || (sz / 8 > BITSTREAM_BANK_MAX) ||
+					((p == 1) && (bs->width != BITSTREAM_CRAM_W)))
+				{
+					bs->result = BITSTREAM_DEVICE;
+					break;
+				}
+				if(p == 1)
+				{
+					bs->cram |= 1 << bs->bank;
+					bs->cram_sz += sz / 8;
+				}
+				else
+					bs->bram_sz += sz / 8;
+				bs->count = sz / 8;
+				bs->state = BS_DATA;
+				bs->unchecked = 1;
+			}
+			else if(p == 5)
+				bs->crc = 0xFFFF;
+			else if(p == 6)
+			{
+				/* wakeup - everything should be there and checked */
+				if(bs->cram != 0xF)
+					bs->result = BITSTREAM_TRUNCATED;
+				else if((bs->cram_sz != BITSTREAM_CRAM_SZ) || (bs->bram_sz > BITSTREAM_BRAM_SZ))
+					bs->result = BITSTREAM_DEVICE;
+				else if(bs->unchecked)
+					bs->result = BITSTREAM_CRC;
+				bs->state = BS_DONE;
+				bs->count = 0;
+			}
+			else
+				bs->result = BITSTREAM_BAD_CMD;
+			break;
+	
+		case 1:
+			if(p > 3)
+				bs->result = BITSTREAM_DEVICE;
+			bs->bank = p;
+			break;
+	
+		case 2:
+			/* the CRC bytes are included so a match leaves zero */
+			if(bs->crc)
+				bs->result = BITSTREAM_CRC;
+			bs->unchecked = 0;
+			break;
+	
+		case 5:		// oscillator range
+		case 8:		// bank offset
+		case 9:		// wakeup options
+			break;
+	
+		case 6:
+			bs->width = p + 1;
+			break;
+	
+		case 7:
+			bs->height = p;
+			break;
+	
+		default:
+			bs->result = BITSTREAM_BAD_CMD;
+			break;
+	}
+}
+
+/*
+ * start checking a bitstream
+ */
+void bitstream_begin(bitstream_t *bs)
+{
+	memset(bs, 0, sizeof(bitstream_t));
+	bs->state = BS_LEAD;
+	bs->crc = 0xFFFF;
+}
+
+/*
+ * check the next piece - returns BITSTREAM_OK while it's good so far
+ */
+uint32_t bitstream_feed(bitstream_t *bs, const uint8_t *data, uint32_t len)
+{
+	uint32_t n;
+	uint8_t b;
+	
+	while(len && !bs->result)
+	{
+		/* bank data is only counted and CRCed */
+		if(bs->state == BS_DATA)
+		{
+			n = (len < bs->count) ? len : bs->count;
+			bs->crc = bitstream_crc(bs->crc, data, n);
+			bs->count -= n;
+			bs->offset += n;
+			data += n;
+			len -= n;
+			if(!bs->count)
+			{
+				bs->state = BS_PAD;
+				bs->count = 2;
+			}
+			continue;
+		}
+	
+		b = *data++;
+		len--;
+		bs->offset++;
+		if((bs->state != BS_LEAD) && (bs->state != BS_DONE))
+			bs->crc = bitstream_crc(bs->crc, &b, 1);
+	
+		switch(bs->state)
+		{
+			case BS_LEAD:
+				/* anything before it is a comment */
+				bs->shift = (bs->shift << 8) | b;
+				if(bs->shift == BITSTREAM_PREAMBLE)
+					bs->state = BS_CMD;
+				else if(bs->offset >= BITSTREAM_LEAD_MAX + 4)
+					bs->result = BITSTREAM_NO_PREAMBLE;
+				break;
+	
+			case BS_CMD:
+				/* opcode in the high nibble, payload bytes in the low */
+				bs->cmd = b;
+				bs->count = b & 0xF;
+				bs->shift = 0;
+				if(bs->count > 4)
+					bs->result = BITSTREAM_BAD_CMD;
+				else if(!bs->count)
+					bitstream_cmd(bs);
+				else
+					bs->state = BS_PAYLOAD;
+				break;
+	
+			case BS_PAYLOAD:
+				bs->shift = (bs->shift << 8) | b;
+				if(!--bs->count)
+					bitstream_cmd(bs);
+				break;
+	
+			case BS_PAD:
+				if(b)
+					bs->result = BITSTREAM_FORMAT;
+				else if(!--bs->count)
+					bs->state = BS_CMD;
+				break;
+	
+			case BS_DONE:
+				if(++bs->count > BITSTREAM_TAIL_MAX)
+					bs->result = BITSTREAM_TRAILING;
+				break;
+		}
+	}
+	
+	return bs->result;
+}
+
+/*
+ * finish checking - returns BITSTREAM_OK if the whole thing was good
+ */
+uint32_t bitstream_end(bitstream_t *bs)
+{
+	if(!bs->result && (bs->state != BS_DONE))
+		bs->result = (bs->state == BS_LEAD) ? BITSTREAM_NO_PREAMBLE : BITSTREAM_TRUNCATED;
+	
+	if(bs->result)
+	{
+		ESP_LOGW(TAG, "Rejected: %s at byte %d", bitstream_names[bs->result], bs->offset);
+		TRACE(BITSTREAM, bs->result, bs->offset);
+	}
+	
+	return bs->result;
+}
+
+/*
+ * check a whole bitstream in memory
+ */
+uint32_t bitstream_check(const uint8_t *data, uint32_t len)
+{
+	bitstream_t bs;
+	
+	bitstream_begin(&bs);
+	bitstream_feed(&bs, data, len);
+	return bitstream_end(&bs);
+}
@@ -0,0 +1,54 @@
+/*
+ * bitstream.h - iCE40 UP5K bitstream checks
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __BITSTREAM__
+#define __BITSTREAM__
+
+#include "main.h"
+
+#define BITSTREAM_PREAMBLE	0x7EAA997E
+#define BITSTREAM_LEAD_MAX	1024		// comment allowed before the preamble
+#define BITSTREAM_TAIL_MAX	16			// padding allowed after wakeup
+#define BITSTREAM_CRAM_W	692			// UP5K CRAM bank width in bits
+#define BITSTREAM_BANK_MAX	(692*336/8)	// largest bank write
+#define BITSTREAM_CRAM_SZ	88576		// UP5K CRAM, all four banks
+#define BITSTREAM_BRAM_SZ	15360		// UP5K BRAM, all four banks
+
+/* results - the err byte gets 0x10 for any of these */
+#define BITSTREAM_OK			0
+#define BITSTREAM_NO_PREAMBLE	1
+#define BITSTREAM_BAD_CMD		2	// unknown or oversized command
+#define BITSTREAM_CRC			3	// CRC check failed or data left unchecked
+#define BITSTREAM_DEVICE		4	// bank geometry isn't a UP5K's
+#define BITSTREAM_FORMAT		5	// bank data not followed by zeros
+#define BITSTREAM_TRUNCATED		6	// ended before wakeup
+#define BITSTREAM_TRAILING		7	// too much after wakeup
+
+/* parser state - fed in any size pieces */
+typedef struct
+{
+	uint32_t state;
+	uint32_t result;
+	uint32_t offset;		// bytes fed so far
+	uint32_t shift;			// preamble or command payload
+	uint32_t count;			// bytes left in this state
+	uint32_t cram_sz;		// CRAM and BRAM bytes seen
+	uint32_t bram_sz;
+	uint16_t crc;
+	uint16_t width;
+	uint16_t height;
+	uint8_t bank;
+	uint8_t cmd;
+	uint8_t cram;			// CRAM banks written, one bit each
+	uint8_t unchecked;		// data since the last CRC check
+} bitstream_t;
+
+void bitstream_begin(bitstream_t *bs);
+uint32_t bitstream_feed(bitstream_t *bs, const uint8_t *data, uint32_t len);
+uint32_t bitstream_end(bitstream_t *bs);
+uint32_t bitstream_check(const uint8_t *data, uint32_t len);
+
+#endif
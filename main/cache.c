@@ -0,0 +1,338 @@
+/*
+ * cache.c - RAM cache of recently used bitstreams keyed by CRC32 so
+ * switching between a few designs needs no network or flash I/O. UP5k
+ * bitstreams are mostly zeros so entries are packed with a zero-run
+ * code when that makes them smaller.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "cache.h"
+#include "ice.h"
+#include "pool.h"
+#include "spiffs.h"
+#include "rom/crc.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+
+/*
+ * Packed format is a series of tokens:
+ *  0x00-0x7F       : (h+1) literal bytes follow
+ *  0x80-0xFF, lo   : (((h&0x7F)<<8)|lo)+1 zero bytes
+ */
+#define CACHE_LIT_MAX		128
+#define CACHE_ZRUN_MAX		32768
+#define CACHE_ZRUN_MIN		3		// shorter zero runs go in literals
+
+typedef struct
+{
+	uint32_t crc;			// CRC32 of the unpacked bitstream
+	uint32_t size;			// unpacked size
+	uint32_t len;			// size in the arena
+	uint32_t offset;		// location in the arena
+	uint32_t packed;		// 0 if stored raw
+	uint32_t used;			// LRU stamp
+} cache_entry_t;
+
+static const char* TAG = "cache";
+static SemaphoreHandle_t cache_mutex;
+static uint8_t *cache_arena;
+static cache_entry_t cache_ent[CACHE_MAX_ENTRIES];	// in arena order
+static uint32_t cache_stamp;
+static uint32_t cache_flash_crc;
+static int cache_flash_known;
+static cache_stats_t cache_st = {.arena = CACHE_ARENA_SZ};
+
+/*
+ * pack src into dst, or just size it if dst is NULL - returns packed size
+ */
+static uint32_t cache_pack(uint8_t *src, uint32_t size, uint8_t *dst)
+{
+	uint32_t i = 0, o = 0, run, lit;
+	
+	while(i < size)
+	{
+		/* zero run */
+		run = 0;
+		while((i+run < size) && !src[i+run] && (run < CACHE_ZRUN_MAX))
+			run++;
+		if(run >= CACHE_ZRUN_MIN)
+		{
+			if(dst)
+			{
+				dst[o] = 0x80 | ((run-1) >> 8);
+				dst[o+1] = (run-1) & 0xff;
+			}
+			o += 2;
+			i += run;
+			continue;
+		}
+	
+		/* literals up to the next zero run worth coding */
+		lit = 0;
+		while((i+lit < size) && (lit < CACHE_LIT_MAX))
+		{
+			if((i+lit+2 < size) && !src[i+lit] && !src[i+lit+1] && !src[i+lit+2])
+				break;
+			lit++;
+		}
+		if(dst)
+		{
+			dst[o] = lit-1;
+			memcpy(&dst[o+1], &src[i], lit);
+		}
+		o += 1+lit;
+		i += lit;
+	}
+	
+	return o;
+}
+
+/*
+ * unpack an entry through buf into the FPGA
+ */
+static void cache_unpack_config(uint8_t *src, uint32_t len, uint8_t *buf, uint32_t bufsz)
+{
+	uint32_t i = 0, fill = 0, n, chunk;
+	int zero;
+	
+	while(i < len)
+	{
+		zero = src[i] & 0x80;
+		if(zero)
+		{
+			n = (((src[i] & 0x7f) << 8) | src[i+1]) + 1;
+			i += 2;
+		}
+		else
+			n = src[i++] + 1;
+	
+		while(n)
+		{
+			chunk = (bufsz-fill < n) ? bufsz-fill : n;
+			if(zero)
+				memset(&buf[fill], 0, chunk);
+			else
+			{
+				memcpy(&buf[fill], &src[i], chunk);
+				i += chunk;
+			}
+			fill += chunk;
+			n -= chunk;
+	
+			if(fill == bufsz)
+			{
+				ICE_FPGA_Config_Write(buf, fill);
+				fill = 0;
+			}
+		}
+	}
+	
+	if(fill)
+		ICE_FPGA_Config_Write(buf, fill);
+}
+
+/*
+ * find an entry by CRC, -1 if not resident
+ */
+static int cache_find(uint32_t crc)
+{
+	int i;
+	
+	for(i=0;i<cache_st.entries;i++)
+		if(cache_ent[i].crc == crc)
+			return i;
+	
+	return -1;
+}
+
+/*
+ * drop the least recently used entry and close up the arena
+ */
+static void cache_evict(void)
+{
+	uint32_t len, end;
+	int i, lru = 0;
+	
+	for(i=1;i<cache_st.entries;i++)
+		if(cache_ent[i].used < cache_ent[lru].used)
+			lru = i;
+	
+	ESP_LOGI(TAG, "Evict 0x%08X", cache_ent[lru].crc);
+	cache_st.raw_bytes -= cache_ent[lru].size;
+	len = cache_ent[lru].len;
+	end = cache_ent[lru].offset + len;
+	memmove(&cache_arena[cache_ent[lru].offset], &cache_arena[end], cache_st.used - end);
+	for(i=lru+1;i<cache_st.entries;i++)
+	{
+		cache_ent[i].offset -= len;
+		cache_ent[i-1] = cache_ent[i];
+	}
+	
+	cache_st.entries--;
+	cache_st.used -= len;
+	cache_st.evictions++;
+}
+
+/*
+ * reserve the arena - the cache is just bypassed if it can't be had
+ */
+esp_err_t cache_init(void)
+{
+	cache_mutex = xSemaphoreCreateMutex();
+	cache_arena = heap_caps_malloc(CACHE_ARENA_SZ, MALLOC_CAP_DMA);
+	if(!cache_arena)
+	{
+		ESP_LOGE(TAG, "Failed to reserve %d", CACHE_ARENA_SZ);
+		cache_st.arena = 0;
+		return ESP_ERR_NO_MEM;
+	}
+	
+	ESP_LOGI(TAG, "Reserved %d", CACHE_ARENA_SZ);
+	return ESP_OK;
+}
+
+/*
+ * add a bitstream that just configured OK - returns its CRC32
+ */
+uint32_t cache_put(uint8_t *data, uint32_t size)
+{
+	uint32_t crc = crc32_le(0, data, size), len;
+	cache_entry_t *ent;
+	int i;
+	
+	if(!cache_arena)
+		return crc;
+	
+	xSemaphoreTake(cache_mutex, portMAX_DELAY);
+	
+	/* already here so just make it most recent */
+	if((i = cache_find(crc)) >= 0)
+	{
+		cache_ent[i].used = ++cache_stamp;
+		xSemaphoreGive(cache_mutex);
+		return crc;
+	}
+	
+	/* packed if that helps */
+	len = cache_pack(data, size, NULL);
+	if(len > size)
+		len = size;
+	if(len > CACHE_ARENA_SZ)
+	{
+		ESP_LOGW(TAG, "0x%08X too big - %d packed", crc, len);
+		cache_st.too_big++;
+		xSemaphoreGive(cache_mutex);
+		return crc;
+	}
+	
+	/* make room */
+	while((cache_st.entries == CACHE_MAX_ENTRIES) || (CACHE_ARENA_SZ - cache_st.used < len))
+		cache_evict();
+	
+	ent = &cache_ent[cache_st.entries++];
+	ent->crc = crc;
+	ent->size = size;
+	ent->len = len;
+	ent->offset = cache_st.used;
+	ent->packed = len < size;
+	ent->used = ++cache_stamp;
+	if(ent->packed)
+		cache_pack(data, size, &cache_arena[ent->offset]);
+	else
+		memcpy(&cache_arena[ent->offset], data, size);
+	
+	cache_st.used += len;
+	cache_st.raw_bytes += size;
+	cache_st.inserts++;
+	ESP_LOGI(TAG, "Added 0x%08X - %d -> %d", crc, size, len);
+	
+	xSemaphoreGive(cache_mutex);
+	return crc;
+}
+
+/*
+ * configure the FPGA with the bitstream matching crc from RAM, or from the
+ * flash file if that's the one. Returns the CACHE_SRC_* it came from and
+ * the ICE_FPGA_Config() status in cfg_stat.
+ */
+int cache_config(uint32_t crc, uint8_t *cfg_stat)
+{
+	int64_t start = esp_timer_get_time();
+	int i, src = CACHE_SRC_MISS;
+	uint8_t *bin = NULL, *buf;
+	uint32_t sz;
+	
+	*cfg_stat = 0;
+	xSemaphoreTake(cache_mutex, portMAX_DELAY);
+	
+	if((i = cache_find(crc)) >= 0)
+	{
+		cache_entry_t *ent = &cache_ent[i];
+	
+		/* packed entries are expanded a slab at a time */
+		buf = ent->packed ? pool_alloc(POOL_MED_SZ) : NULL;
+		if(!ent->packed || buf)
+		{
+			ICE_FPGA_Config_Begin();
+			if(ent->packed)
+				cache_unpack_config(&cache_arena[ent->offset], ent->len, buf, POOL_MED_SZ);
+			else
+				ICE_FPGA_Config_Write(&cache_arena[ent->offset], ent->size);
+			*cfg_stat = ICE_FPGA_Config_End();
+			pool_free(buf);
+	
+			ent->used = ++cache_stamp;
+			cache_st.hits++;
+			src = CACHE_SRC_RAM;
+		}
+		else
+			ESP_LOGW(TAG, "Couldn't alloc unpack buffer");
+	}
+	xSemaphoreGive(cache_mutex);
+	
+	/* try flash unless it's already known not to match */
+	if((src == CACHE_SRC_MISS) && (!cache_flash_known || (cache_flash_crc == crc)) &&
+		!spiffs_read((char *)cfg_file, &bin, &sz))
+	{
+		cache_flash_crc = crc32_le(0, bin, sz);
+		cache_flash_known = 1;
+		if(cache_flash_crc == crc)
+		{
+			if(!(*cfg_stat = ICE_FPGA_Config(bin, sz)))
+				cache_put(bin, sz);
+			cache_st.flash_hits++;
+			src = CACHE_SRC_FLASH;
+		}
+		pool_free(bin);
+	}
+	
+	if(src == CACHE_SRC_MISS)
+		cache_st.misses++;
+	cache_st.config_us = esp_timer_get_time() - start;
+	ESP_LOGI(TAG, "Config 0x%08X - src %d, status %d, %d us", crc, src, *cfg_stat, cache_st.config_us);
+	
+	return src;
+}
+
+/*
+ * the flash file was rewritten so its CRC has to be found again
+ */
+void cache_flash_changed(void)
+{
+	cache_flash_known = 0;
+}
+
+/*
+ * Report cache statistics - returns length of report
+ */
+int cache_stats(uint8_t *buf, int max)
+{
+	if(max < sizeof(cache_stats_t))
+		return 0;
+	
+	memcpy(buf, &cache_st, sizeof(cache_stats_t));
+	return sizeof(cache_stats_t);
+}
@@ -0,0 +1,43 @@
+/*
+ * cache.h - RAM cache of recently used bitstreams
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __CACHE__
+#define __CACHE__
+
+#include "main.h"
+
+/* one arena holds every entry, packed or raw */
+#define CACHE_ARENA_SZ		(64*1024)
+#define CACHE_MAX_ENTRIES	8
+
+/* where cache_config() found the bitstream */
+#define CACHE_SRC_RAM		0
+#define CACHE_SRC_FLASH		1
+#define CACHE_SRC_MISS		2
+
+/* cache statistics as reported by cache_stats() */
+typedef struct
+{
+	uint32_t arena;			// arena size
+	uint32_t used;			// bytes in use
+	uint32_t entries;		// bitstreams resident
+	uint32_t raw_bytes;		// unpacked size of resident bitstreams
+	uint32_t hits;			// configured from RAM
+	uint32_t flash_hits;	// configured from the flash file
+	uint32_t misses;		// not found anywhere
+	uint32_t inserts;		// bitstreams added
+	uint32_t evictions;		// bitstreams dropped for space
+	uint32_t too_big;		// bitstreams that couldn't fit the arena
+	uint32_t config_us;		// time of last configure by CRC
+} cache_stats_t;
+
+esp_err_t cache_init(void);
+uint32_t cache_put(uint8_t *data, uint32_t size);
+int cache_config(uint32_t crc, uint8_t *cfg_stat);
+void cache_flash_changed(void);
+int cache_stats(uint8_t *buf, int max);
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * event.c - FPGA interrupt events pushed to subscribed socket clients
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "event.h"
+#include "ice.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+
+/*
+ * FPGA -> ESP interrupt input. GPIO2 is the only pin between the C3 and
+ * the FPGA that isn't already claimed. CDONE can't be used since it isn't
+ * driven by user logic on the UP5k.
+ */
+#define EVENT_IRQ_PIN			2
+#define EVENT_MAX_SUBS			4
+#define EVENT_DEFAULT_REG		0
+#define EVENT_SEND_TIMEOUT_MS	100
+#define EVENT_POLL_MS			1000	// check for departed subscribers
+
+static const char* TAG = "event";
+static TaskHandle_t event_task_handle;
+static SemaphoreHandle_t event_mutex;
+static int event_socks[EVENT_MAX_SUBS];
+static uint8_t event_active[EVENT_MAX_SUBS];
+static uint8_t event_regs[EVENT_MAX_SUBS];
+static volatile int64_t event_irq_time;
+
+/*
+ * IRQ edge - timestamp and kick the task, SPI can't be used from here
+ */
+static void IRAM_ATTR event_isr(void *arg)
+{
+	BaseType_t woken = pdFALSE;
+	
+	event_irq_time = esp_timer_get_time();
+	vTaskNotifyGiveFromISR(event_task_handle, &woken);
+	if(woken)
+		portYIELD_FROM_ISR();
+}
+
+/*
+ * close a subscriber and free its slot. Call locked.
+ */
+static void event_drop(int i)
+{
+	ESP_LOGI(TAG, "Dropping subscriber %d: errno %d", i, errno);
+	shutdown(event_socks[i], 0);
+	close(event_socks[i]);
+	event_socks[i] = -1;
+	event_active[i] = 0;
+}
+
+/*
+ * send a whole frame - returns 0 if OK, -1 if the client is gone or stuck
+ */
+static int event_send(int sock, const event_frame_t *frame)
+{
+	const uint8_t *p = (const uint8_t *)frame;
+	int left = sizeof(event_frame_t), sent;
+	
+	while(left > 0)
+	{
+		/* send timeout is set at subscribe */
+		if((sent = send(sock, p, left, 0)) <= 0)
+			return -1;
+		p += sent;
+		left -= sent;
+	}
+	
+	return 0;
+}
+
+/*
+ * check whether a subscriber hung up - anything it sends is discarded
+ */
+static int event_closed(int sock)
+{
+	uint8_t dump[16];
+	int len;
+	
+	while((len = recv(sock, dump, sizeof(dump), MSG_DONTWAIT)) > 0)
+		;
+	
+	return !len || ((errno != EAGAIN) && (errno != EWOULDBLOCK));
+}
+
+/*
+ * read the subscribed status registers and push a frame to each
+ * subscriber. Between IRQs, look for subscribers that went away.
+ */
+static void event_task(void *pvParameters)
+{
+	event_frame_t frame;
+	uint32_t seq = 0, status[EVENT_MAX_SUBS];
+	uint8_t regs[EVENT_MAX_SUBS];
+	int i, j, nregs;
+	
+	frame.magic = EVENT_MAGIC;
+	while(1)
+	{
+		if(!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(EVENT_POLL_MS)))
+		{
+			xSemaphoreTake(event_mutex, portMAX_DELAY);
+			for(i=0;i<EVENT_MAX_SUBS;i++)
+				if(event_active[i] && event_closed(event_socks[i]))
+					event_drop(i);
+			xSemaphoreGive(event_mutex);
+			continue;
+		}
+		
+		/* each register once, the default if nobody's listening */
+		xSemaphoreTake(event_mutex, portMAX_DELAY);
+		for(i=0, nregs=0;i<EVENT_MAX_SUBS;i++)
+		{
+			if(!event_active[i])
+				continue;
+			for(j=0;(j<nregs) && (regs[j] != event_regs[i]);j++)
+				;
+			if(j == nregs)
+				regs[nregs++] = event_regs[i];
+		}
+		xSemaphoreGive(event_mutex);
+		if(!nregs)
+			regs[nregs++] = EVENT_DEFAULT_REG;
+		
+		/* always read status so the gateware sees the IRQ acknowledged */
+		for(j=0;j<nregs;j++)
+			ICE_FPGA_Serial_Read(regs[j], &status[j]);
+		frame.seq = seq++;
+		frame.time = event_irq_time;
+		
+		xSemaphoreTake(event_mutex, portMAX_DELAY);
+		for(i=0;i<EVENT_MAX_SUBS;i++)
+		{
+			if(!event_active[i])
+				continue;
+			
+			/* a subscriber enabled since the reads waits for the next one */
+			for(j=0;(j<nregs) && (regs[j] != event_regs[i]);j++)
+				;
+			if(j == nregs)
+				continue;
+			frame.reg = regs[j];
+			frame.status = status[j];
+			
+			/* client gone or stuck - drop it */
+			if(event_send(event_socks[i], &frame))
+				event_drop(i);
+		}
+		xSemaphoreGive(event_mutex);
+	}
+}
+
+/*
+ * set up the IRQ pin and event task
+ */
+esp_err_t event_init(void)
+{
+	esp_err_t ret;
+	int i;
+	
+	for(i=0;i<EVENT_MAX_SUBS;i++)
+	{
+		event_socks[i] = -1;
+		event_active[i] = 0;
+	}
+	event_mutex = xSemaphoreCreateMutex();
+	
+	/* higher priority than socket so events aren't stuck behind commands */
+	xTaskCreate(event_task, "event", 3072, NULL, 6, &event_task_handle);
+	
+	gpio_reset_pin(EVENT_IRQ_PIN);
+	gpio_set_direction(EVENT_IRQ_PIN, GPIO_MODE_INPUT);
+	gpio_set_pull_mode(EVENT_IRQ_PIN, GPIO_PULLDOWN_ONLY);
+	gpio_set_intr_type(EVENT_IRQ_PIN, GPIO_INTR_POSEDGE);
+	
+	/* service may already be installed by someone else */
+	ret = gpio_install_isr_service(0);
+	if((ret != ESP_OK) && (ret != ESP_ERR_INVALID_STATE))
+	{
+		ESP_LOGE(TAG, "Failed to install ISR service (%s)", esp_err_to_name(ret));
+		return ret;
+	}
+	
+	ret = gpio_isr_handler_add(EVENT_IRQ_PIN, event_isr, NULL);
+	if(ret != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Failed to add ISR handler (%s)", esp_err_to_name(ret));
+		return ret;
+	}
+	
+	ESP_LOGI(TAG, "FPGA IRQ on GPIO%d", EVENT_IRQ_PIN);
+	return ESP_OK;
+}
+
+/*
+ * take ownership of a socket for event delivery. Returns the slot or -1
+ * if full. Frames aren't sent until event_enable() so the subscribe reply
+ * can go out first.
+ */
+int event_subscribe(int sock, uint8_t Reg)
+{
+	struct timeval tv = {
+		.tv_sec = 0,
+		.tv_usec = EVENT_SEND_TIMEOUT_MS * 1000,
+	};
+	int i, slot = -1;
+	
+	xSemaphoreTake(event_mutex, portMAX_DELAY);
+	for(i=0;i<EVENT_MAX_SUBS;i++)
+	{
+		if(event_socks[i] < 0)
+		{
+			/* don't let a slow client hold up the others */
+			setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+			event_socks[i] = sock;
+			event_regs[i] = Reg;
+			slot = i;
+			break;
+		}
+	}
+	xSemaphoreGive(event_mutex);
+	
+	if(slot < 0)
+		ESP_LOGW(TAG, "No free subscriber slots");
+	else
+		ESP_LOGI(TAG, "Subscriber %d, status reg %d", slot, Reg);
+	
+	return slot;
+}
+
+/*
+ * start sending frames to a subscriber
+ */
+void event_enable(int slot)
+{
+	xSemaphoreTake(event_mutex, portMAX_DELAY);
+	event_active[slot] = 1;
+	xSemaphoreGive(event_mutex);
+}
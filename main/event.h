@@ -0,0 +1,29 @@
+/*
+ * event.h - FPGA interrupt events pushed to subscribed socket clients
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __EVENT__
+#define __EVENT__
+
+#include "main.h"
+
+/* first word of each event frame - matches the subscribe cmd header */
+#define EVENT_MAGIC 0xCAFEBEE3
+
+/* frame pushed to every subscriber on each FPGA interrupt */
+typedef struct
+{
+	uint32_t magic;		// EVENT_MAGIC
+	uint32_t seq;		// event sequence number, wraps
+	int64_t time;		// esp_timer timestamp of the IRQ edge in us
+	uint32_t reg;		// status register that was read
+	uint32_t status;	// contents of the status register
+} event_frame_t;
+
+esp_err_t event_init(void);
+int event_subscribe(int sock, uint8_t Reg);
+void event_enable(int slot);
+
+#endif
@@ -5,12 +5,14 @@
 
 #include <string.h>
 #include "ice.h"
+#include "regmap.h"
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
 #include "rom/ets_sys.h"
-#include "soc/spi_periph.h"
-#include "esp_rom_gpio.h"
+#include "soc/soc.h"
 #include "hal/gpio_hal.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
 
 /**
   * @brief  SPI Interface pins
@@ -30,9 +32,54 @@
 #define ICE_CDONE_GET()		gpio_get_level(ICE_CDONE_PIN)
 #define ICE_SPI_DUMMY_BYTE	0xFF
 #define ICE_SPI_MAX_XFER	4096
+#define ICE_SPI_HZ			(10*1000*1000)
+#define ICE_WAIT_SPIN_US	100000
+#define ICE_ASYNC_MAX		(ICE_ASYNC_MAX_SZ/ICE_SPI_MAX_XFER)
+
+/*
+ * Configuration timing - iCE40 UltraPlus slave SPI config accepts SCK up to
+ * 25MHz and 80MHz APB only divides down to 20MHz below that. The rest are
+ * the datasheet minimums.
+ */
+#define ICE_CFG_SPI_HZ		(20*1000*1000)
+#define ICE_CFG_CDONE_LOW_US	100		// max wait for CDONE to drop in reset
+#define ICE_CFG_CLEAR_US	1200	// CRESET high to first clock for UP5k
+#define ICE_CFG_DONE_CLKS	104		// >=100 clocks after data before CDONE
+#define ICE_CFG_USER_CLKS	56		// >=49 clocks after CDONE to start user I/O
+#define ICE_CFG_DONE_TO_US	2000	// max wait for CDONE to rise
+
+/* serialize multi-transaction sequences from different tasks */
+#define ICE_LOCK()			xSemaphoreTake(ice_mutex, portMAX_DELAY)
+#define ICE_UNLOCK()		xSemaphoreGive(ice_mutex)
 
 static const char* TAG = "ice";
-static spi_device_handle_t spi;
+static spi_device_handle_t spi, spi_cfg;
+static uint32_t ice_spi_hz = ICE_SPI_HZ;
+static uint8_t ice_psram_rdcmd = ICE_PSRAM_SLOW_READ;
+static SemaphoreHandle_t ice_mutex;
+static spi_transaction_t ice_async_t[ICE_ASYNC_MAX];
+static int ice_async_cnt;
+
+/* configuration sequencer state */
+static SemaphoreHandle_t ice_clear_sem;
+static esp_timer_handle_t ice_clear_timer;
+static ice_cfg_stats_t ice_cfg_st;
+static int64_t ice_cfg_start, ice_cfg_data;
+static uint8_t ice_cfg_status;
+
+/* dummy clock source - in DRAM so the SPI DMA can use it directly */
+static uint8_t ice_cfg_dummy[(ICE_CFG_DONE_CLKS+7)/8] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+/*
+ * CRESET clear time is up
+ */
+static void ICE_Clear_Timer(void *arg)
+{
+	xSemaphoreGive(ice_clear_sem);
+}
 
 void ICE_Init(void)
 {
@@ -46,12 +93,26 @@ void ICE_Init(void)
         .max_transfer_sz = ICE_SPI_MAX_XFER,
     };
     spi_device_interface_config_t devcfg={
-        .clock_speed_hz=10*1000*1000,           //Clock out at 40 MHz
+        .clock_speed_hz=ICE_SPI_HZ,             //Clock out at 10 MHz
         .mode=0,                                //SPI mode 0
         .spics_io_num=-1,                       //CS pin not used
         .queue_size=7,                          //We want to be able to queue 7 transactions at a time
     };
+    spi_device_interface_config_t cfgcfg={
+        .clock_speed_hz=ICE_CFG_SPI_HZ,         //Configuration runs as fast as the FPGA allows
+        .mode=0,                                //SPI mode 0
+        .spics_io_num=-1,                       //CS pin not used
+        .queue_size=ICE_ASYNC_MAX,              //Bitstream chunks in flight
+    };
+    esp_timer_create_args_t clear_args = {
+        .callback = ICE_Clear_Timer,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ice_clear",
+    };
 
+    //Bus lock - CS is a GPIO so whole sequences must not interleave
+    ice_mutex = xSemaphoreCreateMutex();
+    
     //Initialize the SPI bus
     ESP_LOGI(TAG, "Initialize SPI");
 	gpio_reset_pin(ICE_SPI_MISO_PIN);
@@ -63,6 +124,13 @@ void ICE_Init(void)
     //Attach the SPI bus
     ret=spi_bus_add_device(ICE_SPI_HOST, &devcfg, &spi);
     ESP_ERROR_CHECK(ret);
+    ret=spi_bus_add_device(ICE_SPI_HOST, &cfgcfg, &spi_cfg);
+    ESP_ERROR_CHECK(ret);
+	ice_cfg_st.clk_hz = spi_get_actual_clock(APB_CLK_FREQ, ICE_CFG_SPI_HZ, 128);
+	
+	//CRESET wait blocks on a timer instead of spinning
+	ice_clear_sem = xSemaphoreCreateBinary();
+	ESP_ERROR_CHECK(esp_timer_create(&clear_args, &ice_clear_timer));
 
     //Initialize non-SPI GPIOs
 	/* pins 4-7 must be reset prior to use to get out of JTAG mode */
@@ -77,6 +145,70 @@ void ICE_Init(void)
 	gpio_set_direction(ICE_CDONE_PIN, GPIO_MODE_INPUT);
 }
 
+/*
+ * Change the user mode SPI clock. Returns the clock actually used, 0 if
+ * the driver wouldn't take it (the old clock is kept).
+ */
+uint32_t ICE_SPI_SetClock(uint32_t hz)
+{
+    spi_device_interface_config_t devcfg={
+        .clock_speed_hz=hz,
+        .mode=0,                                //SPI mode 0
+        .spics_io_num=-1,                       //CS pin not used
+        .queue_size=7,                          //We want to be able to queue 7 transactions at a time
+    };
+	uint32_t actual = 0;
+	
+	ICE_LOCK();
+	spi_bus_remove_device(spi);
+	if(spi_bus_add_device(ICE_SPI_HOST, &devcfg, &spi) == ESP_OK)
+	{
+		ice_spi_hz = hz;
+		actual = spi_get_actual_clock(APB_CLK_FREQ, hz, 128);
+	}
+	else
+	{
+		devcfg.clock_speed_hz = ice_spi_hz;
+		ESP_ERROR_CHECK(spi_bus_add_device(ICE_SPI_HOST, &devcfg, &spi));
+	}
+	ICE_UNLOCK();
+	
+	return actual;
+}
+
+/*
+ * Current user mode SPI clock as requested
+ */
+uint32_t ICE_SPI_GetClock(void)
+{
+	return ice_spi_hz;
+}
+
+/*
+ * Choose the PSRAM read opcode - ICE_PSRAM_SLOW_READ is limited to 33MHz,
+ * ICE_PSRAM_FAST_READ adds 8 wait clocks but runs at any SPI clock.
+ * Returns 1 if the opcode isn't supported.
+ */
+uint8_t ICE_PSRAM_SetReadCmd(uint8_t cmd)
+{
+	if((cmd != ICE_PSRAM_SLOW_READ) && (cmd != ICE_PSRAM_FAST_READ))
+		return 1;
+	
+	ICE_LOCK();
+	ice_psram_rdcmd = cmd;
+	ICE_UNLOCK();
+	
+	return 0;
+}
+
+/*
+ * Current PSRAM read opcode
+ */
+uint8_t ICE_PSRAM_GetReadCmd(void)
+{
+	return ice_psram_rdcmd;
+}
+
 void ICE_SPI_WriteByte(uint8_t dat8)
 {
     esp_err_t ret;
@@ -169,24 +301,103 @@ void ICE_SPI_ReadBlk(uint8_t *Data, uint32_t Count)
 }
 
 /*
- * Bitbang the SPI_SCK - used for new timing config
+ * Queue a DMA read of a block of bytes - Data must be DMA capable and
+ * Count no more than ICE_ASYNC_MAX*ICE_SPI_MAX_XFER
+ */
+static void ICE_SPI_ReadBlk_Start(uint8_t *Data, uint32_t Count)
+{
+    esp_err_t ret;
+	uint32_t bytes;
+	
+	ice_async_cnt = 0;
+	while(Count && (ice_async_cnt < ICE_ASYNC_MAX))
+	{
+		bytes = (Count > ICE_SPI_MAX_XFER) ? ICE_SPI_MAX_XFER : Count;
+		
+		spi_transaction_t *t = &ice_async_t[ice_async_cnt++];
+		memset(t, 0, sizeof(spi_transaction_t));
+		t->length=8*bytes;
+		t->rxlength = t->length;
+		t->rx_buffer = Data;
+		ret=spi_device_queue_trans(spi, t, portMAX_DELAY);
+		assert(ret==ESP_OK);
+		
+		Count -= bytes;
+		Data += bytes;
+	}
+}
+
+/*
+ * Wait for queued reads to finish
  */
-void ICE_SPI_ClkToggle(uint32_t cycles)
+static void ICE_SPI_ReadBlk_Wait(void)
 {
-	/* configure SCK pin for GPIO output */
-    esp_rom_gpio_pad_select_gpio(ICE_SPI_SCK_PIN);
-	gpio_set_direction(ICE_SPI_SCK_PIN, GPIO_MODE_OUTPUT);
+    esp_err_t ret;
+	spi_transaction_t *t;
+	
+	while(ice_async_cnt--)
+	{
+		ret=spi_device_get_trans_result(spi, &t, portMAX_DELAY);
+		assert(ret==ESP_OK);
+	}
+}
+
+/*
+ * Write a block of bytes on the config device with up to ICE_ASYNC_MAX
+ * transfers queued so the bus doesn't idle between chunks. Returns once
+ * it's all sent so the caller can reuse Data.
+ */
+static void ICE_SPI_CfgWriteBlk(uint8_t *Data, uint32_t Count)
+{
+    esp_err_t ret;
+	spi_transaction_t *t;
+	uint32_t bytes;
+	int idx = 0, cnt = 0;
+	
+	while(Count)
+	{
+		/* results come back in order so the oldest is the next slot */
+		if(cnt == ICE_ASYNC_MAX)
+		{
+			ret=spi_device_get_trans_result(spi_cfg, &t, portMAX_DELAY);
+			assert(ret==ESP_OK);
+			cnt--;
+		}
+		
+		bytes = (Count > ICE_SPI_MAX_XFER) ? ICE_SPI_MAX_XFER : Count;
+		
+		t = &ice_async_t[idx];
+		idx = (idx + 1) % ICE_ASYNC_MAX;
+		cnt++;
+		memset(t, 0, sizeof(spi_transaction_t));
+		t->length=8*bytes;
+		t->tx_buffer=Data;
+		ret=spi_device_queue_trans(spi_cfg, t, portMAX_DELAY);
+		assert(ret==ESP_OK);
+		
+		Count -= bytes;
+		Data += bytes;
+	}
 	
-	/* toggle for cycles */
-	while(cycles--)
+	while(cnt--)
 	{
-		gpio_set_level(ICE_SPI_SCK_PIN, 1);
-		gpio_set_level(ICE_SPI_SCK_PIN, 0);
+		ret=spi_device_get_trans_result(spi_cfg, &t, portMAX_DELAY);
+		assert(ret==ESP_OK);
 	}
+}
+
+/*
+ * Send dummy clocks with CS high in whole bytes
+ */
+static void ICE_SPI_CfgClocks(uint32_t cycles)
+{
+    esp_err_t ret;
+    spi_transaction_t t = {0};
 	
-	/* restore SCK pin to SPI control */
-    esp_rom_gpio_connect_out_signal(ICE_SPI_SCK_PIN, spi_periph_signal[ICE_SPI_HOST].spiclk_out, false, false);
-    esp_rom_gpio_connect_in_signal(ICE_SPI_SCK_PIN, spi_periph_signal[ICE_SPI_HOST].spiclk_in, false);
+	t.length = (cycles + 7) & ~7;
+	t.tx_buffer = ice_cfg_dummy;
+	ret=spi_device_polling_transmit(spi_cfg, &t);
+	assert(ret==ESP_OK);
 }
 
 /*
@@ -275,72 +486,152 @@ uint8_t ICE_FPGA_Config(uint8_t *bitmap, uint32_t size)
 	return 0;
 }
 #else
-/* New version is closer to Lattice timing */
-uint8_t ICE_FPGA_Config(uint8_t *bitmap, uint32_t size)
+/*
+ * Sequencer to Lattice timing - start with ICE_FPGA_Config_Begin(), send
+ * the bitstream in any number of ICE_FPGA_Config_Write() calls, then
+ * ICE_FPGA_Config_End() for the result. The bus is held throughout.
+ */
+void ICE_FPGA_Config_Begin(void)
 {
-	uint32_t timeout;
-
+	int64_t now;
+	
+	ICE_LOCK();
+	ice_cfg_start = esp_timer_get_time();
+	ice_cfg_status = 0;
+	ice_cfg_st.bytes = 0;
+	ice_cfg_st.clear_us = ice_cfg_st.data_us = 0;
+	ice_cfg_st.done_us = ice_cfg_st.done_clks = 0;
+	
+	/* whatever the registers held is gone with the old design */
+	regmap_invalidate();
+	
 	/* drop reset bit */
 	ICE_CRST_LOW();
 	
-	/* delay */
-	ets_delay_us(1);
-	
-	/* drop CS bit to signal slave mode */
+	/* drop CS bit to signal slave mode - reset held at least 200ns */
 	ICE_SPI_CS_LOW();
-	
-	/* delay at least 200ns */
 	ets_delay_us(1);
 	
 	/* Wait for done bit to go inactive */
-	timeout = 100;
-	while(timeout && (ICE_CDONE_GET()==1))
+	while(ICE_CDONE_GET()==1)
 	{
-		timeout--;
-	}
-	if(!timeout)
-	{
-		/* Done bit didn't respond to Reset */
-		return 1;
+		if(esp_timer_get_time() - ice_cfg_start > ICE_CFG_CDONE_LOW_US)
+		{
+			/* Done bit didn't respond to Reset */
+			ice_cfg_status = 1;
+			break;
+		}
 	}
-
-	/* raise reset */
-	ICE_CRST_HIGH();
+	now = esp_timer_get_time();
+	ice_cfg_st.reset_us = now - ice_cfg_start;
+	if(ice_cfg_status)
+		return;
 	
-	/* delay >1200us to allow FPGA to clear */
-	ets_delay_us(1200);
+	/* raise reset and let other tasks run while the FPGA clears */
+	ICE_CRST_HIGH();
+	xSemaphoreTake(ice_clear_sem, 0);
+	esp_timer_start_once(ice_clear_timer, ICE_CFG_CLEAR_US);
+	xSemaphoreTake(ice_clear_sem, portMAX_DELAY);
 	
 	/* send 8 dummy clocks with CS high */
 	ICE_SPI_CS_HIGH();
-	ICE_SPI_ClkToggle(8);
+	ICE_SPI_CfgClocks(8);
 	ICE_SPI_CS_LOW();
 	
-	/* send the bitstream */
-	ICE_SPI_WriteBlk(bitmap, size);
-
-    /* raise CS */
-	ICE_SPI_CS_HIGH();
+	ice_cfg_data = esp_timer_get_time();
+	ice_cfg_st.clear_us = ice_cfg_data - now;
+}
 
-	/* bitbang clock */
-	ICE_SPI_ClkToggle(160);
+/*
+ * send part of the bitstream
+ */
+void ICE_FPGA_Config_Write(uint8_t *Data, uint32_t size)
+{
+	if(ice_cfg_status)
+		return;
+	
+	ICE_SPI_CfgWriteBlk(Data, size);
+	ice_cfg_st.bytes += size;
+}
 
-    /* error if DONE not asserted */
-    if(ICE_CDONE_GET()==0)
-    {
-		return 2;
+/*
+ * finish the bitstream and wait for CDONE - returns 0 if OK, 1 if CDONE
+ * didn't drop in reset, 2 if it didn't rise after the data
+ */
+uint8_t ICE_FPGA_Config_End(void)
+{
+	int64_t start, now;
+	
+	if(!ice_cfg_status)
+	{
+		start = esp_timer_get_time();
+		ice_cfg_st.data_us = start - ice_cfg_data;
+		
+		/* raise CS and clock until DONE asserts */
+		ICE_SPI_CS_HIGH();
+		ICE_SPI_CfgClocks(ICE_CFG_DONE_CLKS);
+		ice_cfg_st.done_clks = ICE_CFG_DONE_CLKS;
+		while(ICE_CDONE_GET()==0)
+		{
+			if(esp_timer_get_time() - start > ICE_CFG_DONE_TO_US)
+			{
+				ice_cfg_status = 2;
+				break;
+			}
+			ICE_SPI_CfgClocks(8);
+			ice_cfg_st.done_clks += 8;
+		}
+		now = esp_timer_get_time();
+		ice_cfg_st.done_us = now - start;
+		
+		/* enough clocks to release the user I/O */
+		if(!ice_cfg_status)
+			ICE_SPI_CfgClocks(ICE_CFG_USER_CLKS);
 	}
 	
-	/* no error handling for now */
-	return 0;
+	/* CS is left high for subsequent port transactions */
+	ICE_SPI_CS_HIGH();
+	
+	ice_cfg_st.count++;
+	if(ice_cfg_status)
+		ice_cfg_st.fails++;
+	ice_cfg_st.status = ice_cfg_status;
+	ice_cfg_st.total_us = esp_timer_get_time() - ice_cfg_start;
+	ICE_UNLOCK();
+	
+	return ice_cfg_status;
+}
+
+/*
+ * configure the FPGA from a complete bitstream in memory
+ */
+uint8_t ICE_FPGA_Config(uint8_t *bitmap, uint32_t size)
+{
+	ICE_FPGA_Config_Begin();
+	ICE_FPGA_Config_Write(bitmap, size);
+	return ICE_FPGA_Config_End();
 }
 #endif
 
+/*
+ * Report configuration timing - returns length of report
+ */
+int ICE_FPGA_Config_Stats(uint8_t *buf, int max)
+{
+	if(max < sizeof(ice_cfg_stats_t))
+		return 0;
+	
+	memcpy(buf, &ice_cfg_st, sizeof(ice_cfg_stats_t));
+	return sizeof(ice_cfg_stats_t);
+}
+
 /*
  * Write a long to the FPGA SPI port
  */
 void ICE_FPGA_Serial_Write(uint8_t Reg, uint32_t Data)
 {
 	/* Drop CS */
+	ICE_LOCK();
 	ICE_SPI_CS_LOW();
 	
 	/* msbit of byte 0 is 0 for write */
@@ -354,6 +645,7 @@ void ICE_FPGA_Serial_Write(uint8_t Reg, uint32_t Data)
 	
 	/* Raise CS */
 	ICE_SPI_CS_HIGH();
+	ICE_UNLOCK();
 }
 
 /*
@@ -364,6 +656,7 @@ void ICE_FPGA_Serial_Read(uint8_t Reg, uint32_t *Data)
 	uint8_t rx[4];
 	
 	/* Drop CS */
+	ICE_LOCK();
 	ICE_SPI_CS_LOW();
 	
 	/* msbit of byte 0 is 1 for write */
@@ -380,6 +673,58 @@ void ICE_FPGA_Serial_Read(uint8_t Reg, uint32_t *Data)
 	
 	/* Raise CS */
 	ICE_SPI_CS_HIGH();
+	ICE_UNLOCK();
+}
+
+/*
+ * Poll a register until (Data & Mask) == Expect or timeout. Short poll
+ * intervals spin, long ones sleep. Returns 0 on match, 1 on timeout.
+ */
+uint8_t ICE_FPGA_Serial_Wait(uint8_t Reg, uint32_t Mask, uint32_t Expect,
+	uint32_t interval_us, uint32_t timeout_us, uint32_t *Data,
+	uint32_t *iters, uint32_t *elapsed_us)
+{
+	int64_t start = esp_timer_get_time(), now, spin = start;
+	uint32_t tick_us = portTICK_PERIOD_MS * 1000;
+	uint8_t stat = 1;
+	
+	*iters = 0;
+	while(1)
+	{
+		ICE_FPGA_Serial_Read(Reg, Data);
+		(*iters)++;
+		now = esp_timer_get_time();
+		
+		if((*Data & Mask) == Expect)
+		{
+			stat = 0;
+			break;
+		}
+		
+		if((now - start) >= timeout_us)
+			break;
+		
+		if(interval_us >= tick_us)
+		{
+			vTaskDelay(interval_us / tick_us);
+			spin = esp_timer_get_time();
+		}
+		else
+		{
+			if(interval_us)
+				ets_delay_us(interval_us);
+			
+			/* let lower priority tasks run during long spins */
+			if((now - spin) >= ICE_WAIT_SPIN_US)
+			{
+				vTaskDelay(1);
+				spin = esp_timer_get_time();
+			}
+		}
+	}
+	
+	*elapsed_us = now - start;
+	return stat;
 }
 
 /***********************************************************************/
@@ -400,6 +745,7 @@ void ICE_PSRAM_Write(uint32_t Addr, uint8_t *Data, uint32_t size)
 	header[3] = (Addr >>  0) & 0xff;
 	
 	/* Drop CS */
+	ICE_LOCK();
 	ICE_SPI_CS_LOW();
 	
 	/* send header */
@@ -409,31 +755,111 @@ void ICE_PSRAM_Write(uint32_t Addr, uint8_t *Data, uint32_t size)
 	ICE_SPI_WriteBlk(Data, size);
 	
 	/* Raise CS */
-	ICE_SPI_CS_HIGH();	
+	ICE_SPI_CS_HIGH();
+	ICE_UNLOCK();
 }
 
 /*
- * Read a block of data from the FPGA attached PSRAM via SPI port
+ * build the header for a PSRAM read - returns its size
  */
-void ICE_PSRAM_Read(uint32_t Addr, uint8_t *Data, uint32_t size)
+static uint32_t ICE_PSRAM_ReadHdr(uint8_t *header, uint32_t Addr)
 {
-	uint8_t header[4];
-	
-	/* build the PSRAM Read header */
-	header[0] = 0x03;					// slow read command
+	header[0] = ice_psram_rdcmd;
 	header[1] = (Addr >> 16) & 0xff;
 	header[2] = (Addr >>  8) & 0xff;
 	header[3] = (Addr >>  0) & 0xff;
+	header[4] = ICE_SPI_DUMMY_BYTE;
+	
+	return (ice_psram_rdcmd == ICE_PSRAM_FAST_READ) ? 5 : 4;
+}
+
+/*
+ * Read a block of data from the FPGA attached PSRAM via SPI port
+ */
+void ICE_PSRAM_Read(uint32_t Addr, uint8_t *Data, uint32_t size)
+{
+	uint8_t header[5];
 	
 	/* Drop CS */
+	ICE_LOCK();
 	ICE_SPI_CS_LOW();
 	
-	/* send header */
-	ICE_SPI_WriteBlk(header, 4);
+	/* send header - fast read has a byte of wait clocks */
+	ICE_SPI_WriteBlk(header, ICE_PSRAM_ReadHdr(header, Addr));
 	
 	/* get data */
 	ICE_SPI_ReadBlk(Data, size);
 	
 	/* Raise CS */
 	ICE_SPI_CS_HIGH();
+	ICE_UNLOCK();
+}
+
+/*
+ * Burst write to one FPGA register. The gateware must accept successive
+ * 32-bit words (msb first) for as long as CS is held low.
+ */
+void ICE_FPGA_Burst_Write(uint8_t Reg, uint8_t *Data, uint32_t size)
+{
+	/* Drop CS */
+	ICE_LOCK();
+	ICE_SPI_CS_LOW();
+	
+	/* msbit of byte 0 is 0 for write */
+	ICE_SPI_WriteByte(Reg & 0x7f);
+	
+	/* send data */
+	ICE_SPI_WriteBlk(Data, size);
+	
+	/* Raise CS */
+	ICE_SPI_CS_HIGH();
+	ICE_UNLOCK();
+}
+
+/*
+ * Start a DMA read of a block of data from PSRAM. The bus stays locked
+ * until ICE_Read_Wait() so the caller can do other work meanwhile.
+ */
+void ICE_PSRAM_Read_Start(uint32_t Addr, uint8_t *Data, uint32_t size)
+{
+	uint8_t header[5];
+	
+	/* Drop CS */
+	ICE_LOCK();
+	ICE_SPI_CS_LOW();
+	
+	/* send header - fast read has a byte of wait clocks */
+	ICE_SPI_WriteBlk(header, ICE_PSRAM_ReadHdr(header, Addr));
+	
+	/* queue data */
+	ICE_SPI_ReadBlk_Start(Data, size);
+}
+
+/*
+ * Start a DMA burst read of one FPGA register. The gateware must return
+ * successive 32-bit words (msb first) for as long as CS is held low.
+ */
+void ICE_FPGA_Burst_Read_Start(uint8_t Reg, uint8_t *Data, uint32_t size)
+{
+	/* Drop CS */
+	ICE_LOCK();
+	ICE_SPI_CS_LOW();
+	
+	/* msbit of byte 0 is 1 for read */
+	ICE_SPI_WriteByte(Reg | 0x80);
+	
+	/* queue data */
+	ICE_SPI_ReadBlk_Start(Data, size);
+}
+
+/*
+ * Finish a read started above
+ */
+void ICE_Read_Wait(void)
+{
+	ICE_SPI_ReadBlk_Wait();
+	
+	/* Raise CS */
+	ICE_SPI_CS_HIGH();
+	ICE_UNLOCK();
 }
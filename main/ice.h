@@ -8,11 +8,52 @@
 
 #include "main.h"
 
+/* PSRAM read opcodes for ICE_PSRAM_SetReadCmd() */
+#define ICE_PSRAM_SLOW_READ	0x03
+#define ICE_PSRAM_FAST_READ	0x0B
+
+/* APS6404L fitted to the ICE-V Wireless */
+#define ICE_PSRAM_SZ		(8*1024*1024)
+
+/* largest single ICE_*_Read_Start() */
+#define ICE_ASYNC_MAX_SZ	(6*4096)
+
+/* configuration timing as reported by ICE_FPGA_Config_Stats() */
+typedef struct
+{
+	uint32_t count;			// configurations attempted
+	uint32_t fails;			// configurations that returned an error
+	uint32_t status;		// result of the last one
+	uint32_t clk_hz;		// config SPI clock
+	uint32_t bytes;			// bitstream size
+	uint32_t reset_us;		// CRESET low until CDONE dropped
+	uint32_t clear_us;		// CRESET high until the first data
+	uint32_t data_us;		// bitstream transfer
+	uint32_t done_us;		// end of data until CDONE rose
+	uint32_t done_clks;		// dummy clocks sent before CDONE rose
+	uint32_t total_us;		// whole sequence
+} ice_cfg_stats_t;
+
 void ICE_Init(void);
+uint32_t ICE_SPI_SetClock(uint32_t hz);
+uint32_t ICE_SPI_GetClock(void);
+uint8_t ICE_PSRAM_SetReadCmd(uint8_t cmd);
+uint8_t ICE_PSRAM_GetReadCmd(void);
 uint8_t ICE_FPGA_Config(uint8_t *bitmap, uint32_t size);
+void ICE_FPGA_Config_Begin(void);
+void ICE_FPGA_Config_Write(uint8_t *Data, uint32_t size);
+uint8_t ICE_FPGA_Config_End(void);
+int ICE_FPGA_Config_Stats(uint8_t *buf, int max);
 void ICE_FPGA_Serial_Write(uint8_t Reg, uint32_t Data);
 void ICE_FPGA_Serial_Read(uint8_t Reg, uint32_t *Data);
+uint8_t ICE_FPGA_Serial_Wait(uint8_t Reg, uint32_t Mask, uint32_t Expect,
+	uint32_t interval_us, uint32_t timeout_us, uint32_t *Data,
+	uint32_t *iters, uint32_t *elapsed_us);
 void ICE_PSRAM_Write(uint32_t Addr, uint8_t *Data, uint32_t size);
 void ICE_PSRAM_Read(uint32_t Addr, uint8_t *Data, uint32_t size);
+void ICE_PSRAM_Read_Start(uint32_t Addr, uint8_t *Data, uint32_t size);
+void ICE_FPGA_Burst_Write(uint8_t Reg, uint8_t *Data, uint32_t size);
+void ICE_FPGA_Burst_Read_Start(uint8_t Reg, uint8_t *Data, uint32_t size);
+void ICE_Read_Wait(void);
 
 #endif
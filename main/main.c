@@ -11,6 +11,12 @@
 #include "spiffs.h"
 #include "wifi.h"
 #include "adc_c3.h"
+#include "event.h"
+#include "seq.h"
+#include "pool.h"
+#include "ota.h"
+#include "cache.h"
+#include "bitstream.h"
 #include "phy.h"
 #include <esp_wifi.h>
 #include <esp_netif.h>
@@ -18,12 +24,14 @@
 
 #define BOOT_PIN 9
 #define LED_PIN 10
+#define BOOT_CFG_TRIES 3
 
 static const char* TAG = "main";
 
 /* build version in simple format */
 const char *fwVersionStr = "V0.1";
 const char *cfg_file = "/spiffs/bitstream.bin";
+const char *cfg_bak_file = "/spiffs/bitstream.bak";
 
 /* build time */
 const char *bdate = __DATE__;
@@ -77,6 +85,34 @@ void boot_task(void *pvParameters)
 	}
 }
 
+/*
+ * configure the FPGA from a file if it checks out - returns 0 if OK
+ */
+static uint8_t boot_config(const char *fname)
+{
+	uint8_t *bin = NULL, cfg_stat = 0xff;
+	uint32_t sz, tries;
+	
+    ESP_LOGI(TAG, "Reading file %s", fname);
+	if(!spiffs_read((char *)fname, &bin, &sz) && !bitstream_check(bin, sz))
+	{
+		for(tries = 0; tries < BOOT_CFG_TRIES; tries++)
+		{
+			if(!(cfg_stat = ICE_FPGA_Config(bin, sz)))
+				break;
+			ESP_LOGW(TAG, "FPGA configured ERROR - status = %d", cfg_stat);
+		}
+		if(!cfg_stat)
+		{
+			ESP_LOGI(TAG, "FPGA configured OK - status = %d", cfg_stat);
+			wifi_set_design(cache_put(bin, sz));
+		}
+	}
+	pool_free(bin);
+	
+	return cfg_stat;
+}
+
 /*
  * Main!
  */
@@ -89,27 +125,33 @@ void app_main(void)
     ESP_LOGI(TAG, "Build Date: %s", bdate);
     ESP_LOGI(TAG, "Build Time: %s", btime);
 
+	/* check if this is a new image on trial */
+	ota_init();
+	
+	/* message buffers must be reserved before WiFi fragments the heap */
+	if(pool_init())
+		ESP_LOGE(TAG, "Buffer pool Init Failed");
+	if(cache_init())
+		ESP_LOGW(TAG, "Bitstream cache disabled");
+	
     ESP_LOGI(TAG, "Initializing SPIFFS");
 	spiffs_init();
 
 	/* init FPGA SPI port */
 	ICE_Init();
     ESP_LOGI(TAG, "FPGA SPI port initialized");
+	seq_init();
 	
-	/* configure FPGA from SPIFFS file */
-    ESP_LOGI(TAG, "Reading file %s", cfg_file);
-	uint8_t *bin = NULL;
-	uint32_t sz;
-	if(!spiffs_read((char *)cfg_file, &bin, &sz))
+	/* configure FPGA from SPIFFS file, or the one it replaced */
+	if(!boot_config(cfg_file) || !boot_config(cfg_bak_file))
 	{
-		uint8_t cfg_stat;
-		
-		/* loop on config failure */
-		while((cfg_stat = ICE_FPGA_Config(bin, sz)))
-			ESP_LOGW(TAG, "FPGA configured ERROR - status = %d", cfg_stat);
-		ESP_LOGI(TAG, "FPGA configured OK - status = %d", cfg_stat);
-		free(bin);
+		/* optional setup sequence - no read buffer so PSRD isn't allowed */
+		seq_result_t seq_res = {0};
+		if(seq_run_file(SEQ_BOOT_FILE, &seq_res) == ESP_OK)
+			ESP_LOGI(TAG, "Boot sequence done - %d us", seq_res.elapsed_us);
 	}
+	else
+		ESP_LOGE(TAG, "No usable bitstream - running without a design");
 
     /* init ADC for Vbat readings */
     if(!adc_c3_init())
@@ -117,6 +159,12 @@ void app_main(void)
     else
         ESP_LOGW(TAG, "ADC Init Failed");
     
+	/* FPGA interrupt -> socket event push */
+	if(!event_init())
+		ESP_LOGI(TAG, "FPGA Events Initialized");
+	else
+		ESP_LOGW(TAG, "FPGA Events Init Failed");
+	
 	/* init WiFi & socket */
 	if(!wifi_init())
 		ESP_LOGI(TAG, "WiFi Running");
@@ -16,5 +16,6 @@
 
 extern const char *fwVersionStr;
 extern const char *cfg_file;
+extern const char *cfg_bak_file;
 
 #endif
\ No newline at end of file
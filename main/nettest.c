@@ -0,0 +1,175 @@
+/*
+ * nettest.c - TCP throughput self-tests. Sink discards a payload, source
+ * sends a pattern and echo returns what it gets, all through the same
+ * socket_recv()/socket_send() as every other command so the numbers are
+ * what the link and lwIP can do without SPI or flash in the way.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "nettest.h"
+#include "pool.h"
+#include "esp_timer.h"
+
+static const char *TAG = "nettest";
+
+/*
+ * start the stats
+ */
+static void nettest_begin(nettest_stats_t *st, int64_t *start)
+{
+	memset(st, 0, sizeof(nettest_stats_t));
+	st->tcp_wnd = CONFIG_LWIP_TCP_WND_DEFAULT;
+	st->tcp_snd_buf = CONFIG_LWIP_TCP_SND_BUF_DEFAULT;
+	st->tcp_mss = CONFIG_LWIP_TCP_MSS;
+	*start = esp_timer_get_time();
+}
+
+/*
+ * count a call that ended at now after a gap since the last
+ */
+static void nettest_gap(nettest_stats_t *st, int64_t *last, int64_t now)
+{
+	uint32_t gap = now - *last;
+	
+	st->calls++;
+	if(gap >= NETTEST_STALL_US)
+		st->stalls++;
+	if(gap > st->max_gap_us)
+		st->max_gap_us = gap;
+	*last = now;
+}
+
+/*
+ * wrap up and log
+ */
+static void nettest_end(nettest_stats_t *st, int64_t start, const char *what)
+{
+	st->us = esp_timer_get_time() - start;
+	st->kbytes_per_sec = (uint64_t)st->bytes * 1000 / (st->us ? st->us : 1);
+	ESP_LOGI(TAG, "%s: %d bytes in %d us, %d kB/s, %d stalls, max gap %d us", what,
+		st->bytes, st->us, st->kbytes_per_sec, st->stalls, st->max_gap_us);
+}
+
+/*
+ * receive and discard txsz bytes, reply with err and stats
+ */
+void nettest_sink(socket_rx_t *rx, char *err, uint32_t txsz)
+{
+	uint8_t *buf = pool_alloc(POOL_MED_SZ), rbuf[1 + sizeof(nettest_stats_t)];
+	uint32_t sz = buf ? POOL_MED_SZ : sizeof(rbuf), left;
+	nettest_stats_t st;
+	int64_t start, last;
+	int len;
+	
+	nettest_begin(&st, &start);
+	last = start;
+	
+	/* still have to drain the payload without a buffer */
+	if(!buf)
+		*err |= 8;
+	while((left = txsz - st.bytes))
+	{
+		if((len = socket_recv(rx, buf ? buf : rbuf, (left < sz) ? left : sz)) <= 0)
+			break;
+		st.bytes += len;
+		nettest_gap(&st, &last, esp_timer_get_time());
+	}
+	nettest_end(&st, start, "Sink");
+	pool_free(buf);
+	
+	if(st.bytes < txsz)
+	{
+		ESP_LOGW(TAG, "Sink: connection lost with %d left", txsz - st.bytes);
+		return;
+	}
+	
+	rbuf[0] = *err;
+	memcpy(&rbuf[1], &st, sizeof(nettest_stats_t));
+	socket_reply(rx->req, rbuf, sizeof(rbuf));
+}
+
+/*
+ * send size bytes of a counting pattern then the stats, from the executor
+ * like any other reply
+ */
+void nettest_source(const socket_req_t *req, char *err, uint32_t size)
+{
+	uint8_t *buf = pool_alloc(POOL_MED_SZ);
+	nettest_stats_t st;
+	int64_t start, last;
+	uint32_t n, i;
+	
+	if(!buf)
+	{
+		*err |= 8;
+		socket_reply(req, err, 1);
+		return;
+	}
+	for(i = 0; i < POOL_MED_SZ; i++)
+		buf[i] = i;
+	
+	nettest_begin(&st, &start);
+	last = start;
+	if(socket_reply_hdr(req, 1 + size + sizeof(nettest_stats_t)) ||
+		socket_send(req->sock, err, 1))
+		goto done;
+	
+	/* a send that blocks this long is waiting on the window */
+	while(st.bytes < size)
+	{
+		n = ((size - st.bytes) > POOL_MED_SZ) ? POOL_MED_SZ : size - st.bytes;
+		if(socket_send(req->sock, buf, n))
+			break;
+		st.bytes += n;
+		nettest_gap(&st, &last, esp_timer_get_time());
+	}
+	nettest_end(&st, start, "Source");
+	
+	if(st.bytes == size)
+		socket_send(req->sock, &st, sizeof(nettest_stats_t));
+	
+done:
+	pool_free(buf);
+}
+
+/*
+ * send back txsz bytes as they arrive then the stats. The status goes
+ * out before the data so it can only report a missing buffer.
+ */
+void nettest_echo(socket_rx_t *rx, char *err, uint32_t txsz)
+{
+	uint8_t *buf = pool_alloc(POOL_MED_SZ), dump[64];
+	uint32_t sz = buf ? POOL_MED_SZ : sizeof(dump), left;
+	nettest_stats_t st;
+	int64_t start, last;
+	int len, sending;
+	
+	if(!buf)
+		*err |= 8;
+	
+	nettest_begin(&st, &start);
+	last = start;
+	
+	/* without a buffer the payload is drained and only the status sent */
+	sending = !*err;
+	if(socket_reply_hdr(rx->req, sending ? 1 + txsz + sizeof(nettest_stats_t) : 1) ||
+		socket_send(rx->req->sock, err, 1))
+		sending = 0;
+	
+	while((left = txsz - st.bytes))
+	{
+		if((len = socket_recv(rx, buf ? buf : dump, (left < sz) ? left : sz)) <= 0)
+			break;
+		if(sending && socket_send(rx->req->sock, buf, len))
+			sending = 0;
+		st.bytes += len;
+		nettest_gap(&st, &last, esp_timer_get_time());
+	}
+	nettest_end(&st, start, "Echo");
+	pool_free(buf);
+	
+	if(sending && (st.bytes == txsz))
+		socket_send(rx->req->sock, &st, sizeof(nettest_stats_t));
+}
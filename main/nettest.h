@@ -0,0 +1,34 @@
+/*
+ * nettest.h - TCP throughput self-tests that leave SPI and flash alone
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __NETTEST__
+#define __NETTEST__
+
+#include "main.h"
+#include "socket.h"
+
+/* a receive gap or send call this long is most likely a retransmit timeout */
+#define NETTEST_STALL_US	200000
+
+/* results, sent after the data */
+typedef struct
+{
+	uint32_t bytes;				// moved in each direction
+	uint32_t us;				// start to last byte
+	uint32_t kbytes_per_sec;
+	uint32_t calls;				// recv() or send() calls
+	uint32_t stalls;			// gaps of NETTEST_STALL_US or more
+	uint32_t max_gap_us;		// longest gap
+	uint32_t tcp_wnd;			// lwIP settings the numbers depend on
+	uint32_t tcp_snd_buf;
+	uint32_t tcp_mss;
+} nettest_stats_t;
+
+void nettest_sink(socket_rx_t *rx, char *err, uint32_t txsz);
+void nettest_source(const socket_req_t *req, char *err, uint32_t size);
+void nettest_echo(socket_rx_t *rx, char *err, uint32_t txsz);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * ota.c - streaming firmware update over the socket. The image is written
+ * to the inactive slot as it arrives and only booted if its SHA-256
+ * matches. A new image that doesn't get the socket server running is
+ * rolled back.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "ota.h"
+#include "pool.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "esp_idf_version.h"
+#include "mbedtls/sha256.h"
+
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+#define mbedtls_sha256_starts mbedtls_sha256_starts_ret
+#define mbedtls_sha256_update mbedtls_sha256_update_ret
+#define mbedtls_sha256_finish mbedtls_sha256_finish_ret
+#endif
+
+/* a new image has this long to get the socket server up */
+#define OTA_VALID_TIMEOUT_S	300
+
+static const char* TAG = "ota";
+static esp_timer_handle_t ota_timer;
+static uint8_t ota_pending;
+
+/*
+ * new image never got going
+ */
+static void ota_timeout(void *arg)
+{
+	ESP_LOGE(TAG, "New image not validated in %d s", OTA_VALID_TIMEOUT_S);
+	ota_fail();
+}
+
+/*
+ * check if we're a new image on trial
+ */
+esp_err_t ota_init(void)
+{
+	const esp_partition_t *running = esp_ota_get_running_partition();
+	esp_ota_img_states_t state;
+	
+	ESP_LOGI(TAG, "Running from %s", running->label);
+	if(esp_ota_get_state_partition(running, &state) != ESP_OK)
+		return ESP_OK;	// factory or no otadata
+	
+	if(state == ESP_OTA_IMG_PENDING_VERIFY)
+	{
+		esp_timer_create_args_t args = {
+			.callback = ota_timeout,
+			.name = "ota",
+		};
+		
+		ESP_LOGW(TAG, "New image - waiting for socket server");
+		ota_pending = 1;
+		ESP_ERROR_CHECK(esp_timer_create(&args, &ota_timer));
+		ESP_ERROR_CHECK(esp_timer_start_once(ota_timer, OTA_VALID_TIMEOUT_S*1000000ULL));
+	}
+	
+	return ESP_OK;
+}
+
+/*
+ * socket server is up - keep this image
+ */
+void ota_mark_valid(void)
+{
+	if(!ota_pending)
+		return;
+	
+	ota_pending = 0;
+	esp_timer_stop(ota_timer);
+	if(esp_ota_mark_app_valid_cancel_rollback() == ESP_OK)
+		ESP_LOGI(TAG, "New image marked valid");
+}
+
+/*
+ * socket server failed - go back to the previous image if this one is new
+ */
+void ota_fail(void)
+{
+	if(!ota_pending)
+		return;
+	
+	ESP_LOGE(TAG, "Rolling back");
+	esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+/*
+ * receive an image: SHA-256(32) followed by the app binary
+ */
+void ota_update(socket_rx_t *rx, char *err, uint32_t txsz)
+{
+	const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+	esp_ota_handle_t handle = 0;
+	mbedtls_sha256_context sha;
+	uint8_t expect[32], actual[32], *buf = NULL;
+	uint32_t left = txsz, got = 0, written = 0, elapsed;
+	int64_t start = esp_timer_get_time();
+	int len, begun = 0;
+	esp_err_t ret;
+	
+	mbedtls_sha256_init(&sha);
+	mbedtls_sha256_starts(&sha, 0);
+	
+	if(txsz <= sizeof(expect) || !part)
+	{
+		ESP_LOGW(TAG, "Bad update - len %d", txsz);
+		*err |= 8;
+	}
+	else if(!(buf = pool_alloc(POOL_MED_SZ)))
+	{
+		ESP_LOGW(TAG, "Couldn't alloc buffer");
+		*err |= 8;
+	}
+	else
+	{
+		/* expected hash first */
+		while(got < sizeof(expect))
+		{
+			if((len = socket_recv(rx, expect + got, sizeof(expect) - got)) <= 0)
+				break;
+			got += len;
+		}
+		left -= got;
+		
+		/* erase as we go so nothing waits for the whole slot */
+		if((got == sizeof(expect)) &&
+		   ((ret = esp_ota_begin(part, OTA_WITH_SEQUENTIAL_WRITES, &handle)) == ESP_OK))
+		{
+			begun = 1;
+			ESP_LOGI(TAG, "Writing %d to %s", left, part->label);
+		}
+		else
+			*err |= 8;
+	}
+	
+	/* stream it in, or drain it if something is already wrong */
+	while(left)
+	{
+		uint8_t dump[64];
+		uint8_t *dst = buf ? buf : dump;
+		uint32_t sz = buf ? POOL_MED_SZ : sizeof(dump);
+		
+		if((len = socket_recv(rx, dst, (left < sz) ? left : sz)) <= 0)
+			break;
+		left -= len;
+		
+		if(*err)
+			continue;
+		
+		mbedtls_sha256_update(&sha, dst, len);
+		if((ret = esp_ota_write(handle, dst, len)) != ESP_OK)
+		{
+			ESP_LOGE(TAG, "Write failed (%s)", esp_err_to_name(ret));
+			*err |= 8;
+		}
+		written += len;
+	}
+	mbedtls_sha256_finish(&sha, actual);
+	mbedtls_sha256_free(&sha);
+	pool_free(buf);
+	
+	if(left)
+	{
+		ESP_LOGW(TAG, "Connection lost with %d left", left);
+		*err |= 8;
+	}
+	else if(!*err && memcmp(expect, actual, sizeof(actual)))
+	{
+		ESP_LOGE(TAG, "SHA-256 mismatch");
+		*err |= 8;
+	}
+	
+	/* esp_ota_end() also checks the image itself */
+	if(begun)
+	{
+		if(*err)
+			esp_ota_abort(handle);
+		else if((ret = esp_ota_end(handle)) != ESP_OK)
+		{
+			ESP_LOGE(TAG, "Image invalid (%s)", esp_err_to_name(ret));
+			*err |= 8;
+		}
+		else if((ret = esp_ota_set_boot_partition(part)) != ESP_OK)
+		{
+			ESP_LOGE(TAG, "Set boot failed (%s)", esp_err_to_name(ret));
+			*err |= 8;
+		}
+	}
+	
+	/* status, bytes written, elapsed ms */
+	{
+		char rbuf[9];
+		elapsed = (esp_timer_get_time() - start) / 1000;
+		rbuf[0] = *err;
+		memcpy(&rbuf[1], &written, 4);
+		memcpy(&rbuf[5], &elapsed, 4);
+		socket_reply(rx->req, rbuf, sizeof(rbuf));
+	}
+	
+	if(!*err)
+	{
+		ESP_LOGI(TAG, "Update OK - %d bytes in %d ms, restarting", written, elapsed);
+		vTaskDelay(500 / portTICK_PERIOD_MS);
+		esp_restart();
+	}
+}
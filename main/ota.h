@@ -0,0 +1,18 @@
+/*
+ * ota.h - streaming firmware update over the socket
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __OTA__
+#define __OTA__
+
+#include "main.h"
+#include "socket.h"
+
+esp_err_t ota_init(void);
+void ota_mark_valid(void);
+void ota_fail(void);
+void ota_update(socket_rx_t *rx, char *err, uint32_t txsz);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * persist.c - writes a bitstream that's already been configured to flash
+ * from a low priority task, so configure and persist costs one upload and
+ * the client isn't kept waiting on SPIFFS.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "persist.h"
+#include "spiffs.h"
+#include "cache.h"
+#include "pool.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "persist";
+
+#define PERSIST_TASK_PRIO	2		// below the network and executor
+
+static TaskHandle_t persist_task_handle;
+static SemaphoreHandle_t persist_free;	// given while no write is queued
+static uint8_t *persist_buf;
+static int64_t persist_start;
+static persist_stat_t persist_st;
+static portMUX_TYPE persist_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+ * write queued buffers one at a time
+ */
+static void persist_task(void *pvParameters)
+{
+	esp_err_t ret;
+	
+	while(1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		
+		spiffs_keep((char *)cfg_file, (char *)cfg_bak_file);
+		ret = spiffs_write((char *)cfg_file, persist_buf, persist_st.bytes);
+		cache_flash_changed();
+		pool_free(persist_buf);
+		persist_buf = NULL;
+		
+		portENTER_CRITICAL(&persist_mux);
+		persist_st.result = ret;
+		persist_st.write_us = esp_timer_get_time() - persist_start;
+		persist_st.state = ret ? PERSIST_FAILED : PERSIST_DONE;
+		portEXIT_CRITICAL(&persist_mux);
+		
+		if(ret)
+			ESP_LOGW(TAG, "Write %d failed: %d", persist_st.seq, ret);
+		else
+			ESP_LOGI(TAG, "Write %d done in %d us", persist_st.seq, persist_st.write_us);
+		xSemaphoreGive(persist_free);
+	}
+}
+
+/*
+ * start the writer task
+ */
+esp_err_t persist_init(void)
+{
+	if(!(persist_free = xSemaphoreCreateBinary()))
+		return ESP_ERR_NO_MEM;
+	xSemaphoreGive(persist_free);
+	
+	if(xTaskCreate(persist_task, "persist", 3072, NULL, PERSIST_TASK_PRIO,
+		&persist_task_handle) != pdPASS)
+		return ESP_FAIL;
+	
+	return ESP_OK;
+}
+
+/*
+ * queue a pool buffer to be written to cfg_file and freed. Waits for
+ * an earlier write to finish first. Returns the job number.
+ */
+uint32_t persist_submit(uint8_t *buf, uint32_t len, uint32_t crc)
+{
+	uint32_t seq;
+	
+	xSemaphoreTake(persist_free, portMAX_DELAY);
+	persist_buf = buf;
+	persist_start = esp_timer_get_time();
+	
+	portENTER_CRITICAL(&persist_mux);
+	seq = ++persist_st.seq;
+	persist_st.state = PERSIST_WRITING;
+	persist_st.crc = crc;
+	persist_st.bytes = len;
+	persist_st.result = 0;
+	persist_st.write_us = 0;
+	portEXIT_CRITICAL(&persist_mux);
+	
+	xTaskNotifyGive(persist_task_handle);
+	return seq;
+}
+
+/*
+ * wait for a queued write to finish - 0 if it didn't in time
+ */
+int persist_wait(TickType_t timeout)
+{
+	if(!persist_free || (xSemaphoreTake(persist_free, timeout) != pdTRUE))
+		return 0;
+	
+	xSemaphoreGive(persist_free);
+	return 1;
+}
+
+/*
+ * state of the latest write
+ */
+void persist_status(persist_stat_t *st)
+{
+	portENTER_CRITICAL(&persist_mux);
+	memcpy(st, &persist_st, sizeof(persist_stat_t));
+	portEXIT_CRITICAL(&persist_mux);
+}
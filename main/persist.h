@@ -0,0 +1,34 @@
+/*
+ * persist.h - background bitstream write to flash
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __PERSIST__
+#define __PERSIST__
+
+#include "main.h"
+
+/* persist_stat_t.state */
+#define PERSIST_IDLE		0	// nothing written since boot
+#define PERSIST_WRITING		1
+#define PERSIST_DONE		2
+#define PERSIST_FAILED		3
+
+/* state of the latest write as reported by persist_status() */
+typedef struct
+{
+	uint32_t state;
+	uint32_t seq;			// job number, counts up from 1
+	uint32_t crc;			// CRC32 of the bitstream
+	uint32_t bytes;
+	uint32_t result;		// esp_err_t of the write
+	uint32_t write_us;		// queued to committed
+} persist_stat_t;
+
+esp_err_t persist_init(void);
+uint32_t persist_submit(uint8_t *buf, uint32_t len, uint32_t crc);
+int persist_wait(TickType_t timeout);
+void persist_status(persist_stat_t *st);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * pool.c - fixed slab message buffer pool. All message, SPI and flash
+ * buffers come from here so long uptimes don't fragment the heap.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "pool.h"
+#include "esp_heap_caps.h"
+
+#define POOL_CLASSES	3
+
+typedef struct
+{
+	uint8_t *base;		// contiguous block of slabs
+	uint32_t free;		// bitmap of free slabs
+	pool_stats_t stats;
+} pool_class_t;
+
+static const char* TAG = "pool";
+static portMUX_TYPE pool_mux = portMUX_INITIALIZER_UNLOCKED;
+static pool_class_t pool[POOL_CLASSES] =
+{
+	{.stats = {.size = POOL_SMALL_SZ, .count = POOL_SMALL_CNT}},
+	{.stats = {.size = POOL_MED_SZ, .count = POOL_MED_CNT}},
+	{.stats = {.size = POOL_LARGE_SZ, .count = POOL_LARGE_CNT}},
+};
+
+/*
+ * reserve all slabs - call before WiFi starts taking memory
+ */
+esp_err_t pool_init(void)
+{
+	int i;
+	
+	for(i=0;i<POOL_CLASSES;i++)
+	{
+		pool[i].base = heap_caps_malloc(pool[i].stats.size * pool[i].stats.count, MALLOC_CAP_DMA);
+		if(!pool[i].base)
+		{
+			ESP_LOGE(TAG, "Failed to reserve %d x %d", pool[i].stats.count, pool[i].stats.size);
+			return ESP_ERR_NO_MEM;
+		}
+		pool[i].free = (1ULL << pool[i].stats.count) - 1;
+		ESP_LOGI(TAG, "Reserved %d x %d", pool[i].stats.count, pool[i].stats.size);
+	}
+	
+	return ESP_OK;
+}
+
+/*
+ * get the smallest free slab that fits, NULL if none
+ */
+void *pool_alloc(uint32_t size)
+{
+	void *ptr = NULL;
+	int i, j, fit = -1;
+	
+	portENTER_CRITICAL(&pool_mux);
+	for(i=0;i<POOL_CLASSES;i++)
+	{
+		if(size > pool[i].stats.size)
+			continue;
+		
+		if(fit < 0)
+			fit = i;
+		
+		if(pool[i].free)
+		{
+			j = __builtin_ctz(pool[i].free);
+			pool[i].free &= ~(1U << j);
+			ptr = pool[i].base + j * pool[i].stats.size;
+			pool[i].stats.allocs++;
+			if(++pool[i].stats.in_use > pool[i].stats.peak)
+				pool[i].stats.peak = pool[i].stats.in_use;
+			break;
+		}
+	}
+	
+	/* charge the failure to the class that should have held it */
+	if(!ptr && (fit >= 0))
+		pool[fit].stats.fails++;
+	portEXIT_CRITICAL(&pool_mux);
+	
+	if(!ptr)
+		ESP_LOGW(TAG, "No slab for %d", size);
+	
+	return ptr;
+}
+
+/*
+ * return a slab
+ */
+void pool_free(void *ptr)
+{
+	uint8_t *p = ptr;
+	int i;
+	
+	if(!p)
+		return;
+	
+	portENTER_CRITICAL(&pool_mux);
+	for(i=0;i<POOL_CLASSES;i++)
+	{
+		if((p >= pool[i].base) && (p < pool[i].base + pool[i].stats.size * pool[i].stats.count))
+		{
+			pool[i].free |= 1U << ((p - pool[i].base) / pool[i].stats.size);
+			pool[i].stats.in_use--;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&pool_mux);
+	
+	if(i == POOL_CLASSES)
+		ESP_LOGE(TAG, "Freeing %p not in pool", ptr);
+}
+
+/*
+ * copy out per-class statistics, returns bytes used
+ */
+int pool_stats(uint8_t *buf, int max)
+{
+	int i, len = 0;
+	
+	portENTER_CRITICAL(&pool_mux);
+	for(i=0;(i<POOL_CLASSES) && (len + sizeof(pool_stats_t) <= max);i++)
+	{
+		memcpy(buf + len, &pool[i].stats, sizeof(pool_stats_t));
+		len += sizeof(pool_stats_t);
+	}
+	portEXIT_CRITICAL(&pool_mux);
+	
+	return len;
+}
@@ -0,0 +1,36 @@
+/*
+ * pool.h - fixed slab message buffer pool
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __POOL__
+#define __POOL__
+
+#include "main.h"
+
+/* slab classes - the large one holds a whole UP5k bitstream */
+#define POOL_SMALL_SZ		512
+#define POOL_SMALL_CNT		8
+#define POOL_MED_SZ			8192
+#define POOL_MED_CNT		4
+#define POOL_LARGE_SZ		(104*1024)
+#define POOL_LARGE_CNT		1
+
+/* per-class statistics as reported by pool_stats() */
+typedef struct
+{
+	uint32_t size;		// slab size
+	uint32_t count;		// number of slabs
+	uint32_t in_use;	// currently allocated
+	uint32_t peak;		// high water mark of in_use
+	uint32_t allocs;	// successful allocations
+	uint32_t fails;		// requests that found no free slab
+} pool_stats_t;
+
+esp_err_t pool_init(void);
+void *pool_alloc(uint32_t size);
+void pool_free(void *ptr);
+int pool_stats(uint8_t *buf, int max);
+
+#endif
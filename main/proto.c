@@ -0,0 +1,185 @@
+/*
+ * proto.c - socket message framing. Splits a byte stream into messages of
+ * either header format, however the stream is segmented.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "proto.h"
+
+#define PROTO_ST_HDR		0
+#define PROTO_ST_BODY		1
+
+/*
+ * little-endian word from the header buffer
+ */
+static uint32_t proto_word(const uint8_t *b)
+{
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+/*
+ * header bytes needed so far - 4 until the magic says which format
+ */
+static uint32_t proto_hdr_need(const proto_t *p)
+{
+	if(p->hlen < 4)
+		return 4;
+	
+	return ((proto_word(p->hbuf) & PROTO_TAG_MASK) == PROTO_TAG_MAGIC) ?
+		PROTO_TAG_HDR_SZ : PROTO_HDR_SZ;
+}
+
+/*
+ * start a new parser - alloc supplies body buffers
+ */
+void proto_init(proto_t *p, void *(*alloc)(uint32_t size))
+{
+	memset(p, 0, sizeof(proto_t));
+	p->alloc = alloc;
+}
+
+/*
+ * commands whose payload is read by the handler as it's used
+ */
+int proto_is_stream(const proto_hdr_t *hdr)
+{
+	if(hdr->tagged && (hdr->cmd >= 0x10))
+		return (hdr->cmd == 0x13) || (hdr->cmd == 0x15);
+	
+	/* big PSRAM writes go straight through rather than taking a slab */
+	return (hdr->cmd == 0xe) || (hdr->cmd == 7) || (hdr->cmd == 9) ||
+		((hdr->cmd == 0xc) && (hdr->txsz > PROTO_PSRAM_WR_INLINE));
+}
+
+/*
+ * consume input up to the end of the next message or header event.
+ * *used is how much of buf was taken.
+ */
+int proto_parse(proto_t *p, const uint8_t *buf, uint32_t len, uint32_t *used)
+{
+	uint32_t sz, need, w0;
+	
+	*used = 0;
+	while(len)
+	{
+		if(p->state == PROTO_ST_HDR)
+		{
+			/* fill header - may arrive in any number of pieces */
+			need = proto_hdr_need(p);
+			sz = need - p->hlen;
+			sz = (sz < len) ? sz : len;
+			memcpy(&p->hbuf[p->hlen], buf, sz);
+			p->hlen += sz;
+			buf += sz;
+			len -= sz;
+			*used += sz;
+	
+			/* magic is known as soon as the first word is in */
+			if(p->hlen == 4)
+			{
+				w0 = proto_word(p->hbuf);
+				if(((w0 & PROTO_MAGIC_MASK) != PROTO_MAGIC) &&
+					((w0 & PROTO_TAG_MASK) != PROTO_TAG_MAGIC))
+				{
+					p->hlen = 0;
+					return PROTO_BAD;
+				}
+				continue;
+			}
+	
+			if(p->hlen < proto_hdr_need(p))
+				continue;
+	
+			/* header done */
+			w0 = proto_word(p->hbuf);
+			p->hdr.tagged = (w0 & PROTO_TAG_MASK) == PROTO_TAG_MAGIC;
+			p->hdr.cmd = w0 & (p->hdr.tagged ? 0xFF : 0xF);
+			p->hdr.txsz = proto_word(&p->hbuf[4]);
+			p->hdr.tag = p->hdr.tagged ? proto_word(&p->hbuf[8]) : 0;
+			p->hlen = 0;
+	
+			if(proto_is_stream(&p->hdr))
+				return PROTO_STREAM;
+	
+			p->body = p->alloc ? p->alloc(p->hdr.txsz) : NULL;
+			p->got = 0;
+			p->state = PROTO_ST_BODY;
+		}
+	
+		if(p->state == PROTO_ST_BODY)
+		{
+			if(p->got == p->hdr.txsz)
+				break;
+	
+			sz = p->hdr.txsz - p->got;
+			sz = (sz < len) ? sz : len;
+			if(p->body)
+				memcpy(&p->body[p->got], buf, sz);
+			p->got += sz;
+			buf += sz;
+			len -= sz;
+			*used += sz;
+		}
+	}
+	
+	/* empty bodies finish with the header */
+	if((p->state == PROTO_ST_BODY) && (p->got == p->hdr.txsz))
+	{
+		p->state = PROTO_ST_HDR;
+		return PROTO_MSG;
+	}
+	
+	return PROTO_MORE;
+}
+
+/*
+ * where the rest of a body can be received without a copy, NULL if the
+ * parser isn't in a body or is discarding it
+ */
+uint8_t *proto_direct(proto_t *p, uint32_t *len)
+{
+	if((p->state != PROTO_ST_BODY) || !p->body || (p->got == p->hdr.txsz))
+		return NULL;
+	
+	*len = p->hdr.txsz - p->got;
+	return &p->body[p->got];
+}
+
+/*
+ * account for len bytes received at proto_direct()
+ */
+int proto_advance(proto_t *p, uint32_t len)
+{
+	p->got += len;
+	if(p->got < p->hdr.txsz)
+		return PROTO_MORE;
+	
+	p->state = PROTO_ST_HDR;
+	return PROTO_MSG;
+}
+
+/*
+ * hand the finished body to the caller - the parser forgets it
+ */
+uint8_t *proto_take(proto_t *p)
+{
+	uint8_t *body = p->body;
+	
+	p->body = NULL;
+	return body;
+}
+
+/*
+ * build the reply prefix for a message - returns its size, 0 for legacy
+ */
+int proto_reply_hdr(const proto_hdr_t *hdr, uint32_t len, uint8_t *out)
+{
+	if(!hdr->tagged)
+		return 0;
+	
+	memcpy(&out[0], &hdr->tag, 4);
+	memcpy(&out[4], &len, 4);
+	return 8;
+}
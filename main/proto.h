@@ -0,0 +1,62 @@
+/*
+ * proto.h - socket message framing. Plain C with no IDF dependencies so
+ * host tools can build the same parser.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __PROTO__
+#define __PROTO__
+
+#include <stdint.h>
+
+/*
+ * Two header formats, both little-endian words followed by txsz bytes:
+ *  legacy : 0xCAFEBEE0|cmd, txsz            - 4 bit cmd, reply is err+data
+ *  tagged : 0xCAFEBA00|cmd, txsz, tag       - 8 bit cmd, reply is prefixed
+ *                                             with tag and length
+ */
+#define PROTO_MAGIC			0xCAFEBEE0
+#define PROTO_MAGIC_MASK	0xFFFFFFF0
+#define PROTO_TAG_MAGIC		0xCAFEBA00
+#define PROTO_TAG_MASK		0xFFFFFF00
+#define PROTO_HDR_SZ		8
+#define PROTO_TAG_HDR_SZ	12
+
+/* PSRAM writes (cmd 0xc) with more payload than this are streamed */
+#define PROTO_PSRAM_WR_INLINE	8192
+
+/* proto_parse() results */
+#define PROTO_MORE			0	// input used up, need more
+#define PROTO_MSG			1	// message complete - take hdr and body
+#define PROTO_STREAM		2	// streaming cmd header - caller reads txsz bytes
+#define PROTO_BAD			3	// unknown magic, stream can't be trusted
+
+typedef struct
+{
+	uint32_t cmd;
+	uint32_t txsz;
+	uint32_t tag;
+	uint32_t tagged;
+} proto_hdr_t;
+
+typedef struct
+{
+	int state;
+	uint8_t hbuf[PROTO_TAG_HDR_SZ];
+	uint32_t hlen;
+	proto_hdr_t hdr;
+	uint8_t *body;		// NULL if alloc failed - body is discarded
+	uint32_t got;
+	void *(*alloc)(uint32_t size);
+} proto_t;
+
+void proto_init(proto_t *p, void *(*alloc)(uint32_t size));
+int proto_is_stream(const proto_hdr_t *hdr);
+int proto_parse(proto_t *p, const uint8_t *buf, uint32_t len, uint32_t *used);
+uint8_t *proto_direct(proto_t *p, uint32_t *len);
+int proto_advance(proto_t *p, uint32_t len);
+uint8_t *proto_take(proto_t *p);
+int proto_reply_hdr(const proto_hdr_t *hdr, uint32_t len, uint8_t *out);
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * ps.c - Wi-Fi power-save governor. Keeps the radio awake while a client
+ * is busy and drops back to modem sleep once things have been quiet for a
+ * while, or holds whatever mode a client pins.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "ps.h"
+#include "trace.h"
+#include "esp_wifi.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "ps";
+
+#define PS_NVS_NS			"ps"
+#define PS_NVS_KEY			"cfg"
+#define PS_TASK_PRIO		4		// below the network and executor
+
+/* per mode accumulators - widened from what ps_stats() reports */
+typedef struct
+{
+	uint32_t entries;
+	int64_t time_us;
+	uint32_t requests;
+	uint64_t lat_sum_us;
+	uint32_t lat_max_us;
+} ps_acc_t;
+
+static const ps_config_t ps_defaults = {
+	.pin = PS_AUTO,
+	.idle_mode = WIFI_PS_MIN_MODEM,
+	.idle_ms = 5000,
+	.boost_bps = 4096,
+};
+
+static ps_config_t ps_cfg;
+static uint32_t ps_mode = WIFI_PS_MIN_MODEM, ps_switches;
+static int64_t ps_mode_start, ps_last_active;
+static ps_acc_t ps_acc[PS_MODES];
+
+/* traffic since the last tick - touched by the network tasks */
+static uint32_t ps_window, ps_kick;
+static portMUX_TYPE ps_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* mode and config - touched by the tick task and the executor */
+static SemaphoreHandle_t ps_lock;
+static esp_timer_handle_t ps_timer;
+static TaskHandle_t ps_task_handle;
+
+/*
+ * switch modes, charging the time so far to the old one. Call locked.
+ */
+static void ps_set(uint32_t mode, int64_t now)
+{
+	esp_err_t ret;
+	
+	if(mode == ps_mode)
+		return;
+	
+	if((ret = esp_wifi_set_ps(mode)) != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Couldn't set mode %d: %d", mode, ret);
+		return;
+	}
+	
+	portENTER_CRITICAL(&ps_mux);
+	ps_acc[ps_mode].time_us += now - ps_mode_start;
+	ps_acc[mode].entries++;
+	ps_mode = mode;
+	portEXIT_CRITICAL(&ps_mux);
+	ps_mode_start = now;
+	ps_switches++;
+	TRACE(PS_MODE, mode, 0);
+}
+
+/*
+ * pick the mode for now. Call locked.
+ */
+static void ps_update(int64_t now)
+{
+	if(ps_cfg.pin != PS_AUTO)
+		ps_set(ps_cfg.pin, now);
+	else if(now - ps_last_active < (int64_t)ps_cfg.idle_ms * 1000)
+		ps_set(WIFI_PS_NONE, now);
+	else
+		ps_set(ps_cfg.idle_mode, now);
+}
+
+/*
+ * periodic timer - runs on the shared esp_timer task so it only wakes
+ * ps_task, which can wait for the lock and the Wi-Fi driver
+ */
+static void ps_tick(void *arg)
+{
+	xTaskNotifyGive(ps_task_handle);
+}
+
+/*
+ * check the traffic rate once per tick
+ */
+static void ps_task(void *arg)
+{
+	int64_t now;
+	uint32_t bytes, kick;
+	
+	while(1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		now = esp_timer_get_time();
+		
+		portENTER_CRITICAL(&ps_mux);
+		bytes = ps_window;
+		kick = ps_kick;
+		ps_window = 0;
+		ps_kick = 0;
+		portEXIT_CRITICAL(&ps_mux);
+		
+		xSemaphoreTake(ps_lock, portMAX_DELAY);
+		
+		/* it takes a burst to wake up but any traffic keeps us awake */
+		if(kick || (bytes && ((ps_mode == WIFI_PS_NONE) ||
+			(bytes * (1000 / PS_TICK_MS) >= ps_cfg.boost_bps))))
+			ps_last_active = now;
+		ps_update(now);
+		
+		xSemaphoreGive(ps_lock);
+	}
+}
+
+/*
+ * check a config before using it
+ */
+static int ps_valid(const ps_config_t *cfg)
+{
+	return ((cfg->pin == PS_AUTO) || (cfg->pin < PS_MODES)) &&
+		(cfg->idle_mode < PS_MODES);
+}
+
+/*
+ * load settings and start the governor - call once connected
+ */
+esp_err_t ps_init(void)
+{
+	esp_timer_create_args_t args = {
+		.callback = ps_tick,
+		.name = "ps",
+	};
+	nvs_handle handle;
+	size_t sz = sizeof(ps_config_t);
+	
+	ps_cfg = ps_defaults;
+	if(nvs_open(PS_NVS_NS, NVS_READONLY, &handle) == ESP_OK)
+	{
+		if((nvs_get_blob(handle, PS_NVS_KEY, &ps_cfg, &sz) != ESP_OK) ||
+			(sz != sizeof(ps_config_t)) || !ps_valid(&ps_cfg))
+			ps_cfg = ps_defaults;
+		nvs_close(handle);
+	}
+	ESP_LOGI(TAG, "pin %d, idle mode %d after %d ms, boost at %d B/s",
+		ps_cfg.pin, ps_cfg.idle_mode, ps_cfg.idle_ms, ps_cfg.boost_bps);
+	
+	if(!(ps_lock = xSemaphoreCreateMutex()))
+		return ESP_ERR_NO_MEM;
+	
+	/* a client usually shows up right after we connect */
+	esp_wifi_get_ps((wifi_ps_type_t *)&ps_mode);
+	ps_mode_start = ps_last_active = esp_timer_get_time();
+	ps_acc[ps_mode].entries++;
+	xSemaphoreTake(ps_lock, portMAX_DELAY);
+	ps_update(ps_mode_start);
+	xSemaphoreGive(ps_lock);
+	
+	if(xTaskCreate(ps_task, "ps", 3072, NULL, PS_TASK_PRIO,
+		&ps_task_handle) != pdPASS)
+		return ESP_FAIL;
+	
+	ESP_ERROR_CHECK(esp_timer_create(&args, &ps_timer));
+	return esp_timer_start_periodic(ps_timer, PS_TICK_MS * 1000);
+}
+
+/*
+ * count bytes moved on the socket
+ */
+void ps_traffic(uint32_t bytes)
+{
+	portENTER_CRITICAL(&ps_mux);
+	ps_window += bytes;
+	portEXIT_CRITICAL(&ps_mux);
+}
+
+/*
+ * a client connected - wake up at the next tick
+ */
+void ps_connect(void)
+{
+	portENTER_CRITICAL(&ps_mux);
+	ps_kick = 1;
+	portEXIT_CRITICAL(&ps_mux);
+}
+
+/*
+ * record the receive to reply time of a request
+ */
+void ps_request(uint32_t lat_us)
+{
+	portENTER_CRITICAL(&ps_mux);
+	ps_acc_t *a = &ps_acc[ps_mode];
+	a->requests++;
+	a->lat_sum_us += lat_us;
+	if(lat_us > a->lat_max_us)
+		a->lat_max_us = lat_us;
+	portEXIT_CRITICAL(&ps_mux);
+}
+
+/*
+ * change settings - PS_KEEP fields stay as they are. Saved to NVS and
+ * applied at once.
+ */
+esp_err_t ps_config(const ps_config_t *cfg)
+{
+	ps_config_t n;
+	nvs_handle handle;
+	esp_err_t ret;
+	
+	if(!ps_lock)
+		return ESP_ERR_INVALID_STATE;
+	
+	xSemaphoreTake(ps_lock, portMAX_DELAY);
+	n = ps_cfg;
+	
+	/* pin uses all ones for auto so it's always set */
+	n.pin = cfg->pin;
+	if(cfg->idle_mode != PS_KEEP)
+		n.idle_mode = cfg->idle_mode;
+	if(cfg->idle_ms != PS_KEEP)
+		n.idle_ms = cfg->idle_ms;
+	if(cfg->boost_bps != PS_KEEP)
+		n.boost_bps = cfg->boost_bps;
+	
+	if(!ps_valid(&n))
+	{
+		xSemaphoreGive(ps_lock);
+		return ESP_ERR_INVALID_ARG;
+	}
+	
+	ps_cfg = n;
+	ps_update(esp_timer_get_time());
+	xSemaphoreGive(ps_lock);
+	
+	/* remember for next boot */
+	if((ret = nvs_open(PS_NVS_NS, NVS_READWRITE, &handle)) == ESP_OK)
+	{
+		if((ret = nvs_set_blob(handle, PS_NVS_KEY, &n, sizeof(ps_config_t))) == ESP_OK)
+			ret = nvs_commit(handle);
+		nvs_close(handle);
+	}
+	if(ret != ESP_OK)
+		ESP_LOGW(TAG, "Couldn't save settings: %d", ret);
+	
+	return ESP_OK;
+}
+
+/*
+ * current settings - returns the mode
+ */
+uint32_t ps_get(ps_config_t *cfg)
+{
+	uint32_t mode;
+	
+	if(ps_lock)
+		xSemaphoreTake(ps_lock, portMAX_DELAY);
+	*cfg = ps_cfg;
+	mode = ps_mode;
+	if(ps_lock)
+		xSemaphoreGive(ps_lock);
+	
+	return mode;
+}
+
+/*
+ * report the mode, settings and per mode residency and latency
+ */
+int ps_stats(uint8_t *buf, int max)
+{
+	ps_stats_t st;
+	ps_acc_t acc[PS_MODES];
+	int64_t now = esp_timer_get_time();
+	int i;
+	
+	if((max < sizeof(ps_stats_t)) || !ps_lock)
+		return 0;
+	
+	xSemaphoreTake(ps_lock, portMAX_DELAY);
+	st.mode = ps_mode;
+	st.cfg = ps_cfg;
+	st.switches = ps_switches;
+	portENTER_CRITICAL(&ps_mux);
+	memcpy(acc, ps_acc, sizeof(acc));
+	portEXIT_CRITICAL(&ps_mux);
+	acc[ps_mode].time_us += now - ps_mode_start;
+	xSemaphoreGive(ps_lock);
+	
+	for(i = 0; i < PS_MODES; i++)
+	{
+		st.m[i].entries = acc[i].entries;
+		st.m[i].time_ms = acc[i].time_us / 1000;
+		st.m[i].requests = acc[i].requests;
+		st.m[i].lat_avg_us = acc[i].requests ? acc[i].lat_sum_us / acc[i].requests : 0;
+		st.m[i].lat_max_us = acc[i].lat_max_us;
+	}
+	
+	memcpy(buf, &st, sizeof(ps_stats_t));
+	return sizeof(ps_stats_t);
+}
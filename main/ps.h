@@ -0,0 +1,53 @@
+/*
+ * ps.h - Wi-Fi power-save governor
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __PS__
+#define __PS__
+
+#include "main.h"
+
+#define PS_AUTO				0xFFFFFFFF	// pin value that lets the governor decide
+#define PS_KEEP				0xFFFFFFFF	// config field left as it is
+#define PS_MODES			3			// WIFI_PS_NONE, MIN_MODEM, MAX_MODEM
+#define PS_TICK_MS			100
+
+/* governor settings - kept in NVS */
+typedef struct
+{
+	uint32_t pin;			// PS_AUTO or a wifi_ps_type_t to hold
+	uint32_t idle_mode;		// wifi_ps_type_t used once idle
+	uint32_t idle_ms;		// quiet time before dropping to idle_mode
+	uint32_t boost_bps;		// traffic rate that wakes the radio
+} ps_config_t;
+
+/* per mode part of the statistics */
+typedef struct
+{
+	uint32_t entries;		// times switched into this mode
+	uint32_t time_ms;		// time spent in it
+	uint32_t requests;		// requests handled in it
+	uint32_t lat_avg_us;	// average receive to reply time
+	uint32_t lat_max_us;	// worst receive to reply time
+} ps_mode_stats_t;
+
+/* statistics as reported by ps_stats() */
+typedef struct
+{
+	uint32_t mode;			// current wifi_ps_type_t
+	ps_config_t cfg;
+	uint32_t switches;		// mode changes
+	ps_mode_stats_t m[PS_MODES];
+} ps_stats_t;
+
+esp_err_t ps_init(void);
+void ps_traffic(uint32_t bytes);
+void ps_connect(void);
+void ps_request(uint32_t lat_us);
+esp_err_t ps_config(const ps_config_t *cfg);
+uint32_t ps_get(ps_config_t *cfg);
+int ps_stats(uint8_t *buf, int max);
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * psram.c - PSRAM operations run on the board so clearing, moving or
+ * checking a region doesn't mean sending it over the network.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "psram.h"
+#include "ice.h"
+#include "pool.h"
+#include "rom/crc.h"
+
+static const char *TAG = "psram";
+
+#define PSRAM_CHUNK			POOL_MED_SZ
+
+/*
+ * check a region fits in the part
+ */
+static int psram_range(uint32_t addr, uint32_t len)
+{
+	return (addr <= ICE_PSRAM_SZ) && (len <= ICE_PSRAM_SZ - addr);
+}
+
+/*
+ * repeat a pattern over [addr, addr+len) - the pattern starts at addr
+ */
+esp_err_t psram_fill(uint32_t addr, uint32_t len, const uint8_t *pat, uint32_t plen)
+{
+	uint8_t *buf;
+	uint32_t i, n, chunk;
+	
+	if(!psram_range(addr, len) || !plen || (plen > PSRAM_PAT_MAX))
+		return ESP_ERR_INVALID_ARG;
+	if(!(buf = pool_alloc(PSRAM_CHUNK)))
+		return ESP_ERR_NO_MEM;
+	
+	/* whole patterns per chunk so each one carries on where the last ended */
+	chunk = PSRAM_CHUNK - (PSRAM_CHUNK % plen);
+	for(i = 0; i < chunk; i += plen)
+		memcpy(buf + i, pat, plen);
+	
+	while(len)
+	{
+		n = (len > chunk) ? chunk : len;
+		ICE_PSRAM_Write(addr, buf, n);
+		addr += n;
+		len -= n;
+	}
+	
+	pool_free(buf);
+	return ESP_OK;
+}
+
+/*
+ * move [src, src+len) to dst - overlapping regions work like memmove()
+ */
+esp_err_t psram_copy(uint32_t dst, uint32_t src, uint32_t len)
+{
+	uint8_t *buf;
+	uint32_t n;
+	int down = (dst > src) && (dst < src + len);
+	
+	if(!psram_range(src, len) || !psram_range(dst, len))
+		return ESP_ERR_INVALID_ARG;
+	if(!(buf = pool_alloc(PSRAM_CHUNK)))
+		return ESP_ERR_NO_MEM;
+	
+	/* a forward copy into a later overlapping region starts at the top */
+	while(len)
+	{
+		n = (len > PSRAM_CHUNK) ? PSRAM_CHUNK : len;
+		len -= n;
+		if(down)
+		{
+			ICE_PSRAM_Read(src + len, buf, n);
+			ICE_PSRAM_Write(dst + len, buf, n);
+		}
+		else
+		{
+			ICE_PSRAM_Read(src, buf, n);
+			ICE_PSRAM_Write(dst, buf, n);
+			src += n;
+			dst += n;
+		}
+	}
+	
+	pool_free(buf);
+	return ESP_OK;
+}
+
+/*
+ * CRC32 of [addr, addr+len) as crc32_le(0, ...) would give. Each chunk is
+ * summed while the DMA for the next is running.
+ */
+esp_err_t psram_crc(uint32_t addr, uint32_t len, uint32_t *crc)
+{
+	uint8_t *buf[2];
+	uint32_t n, next;
+	int cur = 0;
+	esp_err_t ret = ESP_OK;
+	
+	*crc = 0;
+	if(!psram_range(addr, len))
+		return ESP_ERR_INVALID_ARG;
+	buf[0] = pool_alloc(PSRAM_CHUNK);
+	buf[1] = pool_alloc(PSRAM_CHUNK);
+	if(!buf[0] || !buf[1])
+	{
+		ESP_LOGW(TAG, "CRC error - couldn't alloc buffers");
+		ret = ESP_ERR_NO_MEM;
+		goto done;
+	}
+	
+	n = (len > PSRAM_CHUNK) ? PSRAM_CHUNK : len;
+	if(n)
+		ICE_PSRAM_Read_Start(addr, buf[cur], n);
+	while(n)
+	{
+		ICE_Read_Wait();
+		addr += n;
+		len -= n;
+		
+		next = (len > PSRAM_CHUNK) ? PSRAM_CHUNK : len;
+		if(next)
+			ICE_PSRAM_Read_Start(addr, buf[cur ^ 1], next);
+		*crc = crc32_le(*crc, buf[cur], n);
+		cur ^= 1;
+		n = next;
+	}
+	
+done:
+	pool_free(buf[0]);
+	pool_free(buf[1]);
+	return ret;
+}
@@ -0,0 +1,18 @@
+/*
+ * psram.h - PSRAM operations run on the board
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __PSRAM__
+#define __PSRAM__
+
+#include "main.h"
+
+#define PSRAM_PAT_MAX		256		// longest fill pattern
+
+esp_err_t psram_fill(uint32_t addr, uint32_t len, const uint8_t *pat, uint32_t plen);
+esp_err_t psram_copy(uint32_t dst, uint32_t src, uint32_t len);
+esp_err_t psram_crc(uint32_t addr, uint32_t len, uint32_t *crc);
+
+#endif
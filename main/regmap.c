@@ -0,0 +1,178 @@
+/*
+ * regmap.c - RAM shadow of the FPGA registers a client declares cacheable
+ * or write-only. Writes go through to the hardware and the shadow, reads
+ * of those registers come from the shadow so polling configuration state
+ * costs no SPI traffic. Everything else reads the hardware as before.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "regmap.h"
+#include "ice.h"
+
+static const char *TAG = "regmap";
+
+static uint8_t regmap_cls[REGMAP_REGS];
+static uint32_t regmap_val[REGMAP_REGS];
+static uint32_t regmap_valid[REGMAP_REGS/32];
+static regmap_stats_t regmap_st;
+static portMUX_TYPE regmap_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+ * replace the map - registers not in it are volatile. The shadow starts
+ * out empty.
+ */
+esp_err_t regmap_load(const regmap_range_t *map, uint32_t n)
+{
+	uint8_t cls[REGMAP_REGS];
+	uint32_t i, j, cached = 0, wronly = 0;
+	
+	memset(cls, REGMAP_VOLATILE, sizeof(cls));
+	for(i = 0; i < n; i++)
+	{
+		if((map[i].first >= REGMAP_REGS) || (map[i].count > REGMAP_REGS - map[i].first) ||
+			(map[i].cls >= REGMAP_CLASSES))
+		{
+			ESP_LOGW(TAG, "Bad range %d: %d + %d class %d", i, map[i].first, map[i].count, map[i].cls);
+			return ESP_ERR_INVALID_ARG;
+		}
+		for(j = 0; j < map[i].count; j++)
+			cls[map[i].first + j] = map[i].cls;
+	}
+	
+	for(i = 0; i < REGMAP_REGS; i++)
+	{
+		cached += (cls[i] == REGMAP_CACHED);
+		wronly += (cls[i] == REGMAP_WRONLY);
+	}
+	
+	portENTER_CRITICAL(&regmap_mux);
+	memcpy(regmap_cls, cls, sizeof(cls));
+	memset(regmap_valid, 0, sizeof(regmap_valid));
+	regmap_st.loads++;
+	regmap_st.invalidates++;
+	regmap_st.cached = cached;
+	regmap_st.wronly = wronly;
+	portEXIT_CRITICAL(&regmap_mux);
+	
+	ESP_LOGI(TAG, "Loaded %d ranges - %d cached, %d write-only", n, cached, wronly);
+	return ESP_OK;
+}
+
+/*
+ * read a register, from the shadow if it has it
+ */
+void regmap_read(uint8_t reg, uint32_t *data)
+{
+	uint32_t bit;
+	int hit;
+	
+	reg &= 0x7f;
+	bit = 1 << (reg & 31);
+	portENTER_CRITICAL(&regmap_mux);
+	if((hit = (regmap_cls[reg] == REGMAP_WRONLY) ||
+		((regmap_cls[reg] == REGMAP_CACHED) && (regmap_valid[reg >> 5] & bit))))
+	{
+		/* write-only reads back what was written, 0 before that */
+		*data = (regmap_valid[reg >> 5] & bit) ? regmap_val[reg] : 0;
+		regmap_st.hits++;
+	}
+	portEXIT_CRITICAL(&regmap_mux);
+	if(hit)
+		return;
+	
+	ICE_FPGA_Serial_Read(reg, data);
+	
+	portENTER_CRITICAL(&regmap_mux);
+	if(regmap_cls[reg] == REGMAP_CACHED)
+	{
+		regmap_val[reg] = *data;
+		regmap_valid[reg >> 5] |= bit;
+		regmap_st.misses++;
+	}
+	else
+		regmap_st.reads++;
+	portEXIT_CRITICAL(&regmap_mux);
+}
+
+/*
+ * write a register through to the hardware
+ */
+void regmap_write(uint8_t reg, uint32_t data)
+{
+	reg &= 0x7f;
+	ICE_FPGA_Serial_Write(reg, data);
+	
+	portENTER_CRITICAL(&regmap_mux);
+	if(regmap_cls[reg] != REGMAP_VOLATILE)
+	{
+		regmap_val[reg] = data;
+		regmap_valid[reg >> 5] |= 1 << (reg & 31);
+	}
+	regmap_st.writes++;
+	portEXIT_CRITICAL(&regmap_mux);
+}
+
+/*
+ * forget every shadowed value - the FPGA was configured
+ */
+void regmap_invalidate(void)
+{
+	portENTER_CRITICAL(&regmap_mux);
+	memset(regmap_valid, 0, sizeof(regmap_valid));
+	regmap_st.invalidates++;
+	portEXIT_CRITICAL(&regmap_mux);
+}
+
+/*
+ * forget one value - it was written around the shadow
+ */
+void regmap_drop(uint8_t reg)
+{
+	reg &= 0x7f;
+	portENTER_CRITICAL(&regmap_mux);
+	regmap_valid[reg >> 5] &= ~(1 << (reg & 31));
+	portEXIT_CRITICAL(&regmap_mux);
+}
+
+/*
+ * copy out the map and shadow, returns bytes used
+ */
+int regmap_dump(uint8_t *buf, int max)
+{
+	/* buf needn't be aligned */
+	if(max < sizeof(regmap_dump_t))
+		return 0;
+	
+	portENTER_CRITICAL(&regmap_mux);
+	memcpy(buf + offsetof(regmap_dump_t, valid), regmap_valid, sizeof(regmap_valid));
+	memcpy(buf + offsetof(regmap_dump_t, cls), regmap_cls, sizeof(regmap_cls));
+	memcpy(buf + offsetof(regmap_dump_t, value), regmap_val, sizeof(regmap_val));
+	portEXIT_CRITICAL(&regmap_mux);
+	
+	return sizeof(regmap_dump_t);
+}
+
+/*
+ * copy out statistics, returns bytes used
+ */
+int regmap_stats(uint8_t *buf, int max)
+{
+	regmap_stats_t st;
+	int i;
+	
+	if(max < sizeof(regmap_stats_t))
+		return 0;
+	
+	portENTER_CRITICAL(&regmap_mux);
+	st = regmap_st;
+	st.valid = 0;
+	for(i = 0; i < REGMAP_REGS/32; i++)
+		st.valid += __builtin_popcount(regmap_valid[i]);
+	portEXIT_CRITICAL(&regmap_mux);
+	
+	memcpy(buf, &st, sizeof(regmap_stats_t));
+	return sizeof(regmap_stats_t);
+}
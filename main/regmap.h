@@ -0,0 +1,58 @@
+/*
+ * regmap.h - shadow of the FPGA configuration registers
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __REGMAP__
+#define __REGMAP__
+
+#include "main.h"
+
+#define REGMAP_REGS			128
+
+/* register classes */
+#define REGMAP_VOLATILE		0	// always read the hardware - the default
+#define REGMAP_CACHED		1	// write-through, reads come from the shadow
+#define REGMAP_WRONLY		2	// never read back, reads return the last write
+#define REGMAP_CLASSES		3
+
+/* cmd 0x20 map entry - registers first to first+count-1 */
+typedef struct
+{
+	uint32_t first;
+	uint32_t count;
+	uint32_t cls;
+} regmap_range_t;
+
+/* cmd 0x21 reply */
+typedef struct
+{
+	uint32_t valid[REGMAP_REGS/32];		// shadow holds a value, one bit each
+	uint8_t cls[REGMAP_REGS];
+	uint32_t value[REGMAP_REGS];
+} regmap_dump_t;
+
+/* statistics as reported by regmap_stats() */
+typedef struct
+{
+	uint32_t hits;			// reads from the shadow
+	uint32_t misses;		// cached reads that went to the hardware
+	uint32_t reads;			// volatile reads
+	uint32_t writes;
+	uint32_t invalidates;	// shadow cleared by a config or map load
+	uint32_t loads;			// maps loaded
+	uint32_t cached;		// registers in each class
+	uint32_t wronly;
+	uint32_t valid;			// shadow entries holding a value
+} regmap_stats_t;
+
+esp_err_t regmap_load(const regmap_range_t *map, uint32_t n);
+void regmap_read(uint8_t reg, uint32_t *data);
+void regmap_write(uint8_t reg, uint32_t data);
+void regmap_invalidate(void);
+void regmap_drop(uint8_t reg);
+int regmap_dump(uint8_t *buf, int max);
+int regmap_stats(uint8_t *buf, int max);
+
+#endif
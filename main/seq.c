@@ -0,0 +1,345 @@
+/*
+ * seq.c - on-device FPGA command sequence engine. Runs uploaded register
+ * and PSRAM scripts in their own task, timing delays with a microsecond timer so
+ * they neither depend on the tick nor spin for long.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include "seq.h"
+#include "ice.h"
+#include "regmap.h"
+#include "spiffs.h"
+#include "pool.h"
+#include "rom/ets_sys.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+
+/* same as the executor - SPI work mustn't hold off lwIP or the socket */
+#define SEQ_TASK_PRIO	6
+
+/* the most a DELAY or WAIT busy-waits before sleeping */
+#define SEQ_SPIN_MAX_US	200
+
+static const char* TAG = "seq";
+static TaskHandle_t seq_task_handle;
+static SemaphoreHandle_t seq_mutex, seq_done, seq_wake_sem;
+static esp_timer_handle_t seq_timer;
+
+/* the job being run */
+static uint8_t *seq_prog;
+static uint32_t seq_len;
+static seq_result_t *seq_res;
+
+/*
+ * little-endian arg fetch - programs aren't aligned
+ */
+static uint32_t seq_get32(uint8_t *p)
+{
+	return p[0] | (p[1]<<8) | (p[2]<<16) | (p[3]<<24);
+}
+
+static uint16_t seq_get16(uint8_t *p)
+{
+	return p[0] | (p[1]<<8);
+}
+
+/*
+ * length of the instruction at pc, 0 if unknown or truncated
+ */
+static uint32_t seq_oplen(uint8_t *prog, uint32_t pc, uint32_t len)
+{
+	uint32_t sz;
+	
+	switch(prog[pc])
+	{
+		case SEQ_OP_END:
+		case SEQ_OP_NEXT:	sz = 1; break;
+		case SEQ_OP_WRITE:	sz = 6; break;
+		case SEQ_OP_READ:	sz = 3; break;
+		case SEQ_OP_WAIT:	sz = 14; break;
+		case SEQ_OP_DELAY:	sz = 5; break;
+		case SEQ_OP_LOOP:	sz = 3; break;
+		case SEQ_OP_PSRD:	sz = 7; break;
+		case SEQ_OP_PSWR:
+			if(pc + 7 > len)
+				return 0;
+			sz = 7 + seq_get16(&prog[pc+5]);
+			break;
+		default:			return 0;
+	}
+	
+	return (pc + sz <= len) ? sz : 0;
+}
+
+/*
+ * walk a program without running it. Returns SEQ_OK or the error and
+ * offset of the first bad instruction.
+ */
+uint32_t seq_check(uint8_t *prog, uint32_t len, uint32_t *pc)
+{
+	uint32_t sz, depth = 0;
+	
+	*pc = 0;
+	while(*pc < len)
+	{
+		if(!(sz = seq_oplen(prog, *pc, len)))
+			return (prog[*pc] <= SEQ_OP_PSRD) ? SEQ_ERR_TRUNC : SEQ_ERR_OPCODE;
+		
+		switch(prog[*pc])
+		{
+			case SEQ_OP_END:
+				return depth ? SEQ_ERR_LOOP : SEQ_OK;
+			case SEQ_OP_READ:
+				if(prog[*pc+2] >= SEQ_SLOTS)
+					return SEQ_ERR_SLOT;
+				break;
+			case SEQ_OP_LOOP:
+				if(++depth > SEQ_LOOP_DEPTH)
+					return SEQ_ERR_LOOP;
+				break;
+			case SEQ_OP_NEXT:
+				if(!depth--)
+					return SEQ_ERR_LOOP;
+				break;
+		}
+		*pc += sz;
+	}
+	
+	/* running off the end is an implicit END */
+	return depth ? SEQ_ERR_LOOP : SEQ_OK;
+}
+
+/*
+ * timer callback - end of the sleeping part of a DELAY
+ */
+static void seq_wake(void *arg)
+{
+	xSemaphoreGive(seq_wake_sem);
+}
+
+/*
+ * delay to an absolute deadline - sleep on the timer until just short of
+ * it, spin the rest
+ */
+static void seq_delay(uint32_t us)
+{
+	int64_t deadline = esp_timer_get_time() + us;
+	
+	if(us > SEQ_SPIN_MAX_US)
+	{
+		esp_timer_start_once(seq_timer, us - SEQ_SPIN_MAX_US);
+		xSemaphoreTake(seq_wake_sem, portMAX_DELAY);
+	}
+	
+	while(esp_timer_get_time() < deadline)
+	{
+	}
+}
+
+/*
+ * poll a register - spin briefly for a quick answer, then once a tick
+ */
+static uint8_t seq_wait(uint8_t *p)
+{
+	uint32_t timeout = seq_get32(&p[10]), Data, iters, elapsed;
+	
+	if(!ICE_FPGA_Serial_Wait(p[1], seq_get32(&p[2]), seq_get32(&p[6]), 0,
+		(timeout < SEQ_SPIN_MAX_US) ? timeout : SEQ_SPIN_MAX_US, &Data, &iters, &elapsed))
+		return 0;
+	if(timeout <= elapsed)
+		return 1;
+	
+	return ICE_FPGA_Serial_Wait(p[1], seq_get32(&p[2]), seq_get32(&p[6]),
+		portTICK_PERIOD_MS * 1000, timeout - elapsed, &Data, &iters, &elapsed);
+}
+
+/*
+ * find the instruction after the NEXT matching the LOOP at pc
+ */
+static uint32_t seq_skip_loop(uint8_t *prog, uint32_t pc, uint32_t len)
+{
+	uint32_t depth = 0;
+	
+	do
+	{
+		if(prog[pc] == SEQ_OP_LOOP)
+			depth++;
+		else if(prog[pc] == SEQ_OP_NEXT)
+			depth--;
+		pc += seq_oplen(prog, pc, len);
+	}
+	while(depth);
+	
+	return pc;
+}
+
+/*
+ * execute a checked program
+ */
+static uint32_t seq_exec(uint8_t *prog, uint32_t len, seq_result_t *res)
+{
+	uint32_t pc = 0, sz, count;
+	uint32_t loop_pc[SEQ_LOOP_DEPTH], loop_left[SEQ_LOOP_DEPTH];
+	int depth = 0;
+	uint8_t *p;
+	
+	while(pc < len)
+	{
+		p = &prog[pc];
+		sz = seq_oplen(prog, pc, len);
+		res->pc = pc;
+		
+		switch(p[0])
+		{
+			case SEQ_OP_END:
+				return SEQ_OK;
+			
+			case SEQ_OP_WRITE:
+				regmap_write(p[1], seq_get32(&p[2]));
+				break;
+			
+			case SEQ_OP_READ:
+				regmap_read(p[1], &res->slots[p[2]]);
+				break;
+			
+			case SEQ_OP_WAIT:
+				if(seq_wait(p))
+					return SEQ_ERR_TIMEOUT;
+				break;
+			
+			case SEQ_OP_DELAY:
+				seq_delay(seq_get32(&p[1]));
+				break;
+			
+			case SEQ_OP_LOOP:
+				if(!(count = seq_get16(&p[1])))
+				{
+					pc = seq_skip_loop(prog, pc, len);
+					continue;
+				}
+				loop_pc[depth] = pc + sz;
+				loop_left[depth] = count;
+				depth++;
+				break;
+			
+			case SEQ_OP_NEXT:
+				if(--loop_left[depth-1])
+				{
+					pc = loop_pc[depth-1];
+					continue;
+				}
+				depth--;
+				break;
+			
+			case SEQ_OP_PSWR:
+				ICE_PSRAM_Write(seq_get32(&p[1]), &p[7], seq_get16(&p[5]));
+				break;
+			
+			case SEQ_OP_PSRD:
+				count = seq_get16(&p[5]);
+				if(res->rdlen + count > res->rdmax)
+					return SEQ_ERR_RDBUF;
+				ICE_PSRAM_Read(seq_get32(&p[1]), res->rdbuf + res->rdlen, count);
+				res->rdlen += count;
+				break;
+		}
+		pc += sz;
+	}
+	
+	return SEQ_OK;
+}
+
+/*
+ * run jobs handed over by seq_run()
+ */
+static void seq_task(void *pvParameters)
+{
+	int64_t start;
+	
+	while(1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		
+		start = esp_timer_get_time();
+		seq_res->status = seq_exec(seq_prog, seq_len, seq_res);
+		seq_res->elapsed_us = esp_timer_get_time() - start;
+		
+		xSemaphoreGive(seq_done);
+	}
+}
+
+/*
+ * start the sequence task
+ */
+esp_err_t seq_init(void)
+{
+	esp_timer_create_args_t args = {
+		.callback = seq_wake,
+		.name = "seq",
+	};
+	
+	seq_mutex = xSemaphoreCreateMutex();
+	seq_done = xSemaphoreCreateBinary();
+	seq_wake_sem = xSemaphoreCreateBinary();
+	if(!seq_mutex || !seq_done || !seq_wake_sem || (esp_timer_create(&args, &seq_timer) != ESP_OK))
+		return ESP_FAIL;
+	if(xTaskCreate(seq_task, "seq", 3072, NULL, SEQ_TASK_PRIO, &seq_task_handle) != pdPASS)
+		return ESP_FAIL;
+	
+	return ESP_OK;
+}
+
+/*
+ * check and run a program, blocking until done
+ */
+uint32_t seq_run(uint8_t *prog, uint32_t len, seq_result_t *res)
+{
+	res->rdlen = 0;
+	res->elapsed_us = 0;
+	memset(res->slots, 0, sizeof(res->slots));
+	if((res->status = seq_check(prog, len, &res->pc)) != SEQ_OK)
+	{
+		ESP_LOGW(TAG, "Bad program - status %d at %d", res->status, res->pc);
+		return res->status;
+	}
+	
+	xSemaphoreTake(seq_mutex, portMAX_DELAY);
+	seq_prog = prog;
+	seq_len = len;
+	seq_res = res;
+	xTaskNotifyGive(seq_task_handle);
+	xSemaphoreTake(seq_done, portMAX_DELAY);
+	xSemaphoreGive(seq_mutex);
+	
+	if(res->status != SEQ_OK)
+		ESP_LOGW(TAG, "Failed - status %d at %d", res->status, res->pc);
+	
+	return res->status;
+}
+
+/*
+ * run a program stored in a file, ESP_ERR_NOT_FOUND if there isn't one
+ */
+esp_err_t seq_run_file(char *fname, seq_result_t *res)
+{
+	struct stat st;
+	uint8_t *prog = NULL;
+	uint32_t len;
+	esp_err_t ret;
+	
+	if(stat(fname, &st))
+		return ESP_ERR_NOT_FOUND;
+	
+	if(!(ret = spiffs_read(fname, &prog, &len)))
+	{
+		ESP_LOGI(TAG, "Running %s", fname);
+		ret = seq_run(prog, len, res) ? ESP_FAIL : ESP_OK;
+	}
+	if(prog)
+		pool_free(prog);
+	
+	return ret;
+}
@@ -0,0 +1,57 @@
+/*
+ * seq.h - on-device FPGA command sequence engine
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __SEQ__
+#define __SEQ__
+
+#include "main.h"
+
+/*
+ * Sequence opcodes. Programs are a byte stream, multi-byte args are
+ * little-endian.
+ */
+#define SEQ_OP_END		0x00	// -
+#define SEQ_OP_WRITE	0x01	// reg(1) data(4)
+#define SEQ_OP_READ		0x02	// reg(1) slot(1)
+#define SEQ_OP_WAIT		0x03	// reg(1) mask(4) expect(4) timeout_us(4) - polled each tick after 200 us
+#define SEQ_OP_DELAY	0x04	// us(4)
+#define SEQ_OP_LOOP		0x05	// count(2) - repeat up to matching NEXT
+#define SEQ_OP_NEXT		0x06	// -
+#define SEQ_OP_PSWR		0x07	// addr(4) len(2) data(len)
+#define SEQ_OP_PSRD		0x08	// addr(4) len(2) - appended to read data
+
+#define SEQ_SLOTS		16
+#define SEQ_LOOP_DEPTH	4
+#define SEQ_RDBUF_MAX	4096
+
+/* completion status */
+#define SEQ_OK			0
+#define SEQ_ERR_OPCODE	1
+#define SEQ_ERR_TRUNC	2
+#define SEQ_ERR_LOOP	3
+#define SEQ_ERR_SLOT	4
+#define SEQ_ERR_TIMEOUT	5
+#define SEQ_ERR_RDBUF	6
+
+#define SEQ_BOOT_FILE	"/spiffs/boot.seq"
+
+typedef struct
+{
+	uint32_t status;			// SEQ_OK or SEQ_ERR_*
+	uint32_t pc;				// offset of the failing instruction
+	uint32_t elapsed_us;		// total run time
+	uint32_t slots[SEQ_SLOTS];	// READ results
+	uint32_t rdlen;				// bytes of PSRD data in rdbuf
+	uint8_t *rdbuf;				// caller supplied, rdmax bytes
+	uint32_t rdmax;
+} seq_result_t;
+
+esp_err_t seq_init(void);
+uint32_t seq_check(uint8_t *prog, uint32_t len, uint32_t *pc);
+uint32_t seq_run(uint8_t *prog, uint32_t len, seq_result_t *res);
+esp_err_t seq_run_file(char *fname, seq_result_t *res);
+
+#endif
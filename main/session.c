@@ -0,0 +1,202 @@
+/*
+ * session.c - records one socket connection: every recv() and send() with
+ * its boundaries and time, and what the parser made of it. The capture is
+ * read out with cmd 0x16 and fed back through proto.c by the host replay
+ * tool, so segmentation problems can be reproduced off the board.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "session.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "session";
+
+static SemaphoreHandle_t session_lock;
+static uint8_t *session_buf;
+static session_stat_t session_st;
+static int64_t session_t0;
+
+/* socket being recorded - checked unlocked so idle sockets pay one compare */
+static volatile int session_sock = -1;
+
+/*
+ * stop recording. Call locked.
+ */
+static void session_stop(void)
+{
+	if(session_st.state == SESSION_RECORDING)
+		ESP_LOGI(TAG, "Captured %d records, %d bytes", session_st.records, session_st.used);
+	session_sock = -1;
+	session_st.state = session_buf ? SESSION_DONE : SESSION_IDLE;
+}
+
+/*
+ * add a record - gives up on the whole capture once it's full
+ */
+static void session_put(int sock, uint32_t type, const void *data, uint32_t len)
+{
+	session_rec_t rec = {esp_timer_get_time() - session_t0, type, len};
+	uint32_t sz = sizeof(session_rec_t) + ((len + 3) & ~3);
+	
+	xSemaphoreTake(session_lock, portMAX_DELAY);
+	if(sock == session_sock)
+	{
+		if(session_st.used + sz > session_st.size)
+		{
+			ESP_LOGW(TAG, "Capture full");
+			session_st.flags |= SESSION_OVERFLOW;
+			session_stop();
+		}
+		else
+		{
+			memcpy(session_buf + session_st.used, &rec, sizeof(session_rec_t));
+			memcpy(session_buf + session_st.used + sizeof(session_rec_t), data, len);
+			session_st.used += sz;
+			session_st.records++;
+		}
+	}
+	xSemaphoreGive(session_lock);
+}
+
+/*
+ * set up - nothing is allocated until a capture is armed
+ */
+esp_err_t session_init(void)
+{
+	if(!(session_lock = xSemaphoreCreateMutex()))
+		return ESP_ERR_NO_MEM;
+	
+	return ESP_OK;
+}
+
+/*
+ * a connection came in - record it if armed
+ */
+void session_accept(int sock)
+{
+	xSemaphoreTake(session_lock, portMAX_DELAY);
+	if(session_st.state == SESSION_ARMED)
+	{
+		ESP_LOGI(TAG, "Recording socket %d", sock);
+		session_st.state = SESSION_RECORDING;
+		session_t0 = esp_timer_get_time();
+		session_sock = sock;
+	}
+	xSemaphoreGive(session_lock);
+}
+
+/*
+ * bytes from one recv()
+ */
+void session_rx(int sock, const void *buf, int len)
+{
+	if((sock == session_sock) && (len > 0))
+		session_put(sock, SESSION_RX, buf, len);
+}
+
+/*
+ * bytes from one send()
+ */
+void session_tx(int sock, const void *buf, int len)
+{
+	if((sock == session_sock) && (len > 0))
+		session_put(sock, SESSION_TX, buf, len);
+}
+
+/*
+ * what the parser found
+ */
+void session_msg(int sock, uint32_t type, const proto_hdr_t *hdr)
+{
+	if(sock == session_sock)
+		session_put(sock, type, hdr, hdr ? sizeof(proto_hdr_t) : 0);
+}
+
+/*
+ * connection finished
+ */
+void session_close(int sock)
+{
+	if(sock != session_sock)
+		return;
+	
+	session_put(sock, SESSION_CLOSE, NULL, 0);
+	xSemaphoreTake(session_lock, portMAX_DELAY);
+	if(sock == session_sock)
+		session_stop();
+	xSemaphoreGive(session_lock);
+}
+
+/*
+ * cmd 0x16: op, args. Reply is a session_stat_t, plus the data for a read.
+ * Returns the reply size or -1 for a bad request.
+ */
+int session_ctl(const uint32_t *args, int nargs, uint8_t *buf, int max)
+{
+	session_file_t hdr = {SESSION_MAGIC, SESSION_VERSION, sizeof(session_rec_t)};
+	uint32_t op = nargs ? args[0] : SESSION_OP_STATUS, off, len = 0, size;
+	int ret = 0;
+	
+	if(max < sizeof(session_stat_t))
+		return -1;
+	
+	xSemaphoreTake(session_lock, portMAX_DELAY);
+	if((op == SESSION_OP_ARM) || (op == SESSION_OP_FREE))
+	{
+		session_sock = -1;
+		heap_caps_free(session_buf);
+		session_buf = NULL;
+		memset(&session_st, 0, sizeof(session_stat_t));
+		
+		if(op == SESSION_OP_ARM)
+		{
+			size = (nargs > 1) ? args[1] : SESSION_MAX_SZ;
+			if(size > SESSION_MAX_SZ)
+				size = SESSION_MAX_SZ;
+			if((size < sizeof(session_file_t)) ||
+				!(session_buf = heap_caps_malloc(size, MALLOC_CAP_8BIT)))
+			{
+				ESP_LOGW(TAG, "Couldn't alloc %d", size);
+				ret = -1;
+			}
+			else
+			{
+				memcpy(session_buf, &hdr, sizeof(session_file_t));
+				session_st.used = sizeof(session_file_t);
+				session_st.size = size;
+				session_st.state = SESSION_ARMED;
+			}
+		}
+	}
+	else if(op == SESSION_OP_STOP)
+	{
+		if(session_st.state == SESSION_ARMED)
+			session_st.state = SESSION_IDLE;
+		else if(session_st.state == SESSION_RECORDING)
+			session_stop();
+	}
+	else if(op == SESSION_OP_READ)
+	{
+		off = (nargs > 1) ? args[1] : 0;
+		len = (nargs > 2) ? args[2] : 0;
+		if(off > session_st.used)
+			off = session_st.used;
+		if(len > session_st.used - off)
+			len = session_st.used - off;
+		if(len > max - sizeof(session_stat_t))
+			len = max - sizeof(session_stat_t);
+		if(len)
+			memcpy(buf + sizeof(session_stat_t), session_buf + off, len);
+	}
+	else if(op != SESSION_OP_STATUS)
+		ret = -1;
+	
+	memcpy(buf, &session_st, sizeof(session_stat_t));
+	xSemaphoreGive(session_lock);
+	
+	return ret ? ret : sizeof(session_stat_t) + len;
+}
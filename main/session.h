@@ -0,0 +1,31 @@
+/*
+ * session.h - socket session capture for replay on the host
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __SESSION__
+#define __SESSION__
+
+#include "main.h"
+#include "proto.h"
+#include "session_fmt.h"
+
+#define SESSION_MAX_SZ		(64*1024)
+
+/* cmd 0x16 ops */
+#define SESSION_OP_ARM		0	// size - record the next connection
+#define SESSION_OP_STOP		1
+#define SESSION_OP_READ		2	// offset, len
+#define SESSION_OP_STATUS	3
+#define SESSION_OP_FREE		4
+
+esp_err_t session_init(void);
+void session_accept(int sock);
+void session_rx(int sock, const void *buf, int len);
+void session_tx(int sock, const void *buf, int len);
+void session_msg(int sock, uint32_t type, const proto_hdr_t *hdr);
+void session_close(int sock);
+int session_ctl(const uint32_t *args, int nargs, uint8_t *buf, int max);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * session_fmt.h - layout of a captured socket session. Plain C so the
+ * host replay tool can read it.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ *
+ * A capture is a session_file_t then records, each a session_rec_t and
+ * len bytes of data padded to a multiple of 4. All little-endian.
+ */
+
+#ifndef __SESSION_FMT__
+#define __SESSION_FMT__
+
+#include <stdint.h>
+
+#define SESSION_MAGIC		0xCAFE5E55
+#define SESSION_VERSION		1
+
+/* record types */
+#define SESSION_RX			0	// bytes from one recv()
+#define SESSION_TX			1	// bytes from one send()
+#define SESSION_MSG			2	// parser found a message - data is proto_hdr_t
+#define SESSION_STREAM		3	// parser found a streaming cmd - data is proto_hdr_t
+#define SESSION_BAD			4	// parser gave up on the connection
+#define SESSION_CLOSE		5	// connection finished
+
+/* bits of session_stat_t.flags */
+#define SESSION_OVERFLOW	1	// ran out of room, recording stopped early
+
+/* capture states */
+#define SESSION_IDLE		0
+#define SESSION_ARMED		1	// waiting for the next connection
+#define SESSION_RECORDING	2
+#define SESSION_DONE		3
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rec_sz;		// sizeof(session_rec_t)
+} session_file_t;
+
+typedef struct
+{
+	uint32_t ts_us;			// since the connection was accepted
+	uint32_t type;
+	uint32_t len;
+} session_rec_t;
+
+/* status that starts every cmd 0x16 reply */
+typedef struct
+{
+	uint32_t state;
+	uint32_t used;			// bytes of capture including the session_file_t
+	uint32_t size;			// capture buffer size
+	uint32_t flags;
+	uint32_t records;
+} session_stat_t;
+
+#endif
@@ -15,11 +15,29 @@
 #include "lwip/sys.h"
 #include "lwip/sockets.h"
 #include "lwip/netdb.h"
-#include "rom/crc.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
 #include "ice.h"
 #include "spiffs.h"
 #include "phy.h"
 #include "adc_c3.h"
+#include "event.h"
+#include "seq.h"
+#include "stream.h"
+#include "pool.h"
+#include "ota.h"
+#include "cache.h"
+#include "session.h"
+#include "psram.h"
+#include "persist.h"
+#include "timesync.h"
+#include "bitstream.h"
+#include "regmap.h"
+#include "ps.h"
+#include "trace.h"
+#include "bench.h"
+#include "nettest.h"
 
 static const char *TAG = "socket";
 
@@ -27,86 +45,655 @@ static const char *TAG = "socket";
 #define KEEPALIVE_IDLE              5
 #define KEEPALIVE_INTERVAL          5
 #define KEEPALIVE_COUNT             3
+#define SOCKET_RX_SZ				512
+#define EXEC_QUEUE_LEN				8
+#define EXEC_STACK					4096
+#define EXEC_PRIO					6		// above the network task
+#define EXEC_FENCE					0x100	// not a wire cmd
+#define PERSIST_WAIT_MAX_MS			10000
+#define REG_WAIT_MAX_US				10000000	// cmd 4 holds up the executor
+#define REG_WAIT_SPIN_MAX_US		10000		// longest wait polled faster than a tick
+
+/* request queued for the SPI executor - buffer is NULL if alloc failed */
+typedef struct
+{
+	socket_req_t req;
+	uint32_t cmd;
+	char *buffer;
+	int64_t rx_us;		// when the message was complete
+} exec_req_t;
+
+static QueueHandle_t exec_queue;
+static SemaphoreHandle_t exec_fence_sem;
+static char *exec_kept;		// body a command handed on instead of freeing
+
+/*
+ * send a whole buffer
+ */
+int socket_send(const int sock, const void *buf, int len)
+{
+	const char *wbuf = buf;
+	
+	// send() can return less bytes than supplied length.
+	// Walk-around for robust implementation.
+	while (len > 0) {
+		int written = send(sock, wbuf, len, 0);
+		if (written < 0) {
+			ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+			return -1;
+		}
+		session_tx(sock, wbuf, written);
+		len -= written;
+		wbuf += written;
+		ps_traffic(written);
+	}
+	
+	return 0;
+}
+
+/*
+ * send the tag and length that start a tagged reply - len includes the
+ * err byte. Nothing for legacy requests.
+ */
+int socket_reply_hdr(const socket_req_t *req, uint32_t len)
+{
+	uint8_t hdr[8];
+	int sz = proto_reply_hdr(&req->hdr, len, hdr);
+	
+	return sz ? socket_send(req->sock, hdr, sz) : 0;
+}
+
+/*
+ * send a whole reply - buf starts with the err byte
+ */
+int socket_reply(const socket_req_t *req, const void *buf, int len)
+{
+	if(socket_reply_hdr(req, len))
+		return -1;
+	
+	return socket_send(req->sock, buf, len);
+}
+
+/*
+ * receive up to len bytes for a streaming command. Returns the count,
+ * 0 if closed or <0 on error.
+ */
+int socket_recv(socket_rx_t *rx, void *buf, int len)
+{
+	int sz;
+	
+	if(rx->prelen)
+	{
+		sz = (len < rx->prelen) ? len : rx->prelen;
+		memcpy(buf, rx->pre, sz);
+		rx->pre += sz;
+		rx->prelen -= sz;
+		return sz;
+	}
+	
+	if((sz = recv(rx->req->sock, buf, len, 0)) < 0)
+		ESP_LOGE(TAG, "Error occurred during receiving: errno %d", errno);
+	else
+	{
+		session_rx(rx->req->sock, buf, sz);
+		ps_traffic(sz);
+	}
+	
+	return sz;
+}
+
+/*
+ * save configuration to the filesystem as it arrives
+ */
+static void socket_save(socket_rx_t *rx, char *err, uint32_t txsz)
+{
+	spiffs_wr_t *wr;
+	bitstream_t bs;
+	uint8_t *buf = pool_alloc(POOL_SMALL_SZ), dump[64];
+	uint32_t left = txsz, sz = buf ? POOL_SMALL_SZ : sizeof(dump);
+	int len;
+	
+	bitstream_begin(&bs);
+	
+	/* a background write still going would land on top of this one */
+	persist_wait(portMAX_DELAY);
+	wr = spiffs_write_open((char *)cfg_file);
+	if(!wr || !buf)
+		*err |= 8;
+	
+	while(left)
+	{
+		if((len = socket_recv(rx, buf ? buf : dump, (left < sz) ? left : sz)) <= 0)
+			break;
+		left -= len;
+		
+		/* checked on the way in - a bad one is drained but not written */
+		if(!*err && bitstream_feed(&bs, buf, len))
+			*err |= 0x10;
+		if(!*err && spiffs_write_chunk(wr, buf, len))
+			*err |= 8;
+	}
+	
+	if(left)
+	{
+		ESP_LOGW(TAG, "Save: connection lost with %d left", left);
+		*err |= 8;
+	}
+	else if(!*err && bitstream_end(&bs))
+		*err |= 0x10;
+	
+	/* old file is untouched unless everything arrived, was good and was written */
+	if(!*err)
+		spiffs_keep((char *)cfg_file, (char *)cfg_bak_file);
+	if(wr && spiffs_write_close(wr, !*err))
+		*err |= 8;
+	cache_flash_changed();
+	pool_free(buf);
+	
+	if(*err)
+		ESP_LOGW(TAG, "SPIFFS Error - err = %d", *err);
+	else
+		ESP_LOGI(TAG, "SPIFFS wrote OK");
+	socket_reply(rx->req, err, 1);
+}
+
+/*
+ * handle a streaming command - the payload is read from the socket as
+ * it's used
+ */
+static void handle_stream(socket_rx_t *rx, char *err, char cmd, uint32_t txsz)
+{
+	if(cmd == 0xe)
+		socket_save(rx, err, txsz);
+	else if(cmd == 7)
+		stream_playback(rx, err, txsz);
+	else if(cmd == 9)
+		ota_update(rx, err, txsz);
+	else if(cmd == 0x13)
+		nettest_sink(rx, err, txsz);
+	else if(cmd == 0x15)
+		nettest_echo(rx, err, txsz);
+	else if(cmd == 0xc)
+		stream_psram_write(rx, err, txsz);
+}
+
+/*
+ * commands that can be run at a set time - ones that reply in the usual
+ * way and leave the socket alone
+ */
+static int socket_timed_ok(uint32_t cmd)
+{
+	return (cmd <= 1) || (cmd == 4) || (cmd == 5) || (cmd == 0xb) || (cmd == 0xc) ||
+		((cmd >= 0x17) && (cmd <= 0x1b));
+}
 
 /*
- * handle a message
+ * argument bytes a command can't do without
  */
-static void handle_message(const int sock, char *err, char cmd, char *buffer, int txsz)
+static int socket_min_args(char cmd)
+{
+	switch(cmd)
+	{
+		case 0:		// reg
+		case 3:		// reg
+		case 8:		// group
+		case 0xc:	// addr
+			return 4;
+		
+		case 1:		// reg, data
+		case 0xb:	// addr, len
+			return 8;
+		
+		default:
+			return 0;
+	}
+}
+
+/*
+ * handle a message - returns 1 if the socket was handed off and must be
+ * left open
+ */
+static int handle_message(const socket_req_t *req, char *err, char cmd, char *buffer, int txsz)
 {
 	uint32_t Data = 0;
-	char sbuf[5];
-	uint8_t *psram_rdbuf = NULL;
-	uint32_t psram_rdsz = 0;
+	char sbuf[32];
+	uint8_t *bigbuf = NULL;	// commands with large replies
+	uint32_t bigsz = 0;
+	int slot = -1, rplen = 0;
 	
-	if(cmd == 0xf)
+	if(txsz < socket_min_args(cmd))
 	{
-		/* send configuration to FPGA */
+		ESP_LOGW(TAG, "Cmd 0x%x: short args %d", cmd, txsz);
+		*err |= 8;
+	}
+	else if(cmd == 0xf)
+	{
+		/* send configuration to FPGA - a bad one leaves the running design */
 		uint8_t cfg_stat;	
-		if((cfg_stat = ICE_FPGA_Config((uint8_t *)buffer, txsz)))
+		if(bitstream_check((uint8_t *)buffer, txsz))
+			*err |= 0x10;
+		else if((cfg_stat = ICE_FPGA_Config((uint8_t *)buffer, txsz)))
 		{
 			ESP_LOGW(TAG, "FPGA configured ERROR - status = %d", cfg_stat);
 			*err |= 8;
+			wifi_set_design(0);
 		}
 		else
-			ESP_LOGI(TAG, "FPGA configured OK - status = %d", cfg_stat);
+		{
+			TRACE(CONFIG, cfg_stat, txsz);
+			wifi_set_design(cache_put((uint8_t *)buffer, txsz));
+		}
 	}
-	else if(cmd == 0xe)
+	else if(cmd == 0x1c)
 	{
-		/* save configuration to the SPIFFS filesystem */
-		uint8_t cfg_stat;	
-		if((cfg_stat = spiffs_write((char *)cfg_file, (uint8_t *)buffer, txsz)))
+		/* configure, reply, then write to flash in the background */
+		uint8_t cfg_stat;
+		uint32_t job[2] = {0, 0};
+		if(bitstream_check((uint8_t *)buffer, txsz))
+			*err |= 0x10;
+		else if((cfg_stat = ICE_FPGA_Config((uint8_t *)buffer, txsz)))
+		{
+			ESP_LOGW(TAG, "FPGA configured ERROR - status = %d", cfg_stat);
+			*err |= 8;
+			wifi_set_design(0);
+		}
+		else
 		{
-			ESP_LOGW(TAG, "SPIFFS Error - status = %d", cfg_stat);
+			TRACE(CONFIG, cfg_stat, txsz);
+			job[1] = cache_put((uint8_t *)buffer, txsz);
+			wifi_set_design(job[1]);
+			job[0] = persist_submit((uint8_t *)buffer, txsz, job[1]);
+			exec_kept = buffer;
+		}
+		memcpy(&sbuf[1], job, 8);
+		rplen = 8;
+	}
+	else if(cmd == 0x1d)
+	{
+		/* persist status - optionally wait up to ms for the write to finish */
+		persist_stat_t st;
+		uint32_t ms = (txsz >= 4) ? *(uint32_t *)buffer : 0;
+		if(ms)
+			persist_wait(pdMS_TO_TICKS((ms < PERSIST_WAIT_MAX_MS) ? ms : PERSIST_WAIT_MAX_MS));
+		persist_status(&st);
+		memcpy(&sbuf[1], &st, sizeof(persist_stat_t));
+		rplen = sizeof(persist_stat_t);
+	}
+	else if(cmd == 0xa)
+	{
+		/* configure from cache or flash by CRC32 - client uploads on a miss */
+		uint8_t cfg_stat = 0;
+		uint32_t src = CACHE_SRC_MISS;
+		if(txsz < 4)
 			*err |= 8;
+		else if((src = cache_config(*(uint32_t *)buffer, &cfg_stat)) == CACHE_SRC_MISS)
+			ESP_LOGI(TAG, "Config by CRC 0x%08X - miss", *(uint32_t *)buffer);
+		else if(cfg_stat)
+		{
+			ESP_LOGW(TAG, "FPGA configured ERROR - status = %d", cfg_stat);
+			*err |= 8;
+			wifi_set_design(0);
 		}
 		else
-			ESP_LOGI(TAG, "SPIFFS wrote OK - status = %d", cfg_stat);
+			wifi_set_design(*(uint32_t *)buffer);
+		memcpy(&sbuf[1], &src, 4);
+		rplen = 4;
 	}
 	else if(cmd == 0xc)
 	{
 		/* write block of data to PSRAM via SPI pass-thru */
-		uint32_t Addr = *((uint32_t *)buffer);
-		ESP_LOGI(TAG, "PSRAM write: Addr 0x%08X, Len 0x%08X", Addr, txsz-4);
-		ICE_PSRAM_Write(Addr, (uint8_t *)buffer+4, txsz-4);
+		uint32_t Addr = *((uint32_t *)buffer), Len = txsz-4;
+		if((Addr > ICE_PSRAM_SZ) || (Len > ICE_PSRAM_SZ - Addr))
+		{
+			ESP_LOGW(TAG, "PSRAM write error - 0x%08X + 0x%08X out of range", Addr, Len);
+			*err |= 8;
+		}
+		else
+		{
+			TRACE(PSRAM_WR, Addr, Len);
+			ICE_PSRAM_Write(Addr, (uint8_t *)buffer+4, Len);
+		}
 	}
 	else if(cmd == 0xb)
 	{
 		/* read block of data from PSRAM via SPI pass-thru */
 		uint32_t Addr = *((uint32_t *)buffer);
-		psram_rdsz = *((uint32_t *)(buffer+4));
-		psram_rdbuf = malloc(psram_rdsz+1);	// extra byte at start for err status
-		if(psram_rdbuf)
+		uint32_t Len = *((uint32_t *)(buffer+4));
+		TRACE(PSRAM_RD, Addr, Len);
+		
+		/* sent in chunks as it's read so there's no size limit */
+		stream_psram_read(req, err, Addr, Len);
+		return 0;
+	}
+	else if(cmd == 0x17)
+	{
+		/* gather PSRAM regions: count, addr/len pairs */
+		stream_psram_gather(req, err, buffer, txsz);
+		return 0;
+	}
+	else if(cmd == 0x18)
+	{
+		/* scatter to PSRAM regions: count, addr/len pairs, data */
+		stream_psram_scatter(req, err, buffer, txsz);
+		return 0;
+	}
+	else if(cmd == 0x1e)
+	{
+		/* time sync: op, args - reply is the sync status */
+		uint32_t *args = (uint32_t *)buffer;
+		uint32_t op = (txsz >= 4) ? args[0] : TSYNC_OP_STATUS;
+		esp_err_t ret = ESP_OK;
+		if((op == TSYNC_OP_SERVER) && (txsz >= 16))
+			ret = tsync_server(args[1], args[2], args[3]);
+		else if(op == TSYNC_OP_NOW)
+			ret = tsync_now();
+		else if(op != TSYNC_OP_STATUS)
+			ret = ESP_ERR_INVALID_ARG;
+		if(ret != ESP_OK)
+			*err |= 8;
+		if((bigbuf = pool_alloc(POOL_SMALL_SZ)))
+			bigsz = tsync_stats(bigbuf+1, POOL_SMALL_SZ-1);
+		else
+			*err |= 8;
+	}
+	else if(cmd == 0x1f)
+	{
+		/* timed command: server time (64 bit), cmd, its payload - the reply is its own */
+		uint32_t *args = (uint32_t *)buffer;
+		if((txsz < 12) || !socket_timed_ok(args[2]))
+			*err |= 8;
+		else if(tsync_wait(args[0] | ((uint64_t)args[1] << 32)) != ESP_OK)
 		{
-			ESP_LOGI(TAG, "PSRAM read: Addr 0x%08X, Len 0x%08X", Addr, psram_rdsz);
-			ICE_PSRAM_Read(Addr, (uint8_t *)psram_rdbuf+1, psram_rdsz);
+			ESP_LOGW(TAG, "Timed cmd 0x%x: not synced or too far ahead", args[2]);
+			*err |= 8;
 		}
+		else
+			return handle_message(req, err, args[2], buffer+12, txsz-12);
+	}
+	else if(cmd == 0x20)
+	{
+		/* load the register map: first, count, class per range - none clears it */
+		if((txsz % sizeof(regmap_range_t)) ||
+			(regmap_load((regmap_range_t *)buffer, txsz / sizeof(regmap_range_t)) != ESP_OK))
+			*err |= 8;
+	}
+	else if(cmd == 0x21)
+	{
+		/* dump the register map and shadow */
+		if((bigbuf = pool_alloc(1 + sizeof(regmap_dump_t))))
+			bigsz = regmap_dump(bigbuf+1, sizeof(regmap_dump_t));
+		else
+			*err |= 8;
+	}
+	else if(cmd == 0x19)
+	{
+		/* fill PSRAM: addr, len, pattern bytes - no pattern clears */
+		uint32_t *args = (uint32_t *)buffer;
+		uint8_t zero = 0;
+		if(txsz < 8)
+			*err |= 8;
 		else
 		{
-			ESP_LOGW(TAG, "PSRAM read error - couldn't alloc buffer size %d", psram_rdsz+1);
-			psram_rdsz = 0;
+			TRACE(PSRAM_FILL, args[0], args[1]);
+			if(psram_fill(args[0], args[1], (txsz > 8) ? (uint8_t *)&args[2] : &zero,
+				(txsz > 8) ? txsz-8 : 1) != ESP_OK)
+				*err |= 8;
+		}
+	}
+	else if(cmd == 0x1a)
+	{
+		/* copy within PSRAM: dst, src, len */
+		uint32_t *args = (uint32_t *)buffer;
+		if(txsz < 12)
 			*err |= 8;
+		else
+		{
+			TRACE(PSRAM_COPY, args[0], args[2]);
+			if(psram_copy(args[0], args[1], args[2]) != ESP_OK)
+				*err |= 8;
 		}
 	}
+	else if(cmd == 0x1b)
+	{
+		/* CRC32 of PSRAM: addr, len */
+		uint32_t *args = (uint32_t *)buffer;
+		if(txsz < 8)
+			*err |= 8;
+		else
+		{
+			TRACE(PSRAM_CRC, args[0], args[1]);
+			if(psram_crc(args[0], args[1], &Data) != ESP_OK)
+				*err |= 8;
+		}
+		memcpy(&sbuf[1], &Data, 4);
+		rplen = 4;
+	}
 	else if(cmd == 0)
 	{
         /* Read SPI register */
 		uint8_t Reg = *(uint32_t *)buffer & 0x7f;
-		ICE_FPGA_Serial_Read(Reg, &Data);
-		ESP_LOGI(TAG, "Reg read %d = 0x%08X", *(uint32_t *)buffer, Data);
+		regmap_read(Reg, &Data);
+		TRACE(REG_RD, Reg, Data);
+		memcpy(&sbuf[1], &Data, 4);
+		rplen = 4;
 	}
 	else if(cmd == 1)
 	{
         /* Write SPI register */
 		uint8_t Reg = *(uint32_t *)buffer & 0x7f;
 		Data = *(uint32_t *)&buffer[4];
-		ESP_LOGI(TAG, "Reg write %d = %d", Reg, Data);
-		ICE_FPGA_Serial_Write(Reg, Data);
+		TRACE(REG_WR, Reg, Data);
+		regmap_write(Reg, Data);
 	}
 	else if(cmd == 2)
 	{
         /* Report Vbat */
         Data = 2*(uint32_t)adc_c3_get();
-		ESP_LOGI(TAG, "Vbat = %d mV", Data);
+		TRACE(VBAT, Data, 0);
+		memcpy(&sbuf[1], &Data, 4);
+		rplen = 4;
+	}
+	else if(cmd == 3)
+	{
+		/* Subscribe to FPGA interrupt events */
+		uint8_t Reg = *(uint32_t *)buffer & 0x7f;
+		if((slot = event_subscribe(req->sock, Reg)) < 0)
+			*err |= 8;
+	}
+	else if(cmd == 4)
+	{
+		/* Wait for SPI register: Reg, Mask, Expect, interval us, timeout us */
+		uint32_t *args = (uint32_t *)buffer, iters = 0, elapsed = 0;
+		uint8_t Reg = args[0] & 0x7f;
+		if(txsz < 20)
+		{
+			ESP_LOGW(TAG, "Reg wait: short args %d", txsz);
+			*err |= 8;
+		}
+		else if((args[4] > REG_WAIT_MAX_US) ||
+			((args[3] < portTICK_PERIOD_MS * 1000) && (args[4] > REG_WAIT_SPIN_MAX_US)))
+		{
+			/* a long busy-wait would starve everything below the executor */
+			ESP_LOGW(TAG, "Reg wait: interval %d us, timeout %d us not allowed", args[3], args[4]);
+			*err |= 8;
+		}
+		else if(ICE_FPGA_Serial_Wait(Reg, args[1], args[2], args[3], args[4],
+			&Data, &iters, &elapsed))
+		{
+			ESP_LOGW(TAG, "Reg wait %d timeout = 0x%08X", Reg, Data);
+			*err |= 8;
+		}
+		else
+			TRACE(REG_WAIT, Reg, elapsed);
+		
+		/* final value, iterations, elapsed time */
+		memcpy(&sbuf[1], &Data, 4);
+		memcpy(&sbuf[5], &iters, 4);
+		memcpy(&sbuf[9], &elapsed, 4);
+		rplen = 12;
+	}
+	else if(cmd == 5)
+	{
+		/* Sequence: op 0 = run, 1 = store boot seq, 2 = run boot seq, 3 = erase boot seq */
+		uint32_t op = (txsz >= 4) ? *(uint32_t *)buffer : 0xFFFFFFFF, pc;
+		uint8_t *prog = (uint8_t *)buffer+4;
+		uint32_t proglen = (txsz > 4) ? txsz-4 : 0;
+		seq_result_t res = {0};
+		
+		/* reply is status, pc, elapsed, slots, rdlen, read data */
+		bigbuf = pool_alloc(1 + 12 + 4*SEQ_SLOTS + 4 + SEQ_RDBUF_MAX);
+		if(bigbuf)
+		{
+			res.rdbuf = bigbuf + 1 + 12 + 4*SEQ_SLOTS + 4;
+			res.rdmax = SEQ_RDBUF_MAX;
+			if(op == 0)
+				seq_run(prog, proglen, &res);
+			else if(op == 1)
+			{
+				if(!(res.status = seq_check(prog, proglen, &pc)))
+				{
+					if(spiffs_write(SEQ_BOOT_FILE, prog, proglen))
+						*err |= 8;
+				}
+				else
+					res.pc = pc;
+			}
+			else if(op == 2)
+			{
+				if(seq_run_file(SEQ_BOOT_FILE, &res) == ESP_ERR_NOT_FOUND)
+					*err |= 8;
+			}
+			else if(op == 3)
+				remove(SEQ_BOOT_FILE);
+			else
+				*err |= 8;
+			
+			if(res.status)
+				*err |= 8;
+			TRACE(SEQ, res.status, res.elapsed_us);
+			
+			memcpy(bigbuf+1, &res.status, 4);
+			memcpy(bigbuf+5, &res.pc, 4);
+			memcpy(bigbuf+9, &res.elapsed_us, 4);
+			memcpy(bigbuf+13, res.slots, 4*SEQ_SLOTS);
+			memcpy(bigbuf+13+4*SEQ_SLOTS, &res.rdlen, 4);
+			bigsz = 12 + 4*SEQ_SLOTS + 4 + res.rdlen;
+		}
+		else
+		{
+			ESP_LOGW(TAG, "Sequence error - couldn't alloc reply");
+			*err |= 8;
+		}
+	}
+	else if(cmd == 6)
+	{
+		/* Streaming capture - sends its own reply and data frames */
+		stream_capture(req, err, buffer, txsz);
+		return 0;
+	}
+	else if(cmd == 8)
+	{
+		/* Report statistics: group */
+		uint32_t group = *(uint32_t *)buffer;
+		int len = -1;
+		
+		bigbuf = pool_alloc(POOL_SMALL_SZ);
+		if(bigbuf)
+		{
+			if(group == STATS_POOL)
+				len = pool_stats(bigbuf+5, POOL_SMALL_SZ-5);
+			else if(group == STATS_STORAGE)
+				len = spiffs_stats(bigbuf+5, POOL_SMALL_SZ-5);
+			else if(group == STATS_CONFIG)
+				len = ICE_FPGA_Config_Stats(bigbuf+5, POOL_SMALL_SZ-5);
+			else if(group == STATS_CACHE)
+				len = cache_stats(bigbuf+5, POOL_SMALL_SZ-5);
+			else if(group == STATS_PS)
+				len = ps_stats(bigbuf+5, POOL_SMALL_SZ-5);
+			else if(group == STATS_TSYNC)
+				len = tsync_stats(bigbuf+5, POOL_SMALL_SZ-5);
+			else if(group == STATS_REGMAP)
+				len = regmap_stats(bigbuf+5, POOL_SMALL_SZ-5);
+			
+			if(len < 0)
+			{
+				ESP_LOGW(TAG, "Unknown stats group %d", group);
+				*err |= 8;
+				len = 0;
+			}
+			
+			/* length then data */
+			memcpy(bigbuf+1, &len, 4);
+			bigsz = 4 + len;
+		}
+		else
+			*err |= 8;
+	}
+	else if(cmd == 0x10)
+	{
+		/* Wi-Fi power save: pin, idle mode, idle ms, boost B/s */
+		/* an empty payload just reports */
+		ps_config_t cfg;
+		uint32_t mode;
+		if(txsz >= sizeof(ps_config_t))
+		{
+			memcpy(&cfg, buffer, sizeof(ps_config_t));
+			if(ps_config(&cfg) != ESP_OK)
+			{
+				ESP_LOGW(TAG, "Bad power save settings");
+				*err |= 8;
+			}
+		}
+		else if(txsz)
+			*err |= 8;
+		
+		/* reply is the mode then the settings */
+		mode = ps_get(&cfg);
+		memcpy(&sbuf[1], &mode, 4);
+		memcpy(&sbuf[5], &cfg, sizeof(ps_config_t));
+		rplen = 4 + sizeof(ps_config_t);
+	}
+	else if(cmd == 0x11)
+	{
+		/* Dump the trace ring: flags (bit 0 clears it) */
+		uint32_t flags = (txsz >= 4) ? *(uint32_t *)buffer : 0;
+		bigbuf = pool_alloc(POOL_MED_SZ);
+		if(bigbuf)
+			bigsz = trace_dump(bigbuf+1, POOL_MED_SZ-1, flags & 1);
+		else
+			*err |= 8;
+	}
+	else if(cmd == 0x12)
+	{
+		/* SPI benchmark: test, addr, total, sizes, flags, clocks... */
+		int len = -1;
+		if((bigbuf = pool_alloc(POOL_MED_SZ)))
+			len = bench_run((uint32_t *)buffer, txsz/4, bigbuf+1, POOL_MED_SZ-1);
+		if(len < 0)
+		{
+			*err |= 8;
+			len = 0;
+		}
+		bigsz = len;
+	}
+	else if(cmd == 0x16)
+	{
+		/* Session capture: op, args - status and any data read back */
+		int len = -1;
+		if((bigbuf = pool_alloc(POOL_MED_SZ)))
+			len = session_ctl((uint32_t *)buffer, txsz/4, bigbuf+1, POOL_MED_SZ-1);
+		if(len < 0)
+		{
+			*err |= 8;
+			len = 0;
+		}
+		bigsz = len;
+	}
+	else if(cmd == 0x14)
+	{
+		/* Network source: byte count - data and stats follow the status */
+		nettest_source(req, err, (txsz >= 4) ? *(uint32_t *)buffer : 0);
+		return 0;
 	}
 	else
 	{
@@ -115,212 +702,227 @@ static void handle_message(const int sock, char *err, char cmd, char *buffer, in
 	}
 	
 	/* reply with error status */
-	ESP_LOGI(TAG, "Replying with %d", *err);
-	if((cmd == 0x0b) && (psram_rdbuf))
-	{
-		/* PSRAM Read cmd can return a lot of data */
-		// send() can return less bytes than supplied length.
-		// Walk-around for robust implementation.
-		int to_write = psram_rdsz+1;
-		psram_rdbuf[0] = *err;	// prepend err status
-		uint8_t *wbuf = psram_rdbuf;
-		while (to_write > 0) {
-			int written = send(sock, wbuf, to_write, 0);
-			if (written < 0) {
-				ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-			}
-			to_write -= written;
-			wbuf += written;
-		}
+	TRACE(REPLY, *err, bigbuf ? bigsz : rplen);
+	if(bigbuf)
+	{
+		/* some cmds return a lot of data */
+		bigbuf[0] = *err;	// prepend err status
+		socket_reply(req, bigbuf, bigsz+1);
 		
 		/* done with read buffer */
-		free(psram_rdbuf);
-		psram_rdsz = 0;
+		pool_free(bigbuf);
+		bigsz = 0;
 	}
 	else
 	{
 		/* other commands are simpler */
-		// send() can return less bytes than supplied length.
-		// Walk-around for robust implementation.
-		int to_write = ((cmd == 0) || (cmd==2)) ? 5 : 1;
 		sbuf[0] = *err;
-		if((cmd==0) || (cmd==2))
-			memcpy(&sbuf[1], &Data, 4);
-		while (to_write > 0) {
-			int written = send(sock, sbuf, to_write, 0);
-			if (written < 0) {
-				ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-			}
-			to_write -= written;
+		socket_reply(req, sbuf, rplen+1);
+	}
+	
+	/* event frames follow the reply on a subscribed socket */
+	if(slot >= 0)
+	{
+		event_enable(slot);
+		return 1;
+	}
+	
+	return 0;
+}
+
+/*
+ * SPI executor - runs queued requests in order and sends their replies
+ * while the network task goes on receiving
+ */
+static void exec_task(void *pvParameters)
+{
+	exec_req_t r;
+	char err;
+	
+	while(1)
+	{
+		xQueueReceive(exec_queue, &r, portMAX_DELAY);
+		
+		/* everything ahead of a fence is done */
+		if(!r.buffer && (r.cmd == EXEC_FENCE))
+		{
+			xSemaphoreGive(exec_fence_sem);
+			continue;
 		}
+		
+		/* err is per message */
+		err = 0;
+		if(r.buffer)
+		{
+			uint32_t us;
+			TRACE(EXEC, r.cmd, r.req.hdr.tag);
+			handle_message(&r.req, &err, r.cmd, r.buffer, r.req.hdr.txsz);
+			if(r.buffer != exec_kept)
+				pool_free(r.buffer);
+			exec_kept = NULL;
+			us = esp_timer_get_time() - r.rx_us;
+			ps_request(us);
+			TRACE(DONE, r.cmd, us);
+		}
+		else
+		{
+			ESP_LOGW(TAG, "Couldn't alloc buffer");
+			err |= 1;
+			socket_reply(&r.req, &err, 1);
+		}
+	}
+}
+
+/*
+ * wait until the executor has finished everything queued so far
+ */
+static void exec_fence(void)
+{
+	exec_req_t r = {.cmd = EXEC_FENCE};
+	
+	xQueueSend(exec_queue, &r, portMAX_DELAY);
+	xSemaphoreTake(exec_fence_sem, portMAX_DELAY);
+}
+
+/*
+ * body buffers for the parser - when the pool is empty it's usually
+ * because queued requests hold it so wait for them once
+ */
+static void *socket_body_alloc(uint32_t size)
+{
+	void *buf;
+	
+	/* no point waiting for a slab that doesn't exist */
+	if(size > POOL_LARGE_SZ)
+	{
+		ESP_LOGW(TAG, "Body of %d is bigger than any buffer", size);
+		return NULL;
 	}
+	
+	if(!(buf = pool_alloc(size)))
+	{
+		exec_fence();
+		buf = pool_alloc(size);
+	}
+	
+	/* a background flash write may still hold the large slab */
+	if(!buf && persist_wait(portMAX_DELAY))
+		buf = pool_alloc(size);
+	
+	return buf;
 }
 
 /*
- * receive a message
+ * receive messages - returns 1 if the socket is still in use elsewhere
  */
-static void do_getmsg(const int sock)
+static int do_getmsg(const int sock)
 {
-    int len, tot = 0, rxidx, sz, txsz = 0, state = 0;
-    char rx_buffer[128], *filebuffer = NULL, *fptr, err=0, cmd = 0;
-	union u_hdr
-	{
-		char bytes[8];
-		unsigned int words[2];
-	} header;
-
-    do {
-		/* get latest buffer */
-        len = recv(sock, rx_buffer, sizeof(rx_buffer) - 1, 0);
-		rxidx = 0;
+	int len, keep = 0, bad = 0, res;
+	uint32_t used, want;
+	char rx_buffer[SOCKET_RX_SZ], *rxp, err;
+	uint8_t *dst;
+	proto_t p;
+	socket_req_t req = {.sock = sock};
+	exec_req_t r;
+	
+	proto_init(&p, socket_body_alloc);
+	while(!keep && !bad)
+	{
+		/* bodies are received straight into their buffer */
+		if((dst = proto_direct(&p, &want)))
+		{
+			if((len = recv(sock, dst, want, 0)) <= 0)
+				break;
+			session_rx(sock, dst, len);
+			ps_traffic(len);
+			res = proto_advance(&p, len);
+			len = 0;
+		}
+		else
+		{
+			if((len = recv(sock, rx_buffer, sizeof(rx_buffer), 0)) <= 0)
+				break;
+			session_rx(sock, rx_buffer, len);
+			ps_traffic(len);
+			res = PROTO_MORE;
+		}
+		rxp = rx_buffer;
 		
-        if (len < 0) {
-            ESP_LOGE(TAG, "Error occurred during receiving: errno %d", errno);
-        } else if (len == 0) {
-			if(filebuffer)
+		/* a segment may hold the end of one message and several more */
+		do
+		{
+			if(len)
 			{
-				free(filebuffer);
-				ESP_LOGW(TAG, "file buffer not properly freed");
+				res = proto_parse(&p, (uint8_t *)rxp, len, &used);
+				rxp += used;
+				len -= used;
 			}
-            ESP_LOGI(TAG, "Connection closed, tot = %d, state = %d", tot, state);
-        } else {
-			/* valid data - parse w/ state machine */
-			int rxleft = len;
-			switch(state)
+			
+			req.hdr = p.hdr;
+			err = 0;
+			if(res == PROTO_MSG)
 			{
-				case 0:
-					/* waiting for magic header */
-					if(tot < 8)
-					{
-						/* fill header buffer */
-						sz = rxleft;
-						sz = sz <= 8 ? sz : 8;
-						memcpy(&header.bytes[tot], rx_buffer, sz);
-						tot += sz;
-						rxidx += sz;
-						rxleft -= sz;
-					}
-					
-					/* check if header full */
-					if(tot == 8)
-					{
-						/* check if header matches */
-						if((header.words[0] & 0xFFFFFFF0) == 0xCAFEBEE0)
-						{
-							cmd = header.words[0] & 0xF;
-							txsz = header.words[1];
-							ESP_LOGI(TAG, "State 0: Found header: cmd %1X, txsz = %d", cmd, txsz);
-                            
-							/* allocate a buffer for the data */
-							filebuffer = malloc(txsz);
-							if(filebuffer)
-							{
-								/* save any remaining data in buffer */
-								fptr = filebuffer;
-								sz = rxleft;
-								sz = sz <= txsz ? sz : txsz;
-								memcpy(fptr, rx_buffer+rxidx, sz);
-								//ESP_LOGI(TAG, "State 0: got %d, used %d", rxleft, sz);
-								fptr += sz;
-								tot += sz;
-								rxleft -= sz;
-							}
-							else
-							{
-								ESP_LOGW(TAG, "Couldn't alloc buffer");
-								err |= 1;
-							}
-							
-							/* done? */
-							if((tot-8)==txsz)
-							{
-                                /* compute CRC32 to match linux crc32 cmd */
-                                uint32_t crc = crc32_le(0, (uint8_t *)filebuffer, txsz);
-								ESP_LOGI(TAG, "State 0: Done - Received %d, CRC32 = 0x%08X", txsz, crc);
-								handle_message(sock, &err, cmd, filebuffer, txsz);
-								
-								/* free the buffer */
-								free(filebuffer);
-								filebuffer = NULL;
-
-								/* advance to complete state */
-								state = 2;
-							}
-							else
-							{
-								/* advance to next state */
-								state = 1;
-							}
-							
-							/* check for errors */
-							if(rxleft)
-							{
-								ESP_LOGW(TAG, "Received data > txsz %d", rxleft);
-								err |= 2;
-							}
-						}
-						else
-						{
-							ESP_LOGW(TAG, "Wrong Header 0x%08X", header.words[0]);
-							err |= 4;
-						}
-					}
-					break;
-					
-				case 1:
-					/* collecting data in buffer */
-					if(filebuffer)
-					{
-						int fleft = txsz-(fptr-filebuffer);
-						if(fleft<txsz)
-						{
-							sz = len;
-							sz = sz <= fleft ? sz : fleft;
-							memcpy(fptr, rx_buffer, sz);
-							fptr += sz;
-							tot += sz;
-							fleft -= sz;
-							rxleft -= sz;
-							//ESP_LOGI(TAG, "State 1: got %d, used %d, %d left", len, sz, fleft);
-							
-							/* done? */
-							if((tot-8)==txsz)
-							{
-                                /* compute CRC32 to match linux crc32 cmd */
-                                uint32_t crc = crc32_le(0, (uint8_t *)filebuffer, txsz);
-								ESP_LOGI(TAG, "State 1: Done - Received %d, CRC32 = 0x%08X", txsz, crc);
-								
-								/* process it */
-								handle_message(sock, &err, cmd, filebuffer, txsz);
-								
-								/* free the buffer */
-								free(filebuffer);
-								filebuffer = NULL;
-								
-								/* advance state */
-								state = 2;
-							}
-								
-							/* check for errors */
-							if(rxleft)
-							{
-								ESP_LOGW(TAG, "State 1: Received data past end", rxleft);
-							}
-						}
-					}
-					else
-					{
-						ESP_LOGW(TAG, "State 1: Received %d but no buffer", len);
-					}
-					break;
-					
-				case 2:
-					/* still getting data */
-					ESP_LOGW(TAG, "State 2 - Received data past end", rxleft);
-					break;
+				r.req = req;
+				r.cmd = req.hdr.cmd;
+				r.buffer = (char *)proto_take(&p);
+				r.rx_us = esp_timer_get_time();
+				TRACE(HDR, r.cmd, req.hdr.txsz);
+				session_msg(sock, SESSION_MSG, &req.hdr);
+				
+				if(((r.cmd == 3) || (r.cmd == 6)) && r.buffer)
+				{
+					/*
+					 * subscribe hands the socket off so nothing can follow it,
+					 * capture watches it for the stop byte so nothing else may
+					 * read it meanwhile
+					 */
+					exec_fence();
+					keep = handle_message(&req, &err, r.cmd, r.buffer, req.hdr.txsz);
+					pool_free(r.buffer);
+				}
+				else
+					xQueueSend(exec_queue, &r, portMAX_DELAY);
 			}
-        }
-    } while (len > 0);
+			else if(res == PROTO_STREAM)
+			{
+				/* streaming commands read the rest themselves */
+				socket_rx_t rx = {&req, rxp, len};
+				TRACE(STREAM, req.hdr.cmd, req.hdr.txsz);
+				session_msg(sock, SESSION_STREAM, &req.hdr);
+				exec_fence();
+				handle_stream(&rx, &err, req.hdr.cmd, req.hdr.txsz);
+				
+				/* whatever it didn't use is the next message */
+				rxp = rx.pre;
+				len = rx.prelen;
+			}
+			else if(res == PROTO_BAD)
+			{
+				/* can't find the next header so give up on the connection */
+				ESP_LOGW(TAG, "Wrong Header");
+				TRACE(BAD_HDR, 0, 0);
+				session_msg(sock, SESSION_BAD, NULL);
+				err = 4;
+				exec_fence();
+				socket_send(sock, &err, 1);
+				bad = 1;
+			}
+			res = PROTO_MORE;
+		}
+		while(len && !keep && !bad);
+	}
+	
+	if(len < 0)
+		ESP_LOGE(TAG, "Error occurred during receiving: errno %d", errno);
+	
+	/* queued requests still use the socket */
+	exec_fence();
+	pool_free(proto_take(&p));
+	ESP_LOGI(TAG, "Connection closed");
+	TRACE(CLOSE, sock, keep);
+	session_close(sock);
+	
+	return keep;
 }
 
 /*
@@ -345,9 +947,23 @@ void socket_task(void *pvParameters)
         ip_protocol = IPPROTO_IP;
     }
 
+    /* requests are run by the executor while this task keeps receiving */
+    exec_queue = xQueueCreate(EXEC_QUEUE_LEN, sizeof(exec_req_t));
+    exec_fence_sem = xSemaphoreCreateBinary();
+    if(!exec_queue || !exec_fence_sem || (session_init() != ESP_OK) ||
+        (persist_init() != ESP_OK) || (tsync_init() != ESP_OK) ||
+        (xTaskCreate(exec_task, "exec", EXEC_STACK, NULL, EXEC_PRIO, NULL) != pdPASS))
+    {
+        ESP_LOGE(TAG, "Unable to start executor");
+        ota_fail();
+        vTaskDelete(NULL);
+        return;
+    }
+
     int listen_sock = socket(addr_family, SOCK_STREAM, ip_protocol);
     if (listen_sock < 0) {
         ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        ota_fail();
         vTaskDelete(NULL);
         return;
     }
@@ -370,6 +986,9 @@ void socket_task(void *pvParameters)
         goto CLEAN_UP;
     }
 
+    /* a freshly updated image has proven itself */
+    ota_mark_valid();
+
 	/* loop forever handling the socket */
     while (1) {
 
@@ -388,20 +1007,27 @@ void socket_task(void *pvParameters)
         setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
         setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
         setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
+        // Pipelined replies go out as soon as they're ready
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(int));
         // Convert ip address to string
         if (source_addr.ss_family == PF_INET) {
             inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr_str, sizeof(addr_str) - 1);
         }
         ESP_LOGI(TAG, "Socket accepted ip address: %s", addr_str);
+        TRACE(CONNECT, ((struct sockaddr_in *)&source_addr)->sin_addr.s_addr, sock);
+        ps_connect();
+        session_accept(sock);
 
 		/* do the thing this socket does */
-        do_getmsg(sock);
-
-        shutdown(sock, 0);
-        close(sock);
+        if(!do_getmsg(sock))
+        {
+            shutdown(sock, 0);
+            close(sock);
+        }
     }
 
 CLEAN_UP:
+    ota_fail();
     close(listen_sock);
     vTaskDelete(NULL);
 }
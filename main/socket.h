@@ -7,7 +7,36 @@
 #define __SOCKET__
 
 #include "main.h"
+#include "proto.h"
+
+/* where a request came from - its header says how the reply is framed */
+typedef struct
+{
+	int sock;
+	proto_hdr_t hdr;
+} socket_req_t;
+
+/* socket reader that first hands out data already received */
+typedef struct
+{
+	const socket_req_t *req;
+	char *pre;
+	int prelen;
+} socket_rx_t;
+
+/* cmd 8 statistics groups */
+#define STATS_POOL		0
+#define STATS_STORAGE	1
+#define STATS_CONFIG	2
+#define STATS_CACHE		3
+#define STATS_PS		4
+#define STATS_TSYNC		5
+#define STATS_REGMAP	6
 
 void socket_task(void *pvParameters);
+int socket_send(const int sock, const void *buf, int len);
+int socket_reply_hdr(const socket_req_t *req, uint32_t len);
+int socket_reply(const socket_req_t *req, const void *buf, int len);
+int socket_recv(socket_rx_t *rx, void *buf, int len);
 
 #endif
@@ -4,11 +4,32 @@
  */
 
 #include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "spiffs.h"
+#include "pool.h"
+#include "esp_timer.h"
+#if SPIFFS_USE_LITTLEFS
+#include "esp_littlefs.h"
+#else
 #include "esp_spiffs.h"
+#endif
+
+#define SPIFFS_NAME_MAX		64
+
+/* interrupted writes finished or cleaned up at boot */
+#define SPIFFS_RECOVER_MAX	8
 
 static const char* TAG = "spiffs";
 
+#if SPIFFS_USE_LITTLEFS
+static esp_vfs_littlefs_conf_t conf =
+{
+  .base_path = "/spiffs",
+  .partition_label = "storage",
+  .format_if_mount_failed = true
+};
+#else
 static esp_vfs_spiffs_conf_t conf =
 {
   .base_path = "/spiffs",
@@ -16,36 +37,126 @@ static esp_vfs_spiffs_conf_t conf =
   .max_files = 5,
   .format_if_mount_failed = true
 };
+#endif
+
+/*
+ * in-progress write - data goes to <fname>.tmp which is renamed to
+ * <fname>.new once complete and then replaces <fname>
+ */
+struct spiffs_wr
+{
+	FILE *f;
+	uint8_t *vbuf;
+	uint32_t len;
+	int64_t start;
+	char fname[SPIFFS_NAME_MAX];
+	char tmp[SPIFFS_NAME_MAX];
+	char new[SPIFFS_NAME_MAX];
+};
+
+static spiffs_stats_t spiffs_st;
+
+/*
+ * finish or clean up a write that was interrupted by a reset
+ */
+static void spiffs_recover(char *fname)
+{
+	char name[SPIFFS_NAME_MAX];
+	struct stat st;
+	
+	/* complete but not yet swapped in */
+	snprintf(name, sizeof(name), "%s.new", fname);
+	if(!stat(name, &st))
+	{
+		ESP_LOGW(TAG, "Completing interrupted write of %s", fname);
+		remove(fname);
+		rename(name, fname);
+	}
+	
+	/* partial - discard */
+	snprintf(name, sizeof(name), "%s.tmp", fname);
+	if(!stat(name, &st))
+	{
+		ESP_LOGW(TAG, "Removing partial write of %s", fname);
+		remove(name);
+	}
+}
+
+/*
+ * look for interrupted writes of any file - only safe before anything
+ * else is using the filesystem
+ */
+static void spiffs_recover_all(void)
+{
+	char names[SPIFFS_RECOVER_MAX][SPIFFS_NAME_MAX];
+	struct dirent *de;
+	DIR *dir;
+	int i, n = 0, len;
+	
+	if(!(dir = opendir(conf.base_path)))
+		return;
+	
+	/* collect first, the directory mustn't change while it's walked */
+	while((n < SPIFFS_RECOVER_MAX) && (de = readdir(dir)))
+	{
+		len = strlen(de->d_name);
+		if((len > 4) && (!strcmp(&de->d_name[len-4], ".new") || !strcmp(&de->d_name[len-4], ".tmp")) &&
+			(snprintf(names[n], SPIFFS_NAME_MAX, "%s/%.*s", conf.base_path, len-4, de->d_name) < SPIFFS_NAME_MAX))
+			n++;
+	}
+	closedir(dir);
+	
+	for(i = 0; i < n; i++)
+		spiffs_recover(names[i]);
+}
 
 /*
  * init the spiffs api
  */
 esp_err_t spiffs_init(void)
 {
-    // Use settings defined above to initialize and mount SPIFFS filesystem.
-    // Note: esp_vfs_spiffs_register is an all-in-one convenience function.
+	int64_t start = esp_timer_get_time();
+	
+    // Use settings defined above to initialize and mount the filesystem.
+    // Note: esp_vfs_*_register is an all-in-one convenience function.
+#if SPIFFS_USE_LITTLEFS
+    esp_err_t ret = esp_vfs_littlefs_register(&conf);
+#else
     esp_err_t ret = esp_vfs_spiffs_register(&conf);
+#endif
 
     if (ret != ESP_OK) {
         if (ret == ESP_FAIL) {
             ESP_LOGE(TAG, "Failed to mount or format filesystem");
         } else if (ret == ESP_ERR_NOT_FOUND) {
-            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
+            ESP_LOGE(TAG, "Failed to find storage partition");
         } else {
-            ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
+            ESP_LOGE(TAG, "Failed to initialize filesystem (%s)", esp_err_to_name(ret));
         }
         return ESP_FAIL;
     }
+	spiffs_st.mount_us = esp_timer_get_time() - start;
+	spiffs_st.backend = SPIFFS_USE_LITTLEFS;
 
     size_t total = 0, used = 0;
+#if SPIFFS_USE_LITTLEFS
+    ret = esp_littlefs_info(conf.partition_label, &total, &used);
+#else
     ret = esp_spiffs_info(conf.partition_label, &total, &used);
+#endif
     if (ret != ESP_OK)
 	{
-        ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
+        ESP_LOGE(TAG, "Failed to get partition information (%s)", esp_err_to_name(ret));
 		return ESP_FAIL;
     }
+	spiffs_st.total = total;
+	spiffs_st.used = used;
+	
+	/* once, before the persist task can be part way through a write */
+	spiffs_recover_all();
 	
-	ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
+	ESP_LOGI(TAG, "%s partition size: total: %d, used: %d, mount %d us",
+		SPIFFS_USE_LITTLEFS ? "LittleFS" : "SPIFFS", total, used, spiffs_st.mount_us);
 	return ESP_OK;
 }
 
@@ -55,7 +166,9 @@ esp_err_t spiffs_init(void)
 esp_err_t spiffs_read(char *fname, uint8_t **buffer, uint32_t *len)
 {
 	esp_err_t stat = ESP_OK;
+	int64_t start = esp_timer_get_time();
 	size_t act;
+	
     FILE* f = fopen(fname, "rb");
     if (f != NULL)
 	{
@@ -63,7 +176,7 @@ esp_err_t spiffs_read(char *fname, uint8_t **buffer, uint32_t *len)
 		*len = ftell(f);
 		ESP_LOGI(TAG, "File size: %d", *len);
 		fseek(f, 0L, SEEK_SET);
-		*buffer = malloc(*len);
+		*buffer = pool_alloc(*len);
 		if(*buffer)
 		{
 			ESP_LOGI(TAG, "Reading %d from file %s", *len, fname);
@@ -73,14 +186,20 @@ esp_err_t spiffs_read(char *fname, uint8_t **buffer, uint32_t *len)
 			{
 				ESP_LOGE(TAG, "Failed reading - actual = %d", act);
 				stat = ESP_FAIL;
+				
+				/* callers only free what they got on success */
+				pool_free(*buffer);
+				*buffer = NULL;
 			}
 		}
 		else
 		{
-			ESP_LOGE(TAG, "Failed to malloc buffer");
+			ESP_LOGE(TAG, "Failed to alloc buffer");
 			stat = ESP_ERR_NO_MEM;
 		}
 		fclose(f);
+		spiffs_st.rd_bytes = *len;
+		spiffs_st.rd_us = esp_timer_get_time() - start;
 	}
 	else
 	{
@@ -92,28 +211,165 @@ esp_err_t spiffs_read(char *fname, uint8_t **buffer, uint32_t *len)
 }
 
 /*
- * write a file from a buffer
+ * start writing a file - nothing replaces the old one until committed
  */
-esp_err_t spiffs_write(char *fname, uint8_t *buffer, uint32_t len)
+spiffs_wr_t *spiffs_write_open(char *fname)
+{
+	spiffs_wr_t *wr = pool_alloc(sizeof(spiffs_wr_t));
+	
+	if(!wr)
+	{
+		ESP_LOGE(TAG, "Failed to alloc writer");
+		return NULL;
+	}
+	
+	memset(wr, 0, sizeof(spiffs_wr_t));
+	wr->start = esp_timer_get_time();
+	strncpy(wr->fname, fname, SPIFFS_NAME_MAX-1);
+	snprintf(wr->tmp, SPIFFS_NAME_MAX, "%s.tmp", fname);
+	snprintf(wr->new, SPIFFS_NAME_MAX, "%s.new", fname);
+	
+	/* clear out leftovers from an earlier failed attempt */
+	remove(wr->tmp);
+	remove(wr->new);
+	
+	if(!(wr->f = fopen(wr->tmp, "wb")))
+	{
+		ESP_LOGE(TAG, "Failed to open file for writing");
+		pool_free(wr);
+		return NULL;
+	}
+	
+	/* write to flash in whole chunks, not whatever size recv() returns */
+	if((wr->vbuf = pool_alloc(SPIFFS_WR_CHUNK)))
+		setvbuf(wr->f, (char *)wr->vbuf, _IOFBF, SPIFFS_WR_CHUNK);
+	
+	ESP_LOGI(TAG, "Writing file %s", fname);
+	return wr;
+}
+
+/*
+ * add data to a file being written
+ */
+esp_err_t spiffs_write_chunk(spiffs_wr_t *wr, uint8_t *buffer, uint32_t len)
 {
-	esp_err_t stat = ESP_OK;
 	size_t act;
-    FILE* f = fopen(fname, "wb");
-    if (f != NULL)
+	
+	if((act = fwrite(buffer, 1, len, wr->f)) != len)
 	{
-		ESP_LOGI(TAG, "Writing %d to file %s ", len, fname);
-		if((act = fwrite(buffer, 1, len, f)) != len)
-		{
-			ESP_LOGE(TAG, "Failed writing - actual = %d", act);
+		ESP_LOGE(TAG, "Failed writing - actual = %d", act + wr->len);
+		return ESP_FAIL;
+	}
+	wr->len += len;
+	
+	return ESP_OK;
+}
+
+/*
+ * finish a write, replacing the old file only if commit is set and
+ * everything made it to flash
+ */
+esp_err_t spiffs_write_close(spiffs_wr_t *wr, uint8_t commit)
+{
+	esp_err_t stat = ESP_OK;
+	
+	if(fclose(wr->f))
+	{
+		ESP_LOGE(TAG, "Failed closing %s", wr->tmp);
+		stat = ESP_FAIL;
+	}
+	
+	if(commit && !stat)
+	{
+#if SPIFFS_USE_LITTLEFS
+		/* LittleFS rename replaces the target atomically */
+		if(rename(wr->tmp, wr->fname))
 			stat = ESP_FAIL;
+#else
+		/* SPIFFS won't rename onto an existing file - .new marks complete */
+		if(rename(wr->tmp, wr->new))
+			stat = ESP_FAIL;
+		else
+		{
+			remove(wr->fname);
+			if(rename(wr->new, wr->fname))
+				stat = ESP_FAIL;
+		}
+#endif
+		if(stat)
+			ESP_LOGE(TAG, "Failed to replace %s", wr->fname);
+		else
+		{
+			spiffs_st.writes++;
+			spiffs_st.wr_bytes = wr->len;
+			spiffs_st.wr_us = esp_timer_get_time() - wr->start;
+			ESP_LOGI(TAG, "Wrote %d to file %s in %d us", wr->len, wr->fname, spiffs_st.wr_us);
 		}
-		fclose(f);
 	}
 	else
+		remove(wr->tmp);
+	
+	pool_free(wr->vbuf);
+	pool_free(wr);
+	return commit ? stat : ESP_FAIL;
+}
+
+/*
+ * move a file aside as bak before it's replaced - any older bak goes
+ */
+esp_err_t spiffs_keep(char *fname, char *bak)
+{
+	struct stat st;
+	
+	if(stat(fname, &st))
+		return ESP_ERR_NOT_FOUND;
+	
+	remove(bak);
+	if(rename(fname, bak))
 	{
-		ESP_LOGE(TAG, "Failed to open file for writing");
-		stat = ESP_ERR_NOT_FOUND;
-    }
+		ESP_LOGW(TAG, "Couldn't keep %s as %s", fname, bak);
+		return ESP_FAIL;
+	}
 	
-	return stat;
+	return ESP_OK;
+}
+
+/*
+ * write a file from a buffer
+ */
+esp_err_t spiffs_write(char *fname, uint8_t *buffer, uint32_t len)
+{
+	spiffs_wr_t *wr;
+	esp_err_t stat;
+	
+	if(!(wr = spiffs_write_open(fname)))
+		return ESP_ERR_NOT_FOUND;
+	
+	stat = spiffs_write_chunk(wr, buffer, len);
+	
+	return spiffs_write_close(wr, stat == ESP_OK);
+}
+
+/*
+ * copy out statistics, returns bytes used
+ */
+int spiffs_stats(uint8_t *buf, int max)
+{
+	size_t total = 0, used = 0;
+	
+	if(max < sizeof(spiffs_stats_t))
+		return 0;
+	
+#if SPIFFS_USE_LITTLEFS
+	if(!esp_littlefs_info(conf.partition_label, &total, &used))
+#else
+	if(!esp_spiffs_info(conf.partition_label, &total, &used))
+#endif
+	{
+		spiffs_st.total = total;
+		spiffs_st.used = used;
+	}
+	
+	memcpy(buf, &spiffs_st, sizeof(spiffs_stats_t));
+	return sizeof(spiffs_stats_t);
 }
@@ -8,8 +8,40 @@
 
 #include "main.h"
 
+/* 1 to mount the storage partition with LittleFS instead of SPIFFS */
+#ifdef CONFIG_ICE_FS_LITTLEFS
+#define SPIFFS_USE_LITTLEFS	1
+#else
+#define SPIFFS_USE_LITTLEFS	0
+#endif
+
+/* flash writes are buffered to this size */
+#define SPIFFS_WR_CHUNK		4096
+
+/* in-progress file write */
+typedef struct spiffs_wr spiffs_wr_t;
+
+/* storage statistics as reported by spiffs_stats() */
+typedef struct
+{
+	uint32_t backend;		// 0 = SPIFFS, 1 = LittleFS
+	uint32_t mount_us;		// time to mount at boot
+	uint32_t total;			// partition size
+	uint32_t used;			// bytes in use
+	uint32_t writes;		// committed file writes
+	uint32_t wr_bytes;		// size of last committed write
+	uint32_t wr_us;			// open to commit time of last write
+	uint32_t rd_bytes;		// size of last read
+	uint32_t rd_us;			// time of last read
+} spiffs_stats_t;
+
 esp_err_t spiffs_init(void);
 esp_err_t spiffs_read(char *fname, uint8_t **buffer, uint32_t *len);
 esp_err_t spiffs_write(char *fname, uint8_t *buffer, uint32_t len);
+spiffs_wr_t *spiffs_write_open(char *fname);
+esp_err_t spiffs_write_chunk(spiffs_wr_t *wr, uint8_t *buffer, uint32_t len);
+esp_err_t spiffs_write_close(spiffs_wr_t *wr, uint8_t commit);
+esp_err_t spiffs_keep(char *fname, char *bak);
+int spiffs_stats(uint8_t *buf, int max);
 
 #endif
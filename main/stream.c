@@ -0,0 +1,677 @@
+/*
+ * stream.c - continuous FPGA <-> socket streaming
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "stream.h"
+#include "ice.h"
+#include "esp_timer.h"
+#include "pool.h"
+#include "trace.h"
+#include "rom/ets_sys.h"
+#include "lwip/sockets.h"
+
+/* poll fast for a while when there's no data, then sleep */
+#define STREAM_SPIN_US		2000
+#define STREAM_POLL_US		50
+
+/* give up on playback when the gateware takes nothing for this long */
+#define STREAM_STALL_US		5000000
+
+static const char* TAG = "stream";
+
+/*
+ * capture parameters - cmd 6 payload
+ */
+typedef struct
+{
+	uint32_t mode;		// STREAM_MODE_*
+	uint32_t base;		// ring base address or FIFO data register
+	uint32_t size;		// ring size in bytes, unused for FIFO
+	uint32_t wptr_reg;	// ring write pointer or FIFO level (words) register
+	uint32_t rptr_reg;	// ring read pointer register, unused for FIFO
+	uint32_t total;		// bytes to capture, 0 = until client stops
+} stream_cap_args_t;
+
+/*
+ * check for the client closing or asking to stop
+ */
+static int stream_stop_requested(const int sock)
+{
+	char c;
+	
+	/* 0 is closed, anything received is a stop, -1 is nothing yet */
+	return recv(sock, &c, 1, MSG_DONTWAIT) >= 0;
+}
+
+/*
+ * check for the client going away without consuming anything
+ */
+static int stream_peer_closed(const int sock)
+{
+	char c;
+	int len;
+	
+	/* 0 is closed, -1 is nothing yet unless the connection broke */
+	len = recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	return !len || ((len < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK));
+}
+
+/*
+ * Drain an FPGA ring or FIFO into the socket. SPI DMA into one buffer
+ * runs while the other is being sent.
+ */
+void stream_capture(const socket_req_t *req, char *err, char *buffer, int txsz)
+{
+	const int sock = req->sock;
+	stream_cap_args_t args;
+	stream_frame_t *frame[2] = {NULL, NULL};
+	uint32_t rptr = 0, avail, n, reg, sent = 0, overruns = 0, len[2];
+	int64_t start, idle = 0;
+	int cur = 0, pending = -1;
+	
+	memset(&args, 0, sizeof(args));
+	memcpy(&args, buffer, (txsz < sizeof(args)) ? txsz : sizeof(args));
+	if((txsz < sizeof(args)) ||
+	   ((args.mode == STREAM_MODE_RING) && (!args.size || (args.size & 3))) ||
+	   ((args.mode == STREAM_MODE_FIFO) && (args.total & 3)) ||
+	   (args.mode > STREAM_MODE_FIFO))
+	{
+		ESP_LOGW(TAG, "Capture: bad args");
+		*err |= 8;
+	}
+	else
+	{
+		/* double buffer with the frame header in front of each */
+		frame[0] = pool_alloc(sizeof(stream_frame_t) + STREAM_CHUNK);
+		frame[1] = pool_alloc(sizeof(stream_frame_t) + STREAM_CHUNK);
+		if(!frame[0] || !frame[1])
+		{
+			ESP_LOGW(TAG, "Capture: couldn't alloc buffers");
+			*err |= 8;
+		}
+	}
+	
+	/* frames follow the reply unframed */
+	socket_reply(req, err, 1);
+	if(*err)
+		goto done;
+	
+	ESP_LOGI(TAG, "Capture: mode %d, base 0x%08X, size 0x%08X, total %d",
+		args.mode, args.base, args.size, args.total);
+	
+	/* start from wherever the writer is now */
+	if(args.mode == STREAM_MODE_RING)
+	{
+		ICE_FPGA_Serial_Read(args.wptr_reg, &reg);
+		rptr = (reg & STREAM_PTR_MASK) % args.size;
+		ICE_FPGA_Serial_Write(args.rptr_reg, rptr);
+	}
+	
+	start = esp_timer_get_time();
+	while(!args.total || (sent < args.total))
+	{
+		/* how much is waiting */
+		ICE_FPGA_Serial_Read(args.wptr_reg, &reg);
+		if(reg & STREAM_XRUN_FLAG)
+			overruns++;
+		if(args.mode == STREAM_MODE_RING)
+			avail = ((reg & STREAM_PTR_MASK) + args.size - rptr) % args.size;
+		else
+			avail = 4*(reg & STREAM_PTR_MASK);
+		
+		/* nothing new - flush what we have, then wait */
+		if(!avail)
+		{
+			if(pending >= 0)
+			{
+				if(socket_send(sock, frame[pending], sizeof(stream_frame_t) + len[pending]))
+					break;
+				pending = -1;
+			}
+			
+			if(stream_stop_requested(sock))
+				break;
+			
+			if(!idle)
+				idle = esp_timer_get_time();
+			if((esp_timer_get_time() - idle) < STREAM_SPIN_US)
+				ets_delay_us(STREAM_POLL_US);
+			else
+				vTaskDelay(1);
+			continue;
+		}
+		idle = 0;
+		
+		/* a source that never runs dry still has to be stoppable */
+		if(stream_stop_requested(sock))
+			break;
+		
+		/* one chunk, not past the end of the ring or the request */
+		n = (avail > STREAM_CHUNK) ? STREAM_CHUNK : avail;
+		if((args.mode == STREAM_MODE_RING) && (n > args.size - rptr))
+			n = args.size - rptr;
+		if(args.total && (n > args.total - sent))
+			n = args.total - sent;
+		
+		/* read this chunk while sending the last one */
+		if(args.mode == STREAM_MODE_RING)
+			ICE_PSRAM_Read_Start(args.base + rptr, (uint8_t *)(frame[cur]+1), n);
+		else
+			ICE_FPGA_Burst_Read_Start(args.base, (uint8_t *)(frame[cur]+1), n);
+		
+		if(pending >= 0)
+		{
+			if(socket_send(sock, frame[pending], sizeof(stream_frame_t) + len[pending]))
+			{
+				ICE_Read_Wait();
+				pending = -1;
+				break;
+			}
+		}
+		ICE_Read_Wait();
+		
+		/* free up the space */
+		if(args.mode == STREAM_MODE_RING)
+		{
+			rptr = (rptr + n) % args.size;
+			ICE_FPGA_Serial_Write(args.rptr_reg, rptr);
+		}
+		
+		frame[cur]->len = n;
+		frame[cur]->overruns = overruns;
+		len[cur] = n;
+		sent += n;
+		pending = cur;
+		cur ^= 1;
+	}
+	
+	/* last data, then an end frame with the totals */
+	if(pending >= 0)
+		socket_send(sock, frame[pending], sizeof(stream_frame_t) + len[pending]);
+	
+	uint32_t elapsed = esp_timer_get_time() - start;
+	uint32_t trailer[4] = {0, overruns, sent, elapsed};
+	socket_send(sock, trailer, sizeof(trailer));
+	ESP_LOGI(TAG, "Capture: %d bytes in %d us, %d overruns", sent, elapsed, overruns);
+	
+done:
+	if(frame[0])
+		pool_free(frame[0]);
+	if(frame[1])
+		pool_free(frame[1]);
+}
+
+/*
+ * playback parameters - first part of the cmd 7 payload, data follows
+ */
+typedef struct
+{
+	uint32_t mode;			// STREAM_MODE_*
+	uint32_t base;			// ring base address or FIFO data register
+	uint32_t size;			// ring size in bytes, unused for FIFO
+	uint32_t credit_reg;	// free space: bytes for ring, words for FIFO
+	uint32_t wptr_reg;		// ring write pointer register, unused for FIFO
+} stream_play_args_t;
+
+/*
+ * Feed a client stream into an FPGA ring or FIFO. Nothing more is read
+ * from the socket until the gateware has room so TCP flow control holds
+ * the sender back.
+ */
+void stream_playback(socket_rx_t *rx, char *err, uint32_t txsz)
+{
+	stream_play_args_t args;
+	uint8_t *buf = NULL;
+	uint32_t left = txsz, fill = 0, done = 0, wptr = 0, credit, reg, n;
+	uint32_t total = 0, underruns = 0, stalls = 0, elapsed = 0;
+	int64_t start, idle = 0;
+	int len = 0, got = 0;
+	
+	/* collect the args */
+	if((txsz != STREAM_UNBOUNDED) && (txsz < sizeof(args)))
+	{
+		ESP_LOGW(TAG, "Playback: short args");
+		*err |= 8;
+	}
+	else
+	{
+		while(got < sizeof(args))
+		{
+			if((len = socket_recv(rx, (char *)&args + got, sizeof(args) - got)) <= 0)
+			{
+				ESP_LOGW(TAG, "Playback: no args");
+				*err |= 8;
+				goto reply;
+			}
+			got += len;
+		}
+		if(left != STREAM_UNBOUNDED)
+			left -= sizeof(args);
+		
+		if(((args.mode == STREAM_MODE_RING) && (!args.size || (args.size & 3))) ||
+		   (args.mode > STREAM_MODE_FIFO))
+		{
+			ESP_LOGW(TAG, "Playback: bad args");
+			*err |= 8;
+		}
+		else if(!(buf = pool_alloc(STREAM_CHUNK)))
+		{
+			ESP_LOGW(TAG, "Playback: couldn't alloc buffer");
+			*err |= 8;
+		}
+	}
+	
+	/* drain what the client sends if we can't use it */
+	if(*err)
+	{
+		char dump[64];
+		while(left && ((len = socket_recv(rx, dump, sizeof(dump))) > 0))
+			if(left != STREAM_UNBOUNDED)
+				left -= (len < left) ? len : left;
+		goto reply;
+	}
+	
+	ESP_LOGI(TAG, "Playback: mode %d, base 0x%08X, size 0x%08X, len %d",
+		args.mode, args.base, args.size, left);
+	
+	start = esp_timer_get_time();
+	while(left || (fill > done))
+	{
+		/* refill when empty */
+		if((fill == done) && left)
+		{
+			n = (left < STREAM_CHUNK) ? left : STREAM_CHUNK;
+			if((len = socket_recv(rx, buf, n)) <= 0)
+				break;
+			if(left != STREAM_UNBOUNDED)
+				left -= len;
+			fill = len;
+			done = 0;
+		}
+		
+		/* FIFO only takes whole words - top up a partial one */
+		if((args.mode == STREAM_MODE_FIFO) && ((fill - done) < 4) && left)
+		{
+			memmove(buf, buf + done, fill - done);
+			fill -= done;
+			done = 0;
+			n = ((4 - fill) < left) ? (4 - fill) : left;
+			if((len = socket_recv(rx, buf + fill, n)) <= 0)
+				break;
+			if(left != STREAM_UNBOUNDED)
+				left -= len;
+			fill += len;
+			continue;
+		}
+		
+		/* how much room does the gateware have */
+		ICE_FPGA_Serial_Read(args.credit_reg, &reg);
+		if(reg & STREAM_XRUN_FLAG)
+			underruns++;
+		credit = reg & STREAM_PTR_MASK;
+		if(args.mode == STREAM_MODE_FIFO)
+			credit *= 4;
+		
+		n = fill - done;
+		if(args.mode == STREAM_MODE_FIFO)
+			n &= ~3;
+		if(n > credit)
+			n = credit;
+		if((args.mode == STREAM_MODE_RING) && (n > args.size - wptr))
+			n = args.size - wptr;
+		
+		/* a trailing partial word can never be written */
+		if(!n && (args.mode == STREAM_MODE_FIFO) && !left && ((fill - done) < 4))
+			break;
+		
+		/* full - hold off the sender */
+		if(!n)
+		{
+			if(!idle)
+			{
+				idle = esp_timer_get_time();
+				stalls++;
+			}
+			if((esp_timer_get_time() - idle) < STREAM_SPIN_US)
+				ets_delay_us(STREAM_POLL_US);
+			else if((esp_timer_get_time() - idle) > STREAM_STALL_US)
+			{
+				ESP_LOGW(TAG, "Playback: gateware stalled");
+				break;
+			}
+			else if(left && !rx->prelen && stream_peer_closed(rx->req->sock))
+			{
+				ESP_LOGW(TAG, "Playback: client went away");
+				break;
+			}
+			else
+				vTaskDelay(1);
+			continue;
+		}
+		idle = 0;
+		
+		if(args.mode == STREAM_MODE_RING)
+		{
+			ICE_PSRAM_Write(args.base + wptr, buf + done, n);
+			wptr = (wptr + n) % args.size;
+			ICE_FPGA_Serial_Write(args.wptr_reg, wptr);
+		}
+		else
+			ICE_FPGA_Burst_Write(args.base, buf + done, n);
+		
+		done += n;
+		total += n;
+	}
+	
+	elapsed = esp_timer_get_time() - start;
+	ESP_LOGI(TAG, "Playback: %d bytes in %d us, %d underruns, %d stalls",
+		total, elapsed, underruns, stalls);
+	if((left && (left != STREAM_UNBOUNDED)) || (fill > done))
+	{
+		ESP_LOGW(TAG, "Playback: ended early");
+		*err |= 8;
+	}
+	
+reply:
+	/* status, bytes, elapsed us, underruns, credit stalls, kB/s */
+	{
+		char rbuf[21];
+		uint32_t stats[5] = {total, elapsed, underruns, stalls,
+			elapsed ? (uint32_t)((1000ULL*total) / elapsed) : 0};
+		rbuf[0] = *err;
+		memcpy(&rbuf[1], stats, sizeof(stats));
+		socket_reply(rx->req, rbuf, sizeof(rbuf));
+	}
+	
+	if(buf)
+		pool_free(buf);
+}
+
+/*
+ * Send a PSRAM block after the status byte. SPI DMA into one buffer runs
+ * while the other is being sent.
+ */
+void stream_psram_read(const socket_req_t *req, char *err, uint32_t Addr, uint32_t size)
+{
+	const int sock = req->sock;
+	uint8_t *buf[2];
+	uint32_t n, len[2];
+	int cur = 0, pending = -1;
+	
+	buf[0] = buf[1] = NULL;
+	if((Addr > ICE_PSRAM_SZ) || (size > ICE_PSRAM_SZ - Addr))
+	{
+		ESP_LOGW(TAG, "PSRAM read error - 0x%08X + 0x%08X out of range", Addr, size);
+		*err |= 8;
+		socket_reply(req, err, 1);
+		return;
+	}
+	
+	buf[0] = pool_alloc(STREAM_CHUNK);
+	buf[1] = pool_alloc(STREAM_CHUNK);
+	if(!buf[0] || !buf[1])
+	{
+		ESP_LOGW(TAG, "PSRAM read error - couldn't alloc buffers");
+		*err |= 8;
+		socket_reply(req, err, 1);
+		goto done;
+	}
+	
+	/* once the header is out the length can't change so stop if the client goes */
+	if((socket_reply_hdr(req, 1 + size) < 0) || (socket_send(sock, err, 1) < 0))
+		goto done;
+	while(size || (pending >= 0))
+	{
+		n = (size > STREAM_CHUNK) ? STREAM_CHUNK : size;
+		if(n)
+			ICE_PSRAM_Read_Start(Addr, buf[cur], n);
+		
+		if((pending >= 0) && (socket_send(sock, buf[pending], len[pending]) < 0))
+		{
+			if(n)
+				ICE_Read_Wait();
+			ESP_LOGW(TAG, "PSRAM read - client went away with %d left", size);
+			break;
+		}
+		pending = -1;
+		
+		if(n)
+		{
+			ICE_Read_Wait();
+			len[cur] = n;
+			pending = cur;
+			cur ^= 1;
+			Addr += n;
+			size -= n;
+		}
+	}
+	
+done:
+	pool_free(buf[0]);
+	pool_free(buf[1]);
+}
+
+/*
+ * Write a PSRAM block as it arrives - address then data. Used for writes
+ * too big to be worth holding in a pool buffer.
+ */
+void stream_psram_write(socket_rx_t *rx, char *err, uint32_t txsz)
+{
+	uint8_t *buf = NULL, dump[64];
+	uint32_t Addr = 0, left = txsz, n;
+	int len, got = 0;
+	
+	while((got < 4) && left)
+	{
+		if((len = socket_recv(rx, (char *)&Addr + got, 4 - got)) <= 0)
+			break;
+		got += len;
+		left -= len;
+	}
+	
+	if((got < 4) || (Addr > ICE_PSRAM_SZ) || (left > ICE_PSRAM_SZ - Addr))
+	{
+		ESP_LOGW(TAG, "PSRAM write error - 0x%08X + 0x%08X out of range", Addr, left);
+		*err |= 8;
+	}
+	else if(!(buf = pool_alloc(STREAM_CHUNK)))
+	{
+		ESP_LOGW(TAG, "PSRAM write error - couldn't alloc buffer");
+		*err |= 8;
+	}
+	else
+		TRACE(PSRAM_WR, Addr, left);
+	
+	/* write it in, or drain it if something is already wrong */
+	while(left)
+	{
+		n = buf ? STREAM_CHUNK : sizeof(dump);
+		n = (left < n) ? left : n;
+		if((len = socket_recv(rx, buf ? buf : dump, n)) <= 0)
+			break;
+		left -= len;
+		if(buf)
+		{
+			ICE_PSRAM_Write(Addr, buf, len);
+			Addr += len;
+		}
+	}
+	
+	if(left)
+	{
+		ESP_LOGW(TAG, "PSRAM write - client went away with %d left", left);
+		*err |= 8;
+	}
+	
+	socket_reply(rx->req, err, 1);
+	
+	if(buf)
+		pool_free(buf);
+}
+
+/*
+ * check a scatter/gather list - count then addr, len pairs. Fills in the
+ * status of each entry and returns the count, or -1 if the list is bad.
+ */
+static int stream_sg_list(char *buffer, int txsz, uint32_t *status, uint32_t *bytes)
+{
+	uint32_t n, i;
+	stream_sg_t *sg = (stream_sg_t *)(buffer + 4);
+	
+	if(txsz < 4)
+		return -1;
+	n = *(uint32_t *)buffer;
+	if((n > STREAM_SG_MAX) || (4 + n * sizeof(stream_sg_t) > txsz))
+		return -1;
+	
+	*bytes = 0;
+	for(i = 0; i < n; i++)
+	{
+		if((sg[i].addr >= ICE_PSRAM_SZ) || (sg[i].len > ICE_PSRAM_SZ - sg[i].addr))
+			status[i] = STREAM_SG_RANGE;
+		else if(sg[i].len > STREAM_SG_BYTES_MAX - *bytes)
+			return -1;
+		else
+		{
+			status[i] = STREAM_SG_OK;
+			*bytes += sg[i].len;
+		}
+	}
+	
+	return n;
+}
+
+/*
+ * Read a list of PSRAM regions - reply is a status word per entry then the
+ * data of the good ones back to back. Small regions are packed into one
+ * buffer so they go out in as few sends as possible, and the buffer filled
+ * last is sent while the next one is read.
+ */
+void stream_psram_gather(const socket_req_t *req, char *err, char *buffer, int txsz)
+{
+	const int sock = req->sock;
+	stream_sg_t *sg = (stream_sg_t *)(buffer + 4);
+	uint8_t *buf[2];
+	uint32_t *status, bytes, fill, off = 0, piece, len[2];
+	int n, i, cur = 0, pending = -1;
+	
+	buf[0] = pool_alloc(STREAM_CHUNK);
+	buf[1] = pool_alloc(STREAM_CHUNK);
+	status = (uint32_t *)buf[1];
+	if(!buf[0] || !buf[1] || ((n = stream_sg_list(buffer, txsz, status, &bytes)) < 0))
+	{
+		ESP_LOGW(TAG, "PSRAM gather error - bad list or no buffers");
+		*err |= 8;
+		socket_reply(req, err, 1);
+		goto done;
+	}
+	TRACE(PSRAM_GATHER, n, bytes);
+	
+	if(socket_reply_hdr(req, 1 + n * 4 + bytes) || socket_send(sock, err, 1) ||
+		socket_send(sock, status, n * 4))
+		goto done;
+	
+	/* the status buffer is about to hold data - bad entries read nothing */
+	for(i = 0; i < n; i++)
+		if(status[i] != STREAM_SG_OK)
+			sg[i].len = 0;
+	
+	for(i = 0; (i < n) || (pending >= 0); )
+	{
+		/* pack regions until the buffer is full */
+		for(fill = 0; (i < n) && (fill < STREAM_CHUNK); )
+		{
+			piece = sg[i].len - off;
+			if(piece > STREAM_CHUNK - fill)
+				piece = STREAM_CHUNK - fill;
+			if(piece)
+			{
+				ICE_PSRAM_Read_Start(sg[i].addr + off, buf[cur] + fill, piece);
+				if((pending >= 0) && socket_send(sock, buf[pending], len[pending]))
+				{
+					ICE_Read_Wait();
+					goto gone;
+				}
+				pending = -1;
+				ICE_Read_Wait();
+				fill += piece;
+				off += piece;
+			}
+			if(off == sg[i].len)
+			{
+				off = 0;
+				i++;
+			}
+		}
+		
+		if((pending >= 0) && socket_send(sock, buf[pending], len[pending]))
+			goto gone;
+		pending = -1;
+		if(fill)
+		{
+			len[cur] = fill;
+			pending = cur;
+			cur ^= 1;
+		}
+	}
+	goto done;
+	
+gone:
+	ESP_LOGW(TAG, "PSRAM gather - client went away");
+	
+done:
+	pool_free(buf[0]);
+	pool_free(buf[1]);
+}
+
+/*
+ * Write a list of PSRAM regions - count, addr/len pairs then the data of
+ * all of them back to back. Reply is a status word per entry.
+ */
+void stream_psram_scatter(const socket_req_t *req, char *err, char *buffer, int txsz)
+{
+	stream_sg_t *sg = (stream_sg_t *)(buffer + 4);
+	uint8_t *rply = NULL, *data;
+	uint32_t *status, bytes, left;
+	int n = -1, i;
+	
+	if((rply = pool_alloc(1 + STREAM_SG_MAX * 4)))
+		n = stream_sg_list(buffer, txsz, (uint32_t *)(rply + 1), &bytes);
+	if(n < 0)
+	{
+		ESP_LOGW(TAG, "PSRAM scatter error - bad list or no buffer");
+		*err |= 8;
+		socket_reply(req, err, 1);
+		pool_free(rply);
+		return;
+	}
+	TRACE(PSRAM_SCATTER, n, bytes);
+	
+	/* data of bad entries is skipped so everything after still lines up */
+	status = (uint32_t *)(rply + 1);
+	data = (uint8_t *)&sg[n];
+	left = txsz - 4 - n * sizeof(stream_sg_t);
+	for(i = 0; i < n; i++)
+	{
+		if(sg[i].len > left)
+		{
+			status[i] = STREAM_SG_SHORT;
+			*err |= 8;
+			left = 0;
+			continue;
+		}
+		if((status[i] == STREAM_SG_OK) && sg[i].len)
+			ICE_PSRAM_Write(sg[i].addr, data, sg[i].len);
+		data += sg[i].len;
+		left -= sg[i].len;
+	}
+	if(left)
+		*err |= 2;
+	
+	rply[0] = *err;
+	socket_reply(req, rply, 1 + n * 4);
+	pool_free(rply);
+}
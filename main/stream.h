@@ -0,0 +1,56 @@
+/*
+ * stream.h - continuous FPGA <-> socket streaming
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __STREAM__
+#define __STREAM__
+
+#include "main.h"
+#include "socket.h"
+#include "pool.h"
+
+/* source/sink types */
+#define STREAM_MODE_RING	0	// PSRAM ring buffer
+#define STREAM_MODE_FIFO	1	// FPGA FIFO register
+
+/* flag in bit 31 of the FPGA pointer/level register, cleared on read */
+#define STREAM_XRUN_FLAG	0x80000000
+#define STREAM_PTR_MASK		0x00FFFFFF
+
+/* header of every capture frame, a zero len frame ends the stream */
+typedef struct
+{
+	uint32_t len;		// data bytes following
+	uint32_t overruns;	// running count
+} stream_frame_t;
+
+/* one pool slab including the frame header */
+#define STREAM_CHUNK		(POOL_MED_SZ - sizeof(stream_frame_t))
+
+/* playback txsz for a stream that runs until the client shuts down */
+#define STREAM_UNBOUNDED	0xFFFFFFFF
+
+/* scatter/gather entries per request and their status words */
+#define STREAM_SG_MAX		1024
+#define STREAM_SG_BYTES_MAX	ICE_PSRAM_SZ	// total of all regions
+#define STREAM_SG_OK		0
+#define STREAM_SG_RANGE		1	// runs past the end of PSRAM, skipped
+#define STREAM_SG_SHORT		2	// scatter data ran out, skipped
+
+/* one scatter/gather region */
+typedef struct
+{
+	uint32_t addr;
+	uint32_t len;
+} stream_sg_t;
+
+void stream_capture(const socket_req_t *req, char *err, char *buffer, int txsz);
+void stream_playback(socket_rx_t *rx, char *err, uint32_t txsz);
+void stream_psram_read(const socket_req_t *req, char *err, uint32_t Addr, uint32_t size);
+void stream_psram_write(socket_rx_t *rx, char *err, uint32_t txsz);
+void stream_psram_gather(const socket_req_t *req, char *err, char *buffer, int txsz);
+void stream_psram_scatter(const socket_req_t *req, char *err, char *buffer, int txsz);
+
+#endif
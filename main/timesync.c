@@ -0,0 +1,318 @@
+/*
+ * timesync.c - keeps an estimate of a host time server's clock, NTP style,
+ * so commands can be started at a given server time on many boards at
+ * once. Each sync is a burst of UDP exchanges keeping the one with the
+ * lowest round trip, which rejects most of the Wi-Fi jitter, and a line
+ * fitted through recent syncs gives the drift between them.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "timesync.h"
+#include "trace.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "timesync";
+
+#define TSYNC_TASK_PRIO		7		// above the executor so timestamps are tight
+#define TSYNC_RX_TIMEOUT_MS	200
+#define TSYNC_NOW_WAIT_MS	(TSYNC_BURST * TSYNC_RX_TIMEOUT_MS + 500)
+#define TSYNC_SPIN_US		200		// timer fires this early, the rest is polled
+
+/* one sync - board time and offset at it */
+typedef struct
+{
+	int64_t local;
+	int64_t offset;
+} tsync_sample_t;
+
+static TaskHandle_t tsync_task_handle, tsync_waiter;
+static SemaphoreHandle_t tsync_done;
+static esp_timer_handle_t tsync_timer;
+static portMUX_TYPE tsync_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* server settings and the fit - under tsync_mux */
+static uint32_t tsync_ip, tsync_port = TSYNC_PORT, tsync_interval_ms;
+static tsync_sample_t tsync_hist[TSYNC_HIST];
+static uint32_t tsync_nhist;
+static int64_t tsync_ref, tsync_offset, tsync_last;
+static double tsync_drift;
+static tsync_stats_t tsync_st;
+
+/*
+ * one request and its answer - 0 if it came back
+ */
+static int tsync_exchange(int sock, struct sockaddr_in *to, uint32_t seq,
+	int64_t *offset, uint32_t *rtt)
+{
+	tsync_pkt_t pkt = {TSYNC_MAGIC, seq};
+	int64_t t4;
+	int len;
+	
+	pkt.t1 = esp_timer_get_time();
+	if(sendto(sock, &pkt, sizeof(pkt), 0, (struct sockaddr *)to, sizeof(*to)) != sizeof(pkt))
+		return -1;
+	
+	/* drop late answers to earlier requests */
+	do
+	{
+		if((len = recv(sock, &pkt, sizeof(pkt), 0)) < 0)
+			return -1;
+		t4 = esp_timer_get_time();
+	}
+	while((len != sizeof(pkt)) || (pkt.magic != TSYNC_MAGIC) || (pkt.seq != seq));
+	
+	*offset = (((int64_t)pkt.t2 - (int64_t)pkt.t1) + ((int64_t)pkt.t3 - t4)) / 2;
+	*rtt = (t4 - (int64_t)pkt.t1) - (int64_t)(pkt.t3 - pkt.t2);
+	return 0;
+}
+
+/*
+ * add a sync and refit offset and drift by least squares
+ */
+static void tsync_fit(int64_t local, int64_t offset, uint32_t rtt)
+{
+	tsync_sample_t h[TSYNC_HIST];
+	double mx = 0, my = 0, sxy = 0, sxx = 0, dx, drift;
+	uint32_t i, n;
+	
+	portENTER_CRITICAL(&tsync_mux);
+	memmove(&tsync_hist[1], &tsync_hist[0], sizeof(tsync_sample_t) * (TSYNC_HIST - 1));
+	tsync_hist[0].local = local;
+	tsync_hist[0].offset = offset;
+	n = tsync_nhist = (tsync_nhist < TSYNC_HIST) ? tsync_nhist + 1 : TSYNC_HIST;
+	memcpy(h, tsync_hist, sizeof(h));
+	portEXIT_CRITICAL(&tsync_mux);
+	
+	/* relative to the newest sample so doubles keep the precision */
+	for(i = 0; i < n; i++)
+	{
+		mx += h[i].local - local;
+		my += h[i].offset - offset;
+	}
+	mx /= n;
+	my /= n;
+	for(i = 0; i < n; i++)
+	{
+		dx = (h[i].local - local) - mx;
+		sxy += dx * ((h[i].offset - offset) - my);
+		sxx += dx * dx;
+	}
+	drift = (sxx > 0) ? sxy / sxx : 0;
+	
+	portENTER_CRITICAL(&tsync_mux);
+	tsync_drift = drift;
+	tsync_ref = local;
+	tsync_offset = offset + (int64_t)(my - drift * mx);
+	tsync_last = local;
+	tsync_st.rtt_us = rtt;
+	tsync_st.syncs++;
+	portEXIT_CRITICAL(&tsync_mux);
+}
+
+/*
+ * a burst of exchanges, keeping the quickest
+ */
+static void tsync_sync(int sock, uint32_t *seq)
+{
+	struct sockaddr_in to = {.sin_family = AF_INET};
+	int64_t offset, best_offset = 0, local = 0;
+	uint32_t rtt, best_rtt = 0xFFFFFFFF;
+	int i;
+	
+	portENTER_CRITICAL(&tsync_mux);
+	to.sin_addr.s_addr = tsync_ip;
+	to.sin_port = htons(tsync_port);
+	portEXIT_CRITICAL(&tsync_mux);
+	
+	for(i = 0; i < TSYNC_BURST; i++)
+	{
+		if(tsync_exchange(sock, &to, ++*seq, &offset, &rtt))
+			continue;
+		if(rtt < best_rtt)
+		{
+			best_rtt = rtt;
+			best_offset = offset;
+			local = esp_timer_get_time();
+		}
+	}
+	
+	if(best_rtt == 0xFFFFFFFF)
+	{
+		ESP_LOGW(TAG, "No answer from server");
+		portENTER_CRITICAL(&tsync_mux);
+		tsync_st.fails++;
+		portEXIT_CRITICAL(&tsync_mux);
+		return;
+	}
+	
+	tsync_fit(local, best_offset, best_rtt);
+	TRACE(TSYNC, best_rtt, (uint32_t)best_offset);
+}
+
+/*
+ * sync every interval, or when asked
+ */
+static void tsync_task(void *pvParameters)
+{
+	struct timeval tv = {.tv_sec = 0, .tv_usec = TSYNC_RX_TIMEOUT_MS * 1000};
+	uint32_t seq = 0, ip, interval;
+	int sock = -1;
+	
+	while(1)
+	{
+		portENTER_CRITICAL(&tsync_mux);
+		ip = tsync_ip;
+		interval = tsync_interval_ms;
+		portEXIT_CRITICAL(&tsync_mux);
+		
+		if(ip && (sock < 0))
+		{
+			if((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP)) < 0)
+				ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+			else
+				setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		}
+		if(ip && (sock >= 0))
+			tsync_sync(sock, &seq);
+		xSemaphoreGive(tsync_done);
+		
+		ulTaskNotifyTake(pdTRUE, (ip && interval) ? pdMS_TO_TICKS(interval) : portMAX_DELAY);
+	}
+}
+
+/*
+ * wake the task waiting for its start time
+ */
+static void tsync_fire(void *arg)
+{
+	xTaskNotifyGive(tsync_waiter);
+}
+
+/*
+ * start the sync task - it does nothing until a server is set
+ */
+esp_err_t tsync_init(void)
+{
+	esp_timer_create_args_t args = {
+		.callback = tsync_fire,
+		.name = "tsync",
+	};
+	
+	if(!(tsync_done = xSemaphoreCreateBinary()))
+		return ESP_ERR_NO_MEM;
+	if(esp_timer_create(&args, &tsync_timer) != ESP_OK)
+		return ESP_FAIL;
+	if(xTaskCreate(tsync_task, "tsync", 3072, NULL, TSYNC_TASK_PRIO, &tsync_task_handle) != pdPASS)
+		return ESP_FAIL;
+	
+	return ESP_OK;
+}
+
+/*
+ * set the server and sync at once - ip 0 stops syncing and forgets the fit
+ */
+esp_err_t tsync_server(uint32_t ip, uint32_t port, uint32_t interval_ms)
+{
+	portENTER_CRITICAL(&tsync_mux);
+	if(ip != tsync_ip)
+		tsync_nhist = 0;
+	tsync_ip = ip;
+	tsync_port = port ? port : TSYNC_PORT;
+	tsync_interval_ms = interval_ms;
+	portEXIT_CRITICAL(&tsync_mux);
+	
+	ESP_LOGI(TAG, "Server 0x%08X port %d every %d ms", ip, tsync_port, interval_ms);
+	return ip ? tsync_now() : ESP_OK;
+}
+
+/*
+ * sync now and wait for it
+ */
+esp_err_t tsync_now(void)
+{
+	xSemaphoreTake(tsync_done, 0);
+	xTaskNotifyGive(tsync_task_handle);
+	if(xSemaphoreTake(tsync_done, pdMS_TO_TICKS(TSYNC_NOW_WAIT_MS)) != pdTRUE)
+		return ESP_ERR_TIMEOUT;
+	
+	return tsync_nhist ? ESP_OK : ESP_FAIL;
+}
+
+/*
+ * block until a server time - timer wakeup then a short spin. Returns
+ * once the time has come, or at once if it already has.
+ */
+esp_err_t tsync_wait(uint64_t server_us)
+{
+	int64_t now = esp_timer_get_time(), local, start;
+	int32_t err;
+	uint32_t abs_err;
+	
+	portENTER_CRITICAL(&tsync_mux);
+	if(!tsync_nhist)
+	{
+		portEXIT_CRITICAL(&tsync_mux);
+		return ESP_ERR_INVALID_STATE;
+	}
+	
+	/* board time for the server time, including drift since the fit */
+	local = (int64_t)server_us - tsync_offset;
+	local -= (int64_t)(tsync_drift * (local - tsync_ref));
+	portEXIT_CRITICAL(&tsync_mux);
+	
+	if(local - now > TSYNC_SCHED_MAX_US)
+		return ESP_ERR_INVALID_ARG;
+	
+	if(local - now > TSYNC_SPIN_US)
+	{
+		tsync_waiter = xTaskGetCurrentTaskHandle();
+		ulTaskNotifyTake(pdTRUE, 0);
+		esp_timer_start_once(tsync_timer, local - now - TSYNC_SPIN_US);
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	}
+	while((start = esp_timer_get_time()) < local);
+	
+	err = start - local;
+	abs_err = (err < 0) ? -err : err;
+	portENTER_CRITICAL(&tsync_mux);
+	tsync_st.sched++;
+	if(err > TSYNC_LATE_US)
+		tsync_st.late++;
+	tsync_st.last_err_us = err;
+	if(abs_err > tsync_st.max_err_us)
+		tsync_st.max_err_us = abs_err;
+	portEXIT_CRITICAL(&tsync_mux);
+	TRACE(SCHED, err, err > TSYNC_LATE_US);
+	
+	return ESP_OK;
+}
+
+/*
+ * report the fit and timed command errors
+ */
+int tsync_stats(uint8_t *buf, int max)
+{
+	tsync_stats_t st;
+	int64_t now = esp_timer_get_time();
+	
+	if(max < sizeof(tsync_stats_t))
+		return 0;
+	
+	portENTER_CRITICAL(&tsync_mux);
+	st = tsync_st;
+	st.offset_us = tsync_nhist ? tsync_offset + (int64_t)(tsync_drift * (now - tsync_ref)) : 0;
+	st.drift_ppb = tsync_drift * 1e9;
+	st.server = tsync_ip;
+	st.port = tsync_port;
+	st.interval_ms = tsync_interval_ms;
+	st.samples = tsync_nhist;
+	st.age_ms = tsync_nhist ? (now - tsync_last) / 1000 : 0;
+	portEXIT_CRITICAL(&tsync_mux);
+	
+	memcpy(buf, &st, sizeof(tsync_stats_t));
+	return sizeof(tsync_stats_t);
+}
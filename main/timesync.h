@@ -0,0 +1,59 @@
+/*
+ * timesync.h - clock sync with a host time server and timed commands
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __TIMESYNC__
+#define __TIMESYNC__
+
+#include "main.h"
+
+#define TSYNC_PORT			3334		// host server default
+#define TSYNC_MAGIC			0xCAFE7135
+#define TSYNC_BURST			8			// exchanges per sync, lowest round trip kept
+#define TSYNC_HIST			8			// syncs in the drift fit
+#define TSYNC_SCHED_MAX_US	(30*1000000)	// furthest ahead a command can wait
+#define TSYNC_LATE_US		500			// start error counted as late
+
+/* cmd 0x1e ops */
+#define TSYNC_OP_SERVER		0	// ip (network order), port, interval ms - ip 0 stops
+#define TSYNC_OP_NOW		1	// sync at once
+#define TSYNC_OP_STATUS		2
+
+/* UDP exchange - t1 is board time, t2/t3 server receive/send, all us */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t seq;
+	uint64_t t1;
+	uint64_t t2;
+	uint64_t t3;
+} tsync_pkt_t;
+
+/* status as reported by tsync_stats() */
+typedef struct
+{
+	int64_t offset_us;		// server time minus board time now
+	int32_t drift_ppb;		// server clock rate against ours
+	uint32_t rtt_us;		// best round trip of the last sync
+	uint32_t server;		// IPv4, network order
+	uint32_t port;
+	uint32_t interval_ms;
+	uint32_t samples;		// syncs in the fit, 0 until synced
+	uint32_t syncs;
+	uint32_t fails;
+	uint32_t age_ms;		// since the last good sync
+	uint32_t sched;			// timed commands run
+	uint32_t late;			// started more than TSYNC_LATE_US after their time
+	int32_t last_err_us;	// start minus target of the last one
+	uint32_t max_err_us;	// worst |start minus target|
+} tsync_stats_t;
+
+esp_err_t tsync_init(void);
+esp_err_t tsync_server(uint32_t ip, uint32_t port, uint32_t interval_ms);
+esp_err_t tsync_now(void);
+esp_err_t tsync_wait(uint64_t server_us);
+int tsync_stats(uint8_t *buf, int max);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * trace.c - binary trace ring. Records are a timestamp, an ID and two
+ * words so the command path pays for a few stores instead of formatting
+ * and printing. The ring is read out with cmd 0x11 and decoded on the host.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#include <string.h>
+#include "trace.h"
+#include "esp_timer.h"
+
+static trace_rec_t trace_ring[TRACE_RECORDS];
+static uint32_t trace_head, trace_tail;	// running counts, not indices
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+ * add a record, overwriting the oldest when full - not from ISRs
+ */
+void trace_put(uint32_t id, uint32_t a, uint32_t b)
+{
+	uint32_t ts = esp_timer_get_time();
+	trace_rec_t *r;
+	
+	portENTER_CRITICAL(&trace_mux);
+	r = &trace_ring[trace_head++ & (TRACE_RECORDS-1)];
+	r->ts = ts;
+	r->id = id;
+	r->a = a;
+	r->b = b;
+	portEXIT_CRITICAL(&trace_mux);
+}
+
+/*
+ * copy out the header and records oldest first, optionally emptying the
+ * ring. Returns the size.
+ */
+int trace_dump(uint8_t *buf, int max, int clear)
+{
+	trace_hdr_t hdr;
+	uint32_t first, n, part;
+	
+	if(max < sizeof(trace_hdr_t) + sizeof(trace_ring))
+		return 0;
+	
+	portENTER_CRITICAL(&trace_mux);
+	hdr.now = esp_timer_get_time();
+	hdr.count = trace_head - trace_tail;
+	hdr.lost = 0;
+	if(hdr.count > TRACE_RECORDS)
+	{
+		hdr.lost = hdr.count - TRACE_RECORDS;
+		hdr.count = TRACE_RECORDS;
+	}
+	
+	/* may wrap at the end of the array */
+	first = (trace_head - hdr.count) & (TRACE_RECORDS-1);
+	n = hdr.count;
+	part = (first + n > TRACE_RECORDS) ? TRACE_RECORDS - first : n;
+	memcpy(buf + sizeof(trace_hdr_t), &trace_ring[first], part * sizeof(trace_rec_t));
+	memcpy(buf + sizeof(trace_hdr_t) + part * sizeof(trace_rec_t), trace_ring,
+		(n - part) * sizeof(trace_rec_t));
+	
+	if(clear)
+		trace_tail = trace_head;
+	portEXIT_CRITICAL(&trace_mux);
+	
+	memcpy(buf, &hdr, sizeof(trace_hdr_t));
+	return sizeof(trace_hdr_t) + n * sizeof(trace_rec_t);
+}
@@ -0,0 +1,49 @@
+/*
+ * trace.h - binary trace ring for the command path
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+#ifndef __TRACE__
+#define __TRACE__
+
+#include "main.h"
+
+#define TRACE_RECORDS		256		// power of 2
+
+/* event IDs - TRACE_HDR, TRACE_EXEC... */
+enum
+{
+#define TRACE_ID(name, str, a, b) TRACE_##name,
+#include "trace_ids.h"
+#undef TRACE_ID
+	TRACE_ID_COUNT
+};
+
+/* one event */
+typedef struct
+{
+	uint32_t ts;		// esp_timer_get_time() low word
+	uint32_t id;
+	uint32_t a;
+	uint32_t b;
+} trace_rec_t;
+
+/* start of a dump, followed by count records oldest first */
+typedef struct
+{
+	uint32_t now;		// timestamp at the dump
+	uint32_t lost;		// overwritten since the last clear
+	uint32_t count;
+} trace_hdr_t;
+
+#ifdef CONFIG_ICE_TRACE
+#define TRACE(id, a, b)		trace_put(TRACE_##id, (uint32_t)(a), (uint32_t)(b))
+#else
+#define TRACE(id, a, b)
+#endif
+
+void trace_put(uint32_t id, uint32_t a, uint32_t b);
+int trace_dump(uint8_t *buf, int max, int clear);
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * trace_ids.h - trace event IDs with their names and argument names.
+ * Included with TRACE_ID() defined to expand the list - the host decoder
+ * uses the same file so keep it free of anything but TRACE_ID() lines.
+ * New IDs go on the end so older dumps still decode.
+ * part of ICE-V_WiFiMgr
+ * 10-19-26
+ */
+
+TRACE_ID(HDR,		"header",		"cmd",		"txsz")
+TRACE_ID(EXEC,		"exec",			"cmd",		"tag")
+TRACE_ID(REPLY,		"reply",		"err",		"len")
+TRACE_ID(DONE,		"done",			"cmd",		"us")
+TRACE_ID(STREAM,	"stream",		"cmd",		"txsz")
+TRACE_ID(BAD_HDR,	"bad_header",	"word",		"0")
+TRACE_ID(CONNECT,	"connect",		"ip",		"sock")
+TRACE_ID(CLOSE,		"close",		"sock",		"keep")
+TRACE_ID(REG_RD,	"reg_read",		"reg",		"value")
+TRACE_ID(REG_WR,	"reg_write",	"reg",		"value")
+TRACE_ID(REG_WAIT,	"reg_wait",		"reg",		"us")
+TRACE_ID(VBAT,		"vbat",			"mv",		"0")
+TRACE_ID(SEQ,		"sequence",		"status",	"us")
+TRACE_ID(PSRAM_RD,	"psram_read",	"addr",		"len")
+TRACE_ID(PSRAM_WR,	"psram_write",	"addr",		"len")
+TRACE_ID(PSRAM_GATHER,	"psram_gather",	"count",	"bytes")
+TRACE_ID(PSRAM_SCATTER,	"psram_scatter",	"count",	"bytes")
+TRACE_ID(PSRAM_FILL,	"psram_fill",	"addr",		"len")
+TRACE_ID(PSRAM_COPY,	"psram_copy",	"dst",		"len")
+TRACE_ID(PSRAM_CRC,	"psram_crc",	"addr",		"len")
+TRACE_ID(CONFIG,	"config",		"status",	"bytes")
+TRACE_ID(PS_MODE,	"ps_mode",		"mode",		"0")
+TRACE_ID(TSYNC,		"time_sync",	"rtt_us",	"offset")
+TRACE_ID(SCHED,		"timed_start",	"err_us",	"late")
+TRACE_ID(BITSTREAM,	"bitstream_bad",	"result",	"offset")
@@ -22,6 +22,8 @@
 #include "wifi_manager.h"
 #include "socket.h"
 #include "mdns.h"
+#include "ps.h"
+#include "esp_timer.h"
 
 #include "esp_idf_version.h"
 
@@ -33,12 +35,138 @@ extern void phy_bbpll_en_usb(bool en);
 
 static const char *TAG = "wifi";
 
+#define WIFI_FAST_NS		"fastconn"
+#define WIFI_FAST_KEY		"last"
+
+/* last good connection - kept in NVS for a directed connect next boot */
+typedef struct
+{
+	uint8_t ssid[32];
+	uint8_t bssid[6];
+	uint8_t channel;
+	uint8_t pad;
+	esp_netif_ip_info_t ip_info;
+	uint32_t dns;
+} wifi_fast_t;
+
+static wifi_fast_t wifi_fast;
+static uint8_t wifi_fast_valid, wifi_fast_try;
+static int64_t wifi_start_us;
+
+/* manager settings the fast connect replaced */
+static wifi_scan_method_t wifi_scan_method;
+static uint8_t wifi_channel;
+
+/* CRC32 of the running design for the mDNS TXT record, 0 if none */
+static uint32_t wifi_design_crc;
+static uint8_t wifi_mdns_up;
+
 /******************************************************************************/
 /* API                                                                        */
 /******************************************************************************/
 /* wifi connection state */
 uint8_t wifi_connected = 0;
 
+/*
+ * put back the manager's own scan settings so later reconnects can roam
+ */
+static void wifi_fast_restore(void)
+{
+	wifi_config_t *cfg = wifi_manager_get_wifi_sta_config();
+	
+	cfg->sta.bssid_set = 0;
+	cfg->sta.channel = wifi_channel;
+	cfg->sta.scan_method = wifi_scan_method;
+}
+
+/*
+ * remember the connection that just came up - only written when it changes
+ */
+static void wifi_fast_save(const esp_netif_ip_info_t *ip_info)
+{
+	wifi_fast_t f;
+	wifi_ap_record_t ap;
+	esp_netif_dns_info_t dns;
+	nvs_handle handle;
+	esp_err_t ret;
+	
+	if(esp_wifi_sta_get_ap_info(&ap) != ESP_OK)
+		return;
+	
+	memset(&f, 0, sizeof(wifi_fast_t));
+	memcpy(f.ssid, wifi_manager_get_wifi_sta_config()->sta.ssid, sizeof(f.ssid));
+	memcpy(f.bssid, ap.bssid, sizeof(f.bssid));
+	f.channel = ap.primary;
+	f.ip_info = *ip_info;
+	if(esp_netif_get_dns_info(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"),
+		ESP_NETIF_DNS_MAIN, &dns) == ESP_OK)
+		f.dns = dns.ip.u_addr.ip4.addr;
+	
+	if(wifi_fast_valid && !memcmp(&f, &wifi_fast, sizeof(wifi_fast_t)))
+		return;
+	
+	if((ret = nvs_open(WIFI_FAST_NS, NVS_READWRITE, &handle)) == ESP_OK)
+	{
+		if((ret = nvs_set_blob(handle, WIFI_FAST_KEY, &f, sizeof(wifi_fast_t))) == ESP_OK)
+			ret = nvs_commit(handle);
+		nvs_close(handle);
+	}
+	if(ret == ESP_OK)
+	{
+		wifi_fast = f;
+		wifi_fast_valid = 1;
+		ESP_LOGI(TAG, "Saved fast connect to channel %d", f.channel);
+	}
+	else
+		ESP_LOGW(TAG, "Couldn't save fast connect: %d", ret);
+}
+
+/**
+ * @brief the manager is about to connect with its saved credentials.
+ */
+void cb_restore(void *pvParameter){
+	wifi_config_t *cfg = wifi_manager_get_wifi_sta_config();
+	size_t sz = sizeof(wifi_fast_t);
+	nvs_handle handle;
+	
+	wifi_scan_method = cfg->sta.scan_method;
+	wifi_channel = cfg->sta.channel;
+	
+#ifdef CONFIG_ICE_FAST_CONNECT
+	/* last connection is only any use for the same network */
+	if(nvs_open(WIFI_FAST_NS, NVS_READONLY, &handle) == ESP_OK)
+	{
+		wifi_fast_valid = (nvs_get_blob(handle, WIFI_FAST_KEY, &wifi_fast, &sz) == ESP_OK) &&
+			(sz == sizeof(wifi_fast_t));
+		nvs_close(handle);
+	}
+	if(!wifi_fast_valid || memcmp(wifi_fast.ssid, cfg->sta.ssid, sizeof(wifi_fast.ssid)))
+		return;
+	
+	/* straight to the AP we used last time, only scanning its channel */
+	cfg->sta.bssid_set = 1;
+	memcpy(cfg->sta.bssid, wifi_fast.bssid, sizeof(wifi_fast.bssid));
+	cfg->sta.channel = wifi_fast.channel;
+	cfg->sta.scan_method = WIFI_FAST_SCAN;
+	wifi_fast_try = 1;
+	
+#ifdef CONFIG_ICE_FAST_CONNECT_STATIC_IP
+	/* the got IP event comes as soon as we associate */
+	esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+	esp_netif_dns_info_t dns = {0};
+	esp_netif_dhcpc_stop(netif);
+	esp_netif_set_ip_info(netif, &wifi_fast.ip_info);
+	dns.ip.type = ESP_IPADDR_TYPE_V4;
+	dns.ip.u_addr.ip4.addr = wifi_fast.dns;
+	esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns);
+#endif
+	
+	ESP_LOGI(TAG, "Fast connect to %02X:%02X:%02X:%02X:%02X:%02X on channel %d",
+		wifi_fast.bssid[0], wifi_fast.bssid[1], wifi_fast.bssid[2],
+		wifi_fast.bssid[3], wifi_fast.bssid[4], wifi_fast.bssid[5], wifi_fast.channel);
+#endif
+}
+
 /**
  * @brief things we do when the connection comes up.
  */
@@ -51,6 +179,25 @@ void cb_connected(void *pvParameter){
 
 	ESP_LOGI(TAG, "Connected - IP = %s", str_ip);
 	
+	/* first connection after boot - how long did it take */
+	if(wifi_start_us)
+	{
+		int64_t now = esp_timer_get_time();
+		ESP_LOGI(TAG, "Associated in %d ms by %s, %d ms after boot",
+			(int)((now - wifi_start_us) / 1000), wifi_fast_try ? "fast connect" : "scan",
+			(int)(now / 1000));
+		wifi_start_us = 0;
+	}
+	if(wifi_fast_try)
+	{
+		wifi_fast_restore();
+		wifi_fast_try = 0;
+	}
+	
+#ifdef CONFIG_ICE_FAST_CONNECT
+	wifi_fast_save(&param->ip_info);
+#endif
+	
 	wifi_connected = 1;
 }
 
@@ -60,6 +207,17 @@ void cb_connected(void *pvParameter){
 void cb_disconnected(void *pvParameter){
 	ESP_LOGI(TAG, "Disconnected");
 	
+	/* AP moved or went away - the manager's retry does a full scan */
+	if(wifi_fast_try)
+	{
+		ESP_LOGW(TAG, "Fast connect failed - falling back to scan");
+		wifi_fast_restore();
+#ifdef CONFIG_ICE_FAST_CONNECT_STATIC_IP
+		esp_netif_dhcpc_start(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"));
+#endif
+		wifi_fast_try = 0;
+	}
+	
 	wifi_connected = 0;
 }
 
@@ -76,11 +234,17 @@ esp_err_t wifi_init(void)
 	
 	/* start the wifi manager */
 	ESP_LOGI(TAG, "Starting WiFi Manager.");
+	wifi_start_us = esp_timer_get_time();
 	wifi_manager_start();
 
-	/* register callback for the connection status */
+	/*
+	 * register callback for the connection status - the manager only has
+	 * somewhere to put them once started. If it gets to its restore first
+	 * this boot just connects by scanning.
+	 */
 	/* Note - for some reason the log prints don't work here */
 	ESP_LOGI(TAG, "Registering Callbacks.");
+	wifi_manager_set_callback(WM_ORDER_LOAD_AND_RESTORE_STA, &cb_restore);
 	wifi_manager_set_callback(WM_EVENT_STA_GOT_IP, &cb_connected);
 	wifi_manager_set_callback(WM_EVENT_STA_DISCONNECTED, &cb_disconnected);
 	ESP_LOGI(TAG, "Registered Callbacks.");
@@ -96,7 +260,20 @@ esp_err_t wifi_init(void)
     ESP_ERROR_CHECK( mdns_init() );
 	ESP_ERROR_CHECK( mdns_hostname_set("ICE-V") );
 	ESP_ERROR_CHECK( mdns_instance_name_set("ESP32C3 + FPGA") );
-    ESP_ERROR_CHECK( mdns_service_add(NULL, "_FPGA", "_tcp", 3333, NULL, 0)  );
+	
+	/* TXT lets fleet tools skip boards already running a design */
+	char crc_str[12];
+	snprintf(crc_str, sizeof(crc_str), "%08X", wifi_design_crc);
+	mdns_txt_item_t txt[] = {
+		{"fw", fwVersionStr},
+		{"crc", crc_str},
+	};
+    ESP_ERROR_CHECK( mdns_service_add(NULL, "_FPGA", "_tcp", 3333, txt, 2)  );
+	wifi_mdns_up = 1;
+	
+	/* power save follows socket activity from here on */
+	if(ps_init() != ESP_OK)
+		ESP_LOGW(TAG, "Power save governor not running");
 	
 	/* whatever else you want running on top of WiFi */
 	ESP_LOGI(TAG, "Setting up TCP socket server.");
@@ -105,6 +282,22 @@ esp_err_t wifi_init(void)
 	return ret;
 }
 
+/*
+ * note the design now in the FPGA - 0 if configuring failed
+ */
+void wifi_set_design(uint32_t crc)
+{
+	char crc_str[12];
+	
+	wifi_design_crc = crc;
+	if(!wifi_mdns_up)
+		return;
+	
+	snprintf(crc_str, sizeof(crc_str), "%08X", crc);
+	if(mdns_service_txt_item_set("_FPGA", "_tcp", "crc", crc_str) != ESP_OK)
+		ESP_LOGW(TAG, "Couldn't update mDNS TXT");
+}
+
 /*
  * get RSSI
  */
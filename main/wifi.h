@@ -11,5 +11,6 @@
 esp_err_t wifi_init(void);
 int8_t wifi_get_rssi(void);
 void wifi_reset_credentials(void);
+void wifi_set_design(uint32_t crc);
 
 #endif